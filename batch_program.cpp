@@ -0,0 +1,391 @@
+#include "batch_program.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define SCRATCH 15  // Register kept free for negation's zero
+
+BatchProgram::BatchProgram(Node *parse_tree_head, SimdLevel level)
+{
+    this->parse_tree_head = parse_tree_head;
+    this->level = level;
+}
+
+BatchProgram::~BatchProgram()
+{
+    if (program != nullptr)
+        CodeArena::instance().release(program);
+
+    if (scalar != nullptr)
+    {
+        scalar->release();
+        delete scalar;
+    }
+}
+
+SimdLevel BatchProgram::best_simd_level()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return SimdLevel::SSE41;
+    return SimdLevel::SCALAR;
+}
+
+int BatchProgram::length() const
+{
+    return (scalar != nullptr) ? scalar->length() : program_offset;
+}
+
+int BatchProgram::width() const
+{
+    switch (level)
+    {
+    case SimdLevel::AVX2:
+        return 8;
+    case SimdLevel::SSE41:
+        return 4;
+    default:
+        return 1;
+    }
+}
+
+bool BatchProgram::vectorizable(Node *n, int &depth)
+{
+    // Same post-order as traverse(), so slots come out in the same order
+    // EncodedProgram would give them.
+    if (n->child != nullptr && !vectorizable(n->child, depth))
+        return false;
+
+    switch (n->token.id)
+    {
+    case (TypeID::IDENT):
+        if (std::find(variable_handles.begin(), variable_handles.end(), n->token.text) == variable_handles.end())
+        {
+            variable_handles.push_back(n->token.text);
+            variable_names.emplace_back(n->token.value());
+        }
+        // Fall through, a variable is pushed just like a constant.
+    case (TypeID::INTEGER):
+        if (n->token.i_value > INT32_MAX)
+            return false;   // Let the scalar program report it.
+        depth++;
+        if (depth > MAX_STACK)
+            return false;
+        break;
+
+    case ('+'):
+    case ('-'):
+    case ('*'):
+    case ('^'):
+        depth--;
+        break;
+
+    case (TypeID::NEGATE):
+    case (TypeID::UPLUS):
+        break;
+
+    default:    // Division, mod, or something we don't know.
+        return false;
+    }
+
+    if (n->sibling != nullptr && !vectorizable(n->sibling, depth))
+        return false;
+
+    return true;
+}
+
+void BatchProgram::assemble()
+{
+    int depth = 0;
+    if (level == SimdLevel::SCALAR || !vectorizable(parse_tree_head, depth))
+    {
+        level = SimdLevel::SCALAR;
+        scalar = new EncodedProgram(parse_tree_head);
+        scalar->assemble();
+        variable_names = scalar->variables();
+        return;
+    }
+
+    program = CodeArena::instance().allocate();
+    if (program == nullptr)
+    {
+        perror("mmap");
+        throw "Failed to allocate memory for program!";
+    }
+
+    try
+    {
+        encode_loop();
+    }
+    catch (CodeBufferFull &e)
+    {
+        throw ParseException("Expression is too large, its code doesn't fit in " + std::to_string(PROGRAM_SIZE)
+            + " bytes.", parse_tree_head->token);
+    }
+}
+
+void BatchProgram::encode_loop()
+{
+    // RDI = columns, RSI = out, RDX = rows, RCX = current row.
+    X86Assembler as = x86();
+    Label loop_start;
+    Label done;
+    as.xor_(Width::D, Reg::RCX, Reg::RCX);
+    as.test(Width::Q, Reg::RDX, Reg::RDX);
+    as.jcc(Cond::E, done);
+
+    as.bind(loop_start);
+    traverse(parse_tree_head);
+
+    // The result is in register 0.
+    // MOVDQU [RSI + RCX*4], ymm0/xmm0
+    vector_prefix(1, 2, 0, 0, 0);
+    ENCODE 0x7f;
+    ENCODE 0x04;    // [SIB]
+    ENCODE 0x8e;    // RSI + RCX*4
+
+    as.add(Width::Q, Reg::RCX, width());
+    as.cmp(Width::Q, Reg::RCX, Reg::RDX);
+    as.jcc(Cond::B, loop_start);
+    as.bind(done);
+
+    // Avoid AVX-SSE transition penalties in our caller.
+    if (level == SimdLevel::AVX2)
+        as.vzeroupper();
+    as.ret();
+
+    // Constant pool, after the code so it never sits in the loop's path.
+    while (program_offset % 4 != 0)
+        as.int3();
+
+    std::map<int32_t, int> pool;
+    for (auto &fixup : constant_fixups)
+    {
+        if (pool.find(fixup.second) == pool.end())
+        {
+            pool[fixup.second] = program_offset;
+            encode_imm32(fixup.second);
+        }
+
+        int32_t displacement = pool[fixup.second] - (fixup.first + 4);
+        memcpy(program + fixup.first, &displacement, 4);
+    }
+}
+
+void BatchProgram::evaluate(const int *const *columns, int *out, size_t rows,
+    std::vector<std::pair<size_t, ExecutionException>> *failures)
+{
+    if (scalar != nullptr)
+    {
+        std::vector<int64_t> values(variable_names.size());
+        for (size_t row = 0; row < rows; row++)
+        {
+            for (size_t slot = 0; slot < values.size(); slot++)
+                values[slot] = columns[slot][row];
+            try
+            {
+                out[row] = scalar->run(values.data());
+            }
+            catch (ExecutionException &e)
+            {
+                if (failures == nullptr)
+                    throw;
+                out[row] = 0;
+                failures->push_back({row, e});
+            }
+        }
+        return;
+    }
+
+    size_t w = width();
+    size_t full_rows = rows - rows % w;
+    ((CompiledBatch)program)(columns, out, full_rows);
+
+    if (full_rows == rows)
+        return;
+
+    // Leftover rows are copied into one padded block and run as a full
+    // iteration, so the loop never needs a scalar tail of its own.
+    size_t tail = rows - full_rows;
+    std::vector<int> tail_values(variable_names.size() * w, 0);
+    std::vector<const int *> tail_columns(variable_names.size());
+    for (size_t slot = 0; slot < variable_names.size(); slot++)
+    {
+        memcpy(&tail_values[slot * w], columns[slot] + full_rows, tail * sizeof(int));
+        tail_columns[slot] = &tail_values[slot * w];
+    }
+
+    int tail_out[8];
+    ((CompiledBatch)program)(tail_columns.data(), tail_out, w);
+    memcpy(out + full_rows, tail_out, tail * sizeof(int));
+}
+
+void BatchProgram::traverse(Node *n)
+{
+    if (n->child != nullptr)
+    {
+        traverse(n->child);
+    }
+
+    // The operand stack is registers 0..stack_depth-1, the top being
+    // stack_depth-1.
+    uint8_t top = stack_depth - 1;
+
+    switch (n->token.id)
+    {
+    case (TypeID::INTEGER):
+        vector_broadcast(n->token.i_value, stack_depth++);
+        break;
+
+    case (TypeID::IDENT):
+        vector_load_column(std::find(variable_handles.begin(), variable_handles.end(), n->token.text) - variable_handles.begin(),
+            stack_depth++);
+        break;
+
+    case ('+'):
+        vector_binary(1, 0xfe, top - 1, top);    // PADDD
+        stack_depth--;
+        break;
+
+    case ('-'):
+        vector_binary(1, 0xfa, top - 1, top);    // PSUBD
+        stack_depth--;
+        break;
+
+    case ('*'):
+        vector_binary(2, 0x40, top - 1, top);    // PMULLD
+        stack_depth--;
+        break;
+
+    case ('^'):
+        // Exponentiation isn't implemented yet; like the JIT, keep the left operand.
+        stack_depth--;
+        break;
+
+    case (TypeID::NEGATE):
+        // scratch = 0, then top = scratch - top.
+        vector_binary(1, 0xef, SCRATCH, SCRATCH);   // PXOR
+        if (level == SimdLevel::AVX2)
+        {
+            // VPSUBD top, scratch, top
+            vector_prefix(1, 1, top, SCRATCH, top);
+            ENCODE 0xfa;
+            ENCODE 0xc0 + ((top & 7) << 3) + (top & 7);
+        }
+        else
+        {
+            vector_binary(1, 0xfa, SCRATCH, top);   // PSUBD scratch, top
+            vector_prefix(1, 1, top, 0, SCRATCH);   // MOVDQA top, scratch
+            ENCODE 0x6f;
+            ENCODE 0xc0 + ((top & 7) << 3) + (SCRATCH & 7);
+        }
+        break;
+
+    case (TypeID::UPLUS):
+        break;
+
+    default:
+        throw ParseException("Encountered unsupported symbol during batch assembly.", n->token);
+    }
+
+    if (n->sibling != nullptr)
+    {
+        traverse(n->sibling);
+    }
+}
+
+void BatchProgram::vector_prefix(uint8_t map, uint8_t pp, uint8_t reg, uint8_t src1, uint8_t rm)
+{
+    if (level == SimdLevel::AVX2)
+    {
+        uint8_t r = (reg & 8) ? 0 : 0x80;      // VEX stores R and B inverted
+        uint8_t b = (rm & 8) ? 0 : 0x20;
+        uint8_t vvvv = (~src1 & 0xf) << 3;
+        uint8_t l_pp = 0x04 | pp;               // L = 1, 256-bit
+
+        if (map == 1 && b)
+        {
+            // Two byte VEX
+            ENCODE 0xc5;
+            ENCODE r | vvvv | l_pp;
+        }
+        else
+        {
+            // Three byte VEX, X is never needed (W = 0)
+            ENCODE 0xc4;
+            ENCODE r | 0x40 | b | map;
+            ENCODE vvvv | l_pp;
+        }
+        return;
+    }
+
+    if (pp == 1)
+        ENCODE 0x66;
+    else if (pp == 2)
+        ENCODE 0xf3;
+
+    if ((reg & 8) || (rm & 8))
+        ENCODE 0x40 | ((reg & 8) ? 0x04 : 0) | ((rm & 8) ? 0x01 : 0);   // REX.R / REX.B
+
+    ENCODE 0x0f;
+    if (map == 2)
+        ENCODE 0x38;
+}
+
+void BatchProgram::vector_binary(uint8_t map, uint8_t opcode, uint8_t dst, uint8_t src)
+{
+    vector_prefix(map, 1, dst, dst, src);
+    ENCODE opcode;
+    ENCODE 0xc0 + ((dst & 7) << 3) + (src & 7);
+}
+
+void BatchProgram::vector_load_column(int slot, uint8_t dst)
+{
+    x86().mov(Width::Q, Reg::RAX, Mem(Reg::RDI, slot * 8));
+
+    // MOVDQU dst, [RAX + RCX*4]
+    vector_prefix(1, 2, dst, 0, 0);
+    ENCODE 0x6f;
+    ENCODE 0x04 + ((dst & 7) << 3);     // [SIB]
+    ENCODE 0x88;                        // RAX + RCX*4
+}
+
+void BatchProgram::vector_broadcast(int32_t value, uint8_t dst)
+{
+    if (level == SimdLevel::AVX2)
+    {
+        // VPBROADCASTD dst, [RIP + disp32]
+        vector_prefix(2, 1, dst, 0, 0);
+        ENCODE 0x58;
+    }
+    else
+    {
+        // MOVD dst, [RIP + disp32]
+        vector_prefix(1, 1, dst, 0, 0);
+        ENCODE 0x6e;
+    }
+
+    ENCODE 0x05 + ((dst & 7) << 3);     // RIP-relative
+    constant_fixups.push_back({program_offset, value});
+    encode_imm32(0);
+
+    if (level == SimdLevel::SSE41)
+    {
+        // PSHUFD dst, dst, 0
+        vector_prefix(1, 1, dst, 0, dst);
+        ENCODE 0x70;
+        ENCODE 0xc0 + ((dst & 7) << 3) + (dst & 7);
+        ENCODE 0x00;
+    }
+}
+
+void BatchProgram::encode_imm32(int32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        ENCODE value & 0xff;
+        value >>= 8;
+    }
+}
@@ -0,0 +1,134 @@
+/**
+ * @file batch_program.h
+ * @author Jake Rogers (z1826513)
+ *
+ * A BatchProgram assembles an arithmetic expression into a SIMD loop that
+ * evaluates it over whole columns of int32 values at once: one input column
+ * per variable, one output column for the results.
+ *
+ * With AVX2 each iteration handles 8 rows in ymm registers, with SSE4.1 it
+ * handles 4 rows in xmm registers. The expression's operand stack lives
+ * entirely in vector registers (the last one is kept free as scratch), so an
+ * iteration is nothing but loads, arithmetic and a single store.
+ *
+ * +, -, *, negation and uplus map straight onto vector instructions. x86 has
+ * no packed integer division, so expressions using / or mod (or ones too deep
+ * for the register stack) fall back to calling the scalar JIT once per row,
+ * which keeps their results (and traps) identical to EncodedProgram.
+ */
+
+#ifndef BATCH_PROGRAM_H
+#define BATCH_PROGRAM_H
+
+#include <map>
+#include <vector>
+
+#include "encoded_program.h"
+
+// Signature of an assembled batch loop. 'rows' must be a multiple of the
+// vector width; BatchProgram::evaluate handles any leftover rows.
+typedef void (*CompiledBatch)(const int* const* columns, int* out, size_t rows);
+
+enum class SimdLevel
+{
+    SCALAR,     // No vector code, one JIT call per row
+    SSE41,      // 4 rows per iteration
+    AVX2        // 8 rows per iteration
+};
+
+class BatchProgram
+{
+public:
+    // Create a batch program for the expression in parse_tree_head, using
+    // the given instruction set (by default, the best the CPU supports).
+    BatchProgram(Node* parse_tree_head, SimdLevel level = best_simd_level());
+
+    // Frees the program's memory.
+    ~BatchProgram();
+
+    // Encode the loop for the expression. If the expression can't be
+    // vectorized, a scalar EncodedProgram is assembled instead and
+    // get_level() reports SCALAR. Throws a ParseException if the code would
+    // overflow the program buffer.
+    void assemble();
+
+    // Evaluate the expression for 'rows' rows. columns[slot] points to the
+    // values of the variable in that slot (see variables()), and out receives
+    // one result per row. A row which fails (only possible for the scalar
+    // fallback, e.g. dividing by zero) throws, or with 'failures' is added to
+    // it, in row order, and the rest still run.
+    void evaluate(const int* const* columns, int* out, size_t rows,
+        std::vector<std::pair<size_t, ExecutionException>>* failures = nullptr);
+
+    inline const std::vector<std::string>& variables() const {return variable_names;}
+    inline SimdLevel get_level() const {return level;}
+
+    // Size of the encoded loop, or of the scalar program when falling back.
+    int length() const;
+
+    // Rows handled per iteration of the loop.
+    int width() const;
+
+    // The widest instruction set this CPU supports.
+    static SimdLevel best_simd_level();
+
+private:
+    // Check the tree only uses vectorizable operations and fits in the
+    // register stack, and assign variable slots along the way.
+    bool vectorizable(Node* n, int& depth);
+
+    // Post-order traversal emitting the body of the loop.
+    void traverse(Node* n);
+
+    // Emit the prefix for a vector instruction. With AVX2 this is a VEX
+    // prefix (map 1 = 0F, 2 = 0F38; pp 1 = 66, 2 = F3), with SSE4.1 the
+    // legacy prefix, REX if needed, and the escape bytes. 'src1' is only
+    // used by VEX's non-destructive three-operand form.
+    void vector_prefix(uint8_t map, uint8_t pp, uint8_t reg, uint8_t src1, uint8_t rm);
+
+    // dst = dst <op> src, for a packed-dword opcode such as 0xfe (paddd).
+    void vector_binary(uint8_t map, uint8_t opcode, uint8_t dst, uint8_t src);
+
+    // Load the current rows of the column for 'slot' into register 'dst'.
+    void vector_load_column(int slot, uint8_t dst);
+
+    // Fill register 'dst' with copies of 'value', from the constant pool.
+    void vector_broadcast(int32_t value, uint8_t dst);
+
+    void encode_imm32(int32_t value);
+
+    // An assembler for the loop's general purpose instructions, writing at
+    // the end of the program. Vector instructions are encoded by hand.
+    inline X86Assembler x86() {return X86Assembler(program, program_offset, PROGRAM_SIZE);}
+
+    // The offset ENCODE writes its byte at, as in EncodedProgram.
+    inline int next_byte()
+    {
+        if (program_offset >= (int)PROGRAM_SIZE)
+            throw CodeBufferFull();
+        return program_offset++;
+    }
+
+    // The loop itself, once it's known to be vectorizable.
+    void encode_loop();
+
+    Node* parse_tree_head;
+    SimdLevel level;
+    unsigned char* program = nullptr;
+    int program_offset = 0;
+    int stack_depth = 0;
+
+    std::vector<std::string> variable_names;
+    std::vector<uint32_t> variable_handles;     // Slot -> name's StringPool handle
+
+    // RIP-relative references to the constant pool, patched after the loop
+    // is encoded: (offset of the disp32, constant).
+    std::vector<std::pair<int, int32_t>> constant_fixups;
+
+    EncodedProgram* scalar = nullptr;   // Used instead when not vectorizable.
+
+    const unsigned int PROGRAM_SIZE = 50000;
+    static const int MAX_STACK = 15;    // ymm/xmm 0-14, 15 is scratch
+};
+
+#endif
@@ -0,0 +1,106 @@
+/**
+ * @file batch_eval.cpp
+ * @author Jake Rogers (z1826513)
+ * @brief Benchmarks BatchProgram against the scalar JIT called once per row.
+ *
+ * Every expression in the source file is evaluated over 'rows' rows of
+ * random column data, by a row loop around EncodedProgram::run and by a
+ * BatchProgram at each SIMD level the CPU supports. The results are checked
+ * against each other, and the best of several repetitions is reported.
+ *
+ * Usage: ./bench_batch src_file [rows]
+ */
+
+#include <cstring>
+#include <random>
+
+#include "bench_common.h"
+#include "../encoded_program.h"
+#include "../batch_program.h"
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: ./bench_batch src_file [rows]" << std::endl;
+        return 1;
+    }
+    size_t rows = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 1000000;
+
+    std::vector<Token> tokens;
+    if (!lex_file(argv[1], tokens))
+        return 1;
+
+    tree_gen parse_tree(tokens);
+    std::vector<Node *> heads;
+    if (!parse_tokens(parse_tree, heads))
+        return 1;
+
+    // Small values keep products from overflowing into anything interesting,
+    // and a divisor of zero out of every row.
+    std::mt19937 rng(515);
+    std::uniform_int_distribution<int> values(1, 1000);
+
+    SimdLevel best = BatchProgram::best_simd_level();
+    printf("%-6s %8s %12s %12s %12s %9s\n", "expr", "vars", "scalar ns/row", "sse4.1 ns/row", "avx2 ns/row", "speedup");
+
+    for (size_t e = 0; e < heads.size(); e++)
+    {
+        EncodedProgram scalar(heads[e]);
+        scalar.assemble();
+        size_t slots = scalar.variables().size();
+
+        std::vector<std::vector<int>> columns(slots, std::vector<int>(rows));
+        std::vector<const int *> column_ptrs(slots);
+        for (size_t slot = 0; slot < slots; slot++)
+        {
+            for (size_t row = 0; row < rows; row++)
+                columns[slot][row] = values(rng);
+            column_ptrs[slot] = columns[slot].data();
+        }
+
+        std::vector<int> expected(rows), actual(rows);
+        std::vector<int64_t> row_values(slots);
+        double scalar_ns = best_time([&]() {
+            for (size_t row = 0; row < rows; row++)
+            {
+                for (size_t slot = 0; slot < slots; slot++)
+                    row_values[slot] = column_ptrs[slot][row];
+                expected[row] = scalar.run(row_values.data());
+            }
+        });
+        scalar.release();
+
+        double level_ns[2] = {0, 0};
+        SimdLevel levels[2] = {SimdLevel::SSE41, SimdLevel::AVX2};
+        for (int l = 0; l < 2; l++)
+        {
+            if (levels[l] > best)
+                continue;
+
+            BatchProgram batch(heads[e], levels[l]);
+            batch.assemble();
+            if (batch.get_level() == SimdLevel::SCALAR && l > 0)
+                continue;   // Same fallback as the previous level, skip it.
+
+            level_ns[l] = best_time([&]() {
+                batch.evaluate(column_ptrs.data(), actual.data(), rows);
+            });
+
+            if (memcmp(expected.data(), actual.data(), rows * sizeof(int)) != 0)
+            {
+                std::cerr << "MISMATCH: expression #" << e << " differs from the scalar JIT." << std::endl;
+                return 1;
+            }
+        }
+
+        double fastest = (level_ns[1] > 0) ? level_ns[1] : level_ns[0];
+        printf("#%-5zu %8zu %12.3f %12.3f %12.3f %8.2fx\n", e, slots,
+            scalar_ns / rows, level_ns[0] / rows, level_ns[1] / rows,
+            fastest > 0 ? scalar_ns / fastest : 0.0);
+
+        parse_tree.delete_tree(heads[e]);
+    }
+
+    return 0;
+}
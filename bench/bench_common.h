@@ -0,0 +1,146 @@
+/**
+ * @file bench_common.h
+ * @author Jake Rogers (z1826513)
+ * @brief Helpers shared by the benchmark programs: running the front end over
+ * a source file, and timing a piece of work.
+ */
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../fsm/lexer_fsm.h"
+#include "../lexer_reader.h"
+#include "../lexer_error.h"
+#include "../tree_gen.h"
+
+#define REPETITIONS 5
+
+typedef std::chrono::steady_clock Clock;
+
+// Best-of-REPETITIONS time in nanoseconds for one run of 'body'.
+template <typename F>
+double best_time(F body)
+{
+    double best = 1e300;
+    for (int i = 0; i < REPETITIONS; i++)
+    {
+        Clock::time_point start = Clock::now();
+        body();
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        if (ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+// Summary of repeated timings of one piece of work, in nanoseconds.
+struct Samples
+{
+    int count = 0;
+    double min = 0;
+    double median = 0;
+    double mean = 0;
+    double stddev = 0;
+    double max = 0;
+};
+
+// Time 'repetitions' runs of 'body' after one untimed warm-up run. 'reset'
+// runs after each, untimed, to undo whatever the body did (free trees,
+// release programs) so every run starts from the same state.
+template <typename F, typename R>
+Samples measure(int repetitions, F body, R reset)
+{
+    body();
+    reset();
+
+    std::vector<double> times;
+    for (int i = 0; i < repetitions; i++)
+    {
+        Clock::time_point start = Clock::now();
+        body();
+        times.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+        reset();
+    }
+
+    Samples samples;
+    if (times.empty())
+        return samples;
+
+    std::sort(times.begin(), times.end());
+    samples.count = times.size();
+    samples.min = times.front();
+    samples.max = times.back();
+    samples.median = (times.size() % 2) ? times[times.size() / 2]
+        : (times[times.size() / 2 - 1] + times[times.size() / 2]) / 2;
+
+    for (double t : times)
+        samples.mean += t;
+    samples.mean /= times.size();
+    for (double t : times)
+        samples.stddev += (t - samples.mean) * (t - samples.mean);
+    samples.stddev = std::sqrt(samples.stddev / times.size());
+    return samples;
+}
+
+// Lex every token from 'reader' into 'tokens'. Returns false (after
+// printing why) on a lexical error, benchmarks want clean input.
+inline bool lex_reader(LexerReader &reader, std::vector<Token> &tokens)
+{
+    LexerFSM fsm(&reader);
+    try
+    {
+        while (reader)
+            fsm.processNextState();
+        fsm.addEOF();
+    }
+    catch (LexicalException &e)
+    {
+        std::cerr << e.message() << std::endl;
+        return false;
+    }
+    tokens = fsm.tokens;
+    return true;
+}
+
+// Lex every token in src_path.
+inline bool lex_file(const char *src_path, std::vector<Token> &tokens)
+{
+    LexerReader reader(src_path);
+    return lex_reader(reader, tokens);
+}
+
+// The same for source text generated by the benchmark itself.
+inline bool lex_text(const std::string &text, std::vector<Token> &tokens)
+{
+    std::istringstream stream(text);
+    LexerReader reader(stream);
+    return lex_reader(reader, tokens);
+}
+
+inline bool parse_tokens(tree_gen &parse_tree, std::vector<Node *> &heads)
+{
+    try
+    {
+        while (!parse_tree.finished())
+        {
+            Node *head;
+            parse_tree.create_parse_tree(head);
+            heads.push_back(head);
+        }
+    }
+    catch (ParseException &e)
+    {
+        std::cerr << e.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+#endif
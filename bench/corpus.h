@@ -0,0 +1,225 @@
+/**
+ * @file corpus.h
+ * @author Jake Rogers (z1826513)
+ * @brief Synthetic source files for the benchmarks, generated from a seed so
+ * every run (and every machine) sees exactly the same input.
+ *
+ * A corpus is a list of expressions, one per line. Everything about it is a
+ * parameter: how many expressions, how deeply they nest, which operators
+ * they use, how often variables appear instead of literals, and how dense
+ * comments, strings, unicode escapes and raw UTF-8 text are. An error rate salts the file
+ * with lexical and syntax errors for benchmarking the diagnostic paths.
+ *
+ * Strings aren't part of the expression grammar, so a corpus with strings
+ * or escapes in it is only useful to the lexer benchmarks.
+ */
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+struct CorpusOptions
+{
+    size_t expressions = 1000;
+    int depth = 4;                      // Deepest nesting of binary operators
+    std::string operators = "+-*/%^";   // '%' is written as 'mod'
+    int variables = 0;                  // Distinct variable names, 0 for literals only
+    double variable_ratio = 0.5;        // Chance a leaf is a variable (if there are any)
+    double comment_density = 0.0;       // Chance per expression of a comment
+    double string_density = 0.0;        // Chance per expression of a string literal
+    double unicode_density = 0.0;       // Chance per string character of a \u escape
+    double text_density = 0.0;          // Chance per string character of raw non-ASCII UTF-8
+    double error_rate = 0.0;            // Chance per expression of an error
+    uint64_t seed = 1;
+};
+
+class CorpusGenerator
+{
+public:
+    CorpusGenerator(const CorpusOptions &options)
+        : options(options), state(options.seed ? options.seed : 1) {}
+
+    std::string generate()
+    {
+        std::string out;
+        for (size_t i = 0; i < options.expressions; i++)
+        {
+            if (chance(options.comment_density))
+                comment(out);
+            if (chance(options.string_density))
+                string(out);
+
+            if (chance(options.error_rate))
+                error(out);
+            else
+                // A top level expression never starts with a sign, otherwise
+                // it would carry on the expression before it.
+                expression(out, options.depth, false);
+            out += '\n';
+        }
+        return out;
+    }
+
+private:
+    // xorshift64*, small and the same everywhere (unlike std:: distributions).
+    uint64_t next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545f4914f6cdd1dULL;
+    }
+
+    uint64_t below(uint64_t n) {return next() % n;}
+    bool chance(double p) {return (next() >> 11) * (1.0 / 9007199254740992.0) < p;}
+
+    void literal(std::string &out, int max)
+    {
+        out += std::to_string(1 + below(max));
+    }
+
+    void leaf(std::string &out, bool allow_sign)
+    {
+        if (allow_sign && chance(0.1))
+            out += '-';
+
+        if (options.variables > 0 && chance(options.variable_ratio))
+        {
+            out += 'v';
+            out += std::to_string(below(options.variables));
+        }
+        else
+        {
+            literal(out, 999);
+        }
+    }
+
+    void expression(std::string &out, int depth, bool allow_sign)
+    {
+        if (depth == 0 || options.operators.empty() || chance(0.25))
+        {
+            leaf(out, allow_sign);
+            return;
+        }
+
+        bool parenthesized = chance(0.3);
+        if (parenthesized)
+            out += '(';
+
+        expression(out, depth - 1, allow_sign && !parenthesized);
+
+        char op = options.operators[below(options.operators.size())];
+        if (op == '%')
+            out += " mod ";
+        else
+        {
+            out += ' ';
+            out += op;
+            out += ' ';
+        }
+
+        // Dividing by a positive literal can never trap, whatever the left
+        // side turns out to be.
+        if (op == '/' || op == '%')
+            literal(out, 99);
+        else
+            expression(out, depth - 1, true);
+
+        if (parenthesized)
+            out += ')';
+    }
+
+    void comment(std::string &out)
+    {
+        if (chance(0.5))
+            out += "# an inline comment about the next expression\n";
+        else
+            out += "<<- a block comment\n   spanning two lines ->>\n";
+    }
+
+    void string(std::string &out)
+    {
+        out += '"';
+        size_t length = 8 + below(24);
+        for (size_t i = 0; i < length; i++)
+        {
+            if (chance(options.unicode_density))
+            {
+                // Spread escapes over every UTF-8 length.
+                char escape[16];
+                snprintf(escape, sizeof(escape), "\\u%06x", code_point(i % 4));
+                out += escape;
+            }
+            else if (chance(options.text_density))
+            {
+                // The same, written out as raw UTF-8.
+                static const uint8_t leads[] = {0, 0xc0, 0xe0, 0xf0};
+                int continuations = 1 + i % 3;
+                uint32_t c = code_point(continuations);
+                out += (char)(leads[continuations] | c >> (6 * continuations));
+                for (int b = continuations - 1; b >= 0; b--)
+                    out += (char)(0x80 | ((c >> (6 * b)) & 0x3f));
+            }
+            else if (chance(0.05))
+            {
+                out += "\\n";
+            }
+            else
+            {
+                out += 'a' + below(26);
+            }
+        }
+        out += "\"\n";
+    }
+
+    // A random code point (not a surrogate) whose UTF-8 has 'continuations'
+    // bytes after the lead; 0 gives printable ASCII.
+    uint32_t code_point(int continuations)
+    {
+        static const uint32_t limits[] = {0x20, 0x80, 0x800, 0x10000, 0x110000};
+        uint32_t low = limits[continuations], high = limits[continuations + 1];
+        uint32_t c = low + below(high - low);
+        if (c >= 0xd800 && c < 0xe000)
+            c = 0xe000;
+        return c;
+    }
+
+    void error(std::string &out)
+    {
+        switch (below(3))
+        {
+        case 0:     // Illegal escape, a lexical error
+            out += "\"bad \\q escape\"";
+            break;
+        case 1:     // Two operators in a row, a syntax error
+            literal(out, 999);
+            out += " + * ";
+            literal(out, 999);
+            break;
+        default:    // Unbalanced parentheses, a syntax error
+            out += "(";
+            expression(out, 1, false);
+            break;
+        }
+    }
+
+    CorpusOptions options;
+    uint64_t state;
+};
+
+// Write a generated corpus to 'path'. Returns the number of bytes written,
+// or 0 if the file couldn't be written.
+inline size_t write_corpus(const CorpusOptions &options, const std::string &path)
+{
+    std::string text = CorpusGenerator(options).generate();
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+        return 0;
+    size_t written = fwrite(text.data(), 1, text.size(), file);
+    fclose(file);
+    return written;
+}
+
+#endif
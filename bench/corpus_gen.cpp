@@ -0,0 +1,75 @@
+/**
+ * @file corpus_gen.cpp
+ * @author Jake Rogers (z1826513)
+ * @brief Writes a synthetic ncc source file (see corpus.h) to stdout or a
+ * file, so a corpus the suite uses can be inspected or fed to ./ncc by hand.
+ *
+ * Usage: ./bench_corpus [--expressions N] [--depth N] [--operators "+-*" ]
+ *        [--variables N] [--variable-ratio P] [--comments P] [--strings P]
+ *        [--unicode P] [--text P] [--errors P] [--seed N] [-o file]
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "corpus.h"
+
+int main(int argc, char **argv)
+{
+    CorpusOptions options;
+    const char *out_path = nullptr;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (value == nullptr)
+        {
+            std::cerr << "Missing value for " << argv[i] << std::endl;
+            return 1;
+        }
+
+        if (strcmp(argv[i], "--expressions") == 0)
+            options.expressions = strtoull(value, nullptr, 10);
+        else if (strcmp(argv[i], "--depth") == 0)
+            options.depth = atoi(value);
+        else if (strcmp(argv[i], "--operators") == 0)
+            options.operators = value;
+        else if (strcmp(argv[i], "--variables") == 0)
+            options.variables = atoi(value);
+        else if (strcmp(argv[i], "--variable-ratio") == 0)
+            options.variable_ratio = atof(value);
+        else if (strcmp(argv[i], "--comments") == 0)
+            options.comment_density = atof(value);
+        else if (strcmp(argv[i], "--strings") == 0)
+            options.string_density = atof(value);
+        else if (strcmp(argv[i], "--unicode") == 0)
+            options.unicode_density = atof(value);
+        else if (strcmp(argv[i], "--text") == 0)
+            options.text_density = atof(value);
+        else if (strcmp(argv[i], "--errors") == 0)
+            options.error_rate = atof(value);
+        else if (strcmp(argv[i], "--seed") == 0)
+            options.seed = strtoull(value, nullptr, 10);
+        else if (strcmp(argv[i], "-o") == 0)
+            out_path = value;
+        else
+        {
+            std::cerr << "Unknown option " << argv[i] << std::endl;
+            return 1;
+        }
+        i++;
+    }
+
+    if (out_path != nullptr)
+    {
+        if (write_corpus(options, out_path) == 0)
+        {
+            std::cerr << "Could not write " << out_path << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    std::cout << CorpusGenerator(options).generate();
+    return 0;
+}
@@ -0,0 +1,197 @@
+/**
+ * @file incremental.cpp
+ * @author Jake Rogers (z1826513)
+ * @brief Measures how long an IncrementalDocument takes to catch up with an
+ * edit, against compiling the whole file again, and checks that it agrees
+ * with a full compile.
+ *
+ * A generated corpus is opened as a document and then edited at random
+ * places, the way typing would: single characters inserted (digits,
+ * operators, spaces, newlines, brackets, comment and string openers), short
+ * runs deleted, each undone again by the next edit.
+ * Reported are the edit-to-result latency percentiles, how much of the file
+ * each edit redid, and the time for a full compile.
+ *
+ * With --check, after every edit the document's output is compared with a
+ * fresh document loaded from the same text, and the first difference is
+ * printed (with the text that produced it) before exiting with status 1.
+ *
+ * Usage: ./bench_incremental [--expressions N] [--edits N] [--seed N] [--check]
+ */
+
+#include <cstring>
+#include <sstream>
+
+#include "bench_common.h"
+#include "corpus.h"
+#include "../encoded_program.h"
+#include "../incremental.h"
+#include "../parse_exception.h"
+#include "../execution_exception.h"
+
+// What ncc prints for an expression without variable bindings. Variables
+// aren't bound, and the edits never make '/' or "mod", so nothing divides by zero.
+static bool compile_expression(tree_gen &parse_tree, Node *head, OutputBuffer &out, std::ostream &err)
+{
+    out << "Code Tree:" << '\n';
+    parse_tree.print_tree_pretty(head, 0, out);
+    out << '\n';
+
+    EncodedProgram prog(head);
+    bool clean = true;
+    try
+    {
+        prog.assemble();
+        if (prog.variables().empty())
+            out << "Program Length: " << prog.length() << " bytes\n" << "Output: " << prog.run(nullptr) << '\n';
+        else
+            err << "Error: variable '" << prog.variables()[0] << "' has no value, use --bind or --rows." << '\n';
+    }
+    catch (ParseException &e)
+    {
+        err << e.message() << '\n';
+        clean = false;
+    }
+    catch (ExecutionException &e)
+    {
+        err << e.message() << '\n';
+    }
+    prog.release();
+    out << '\n';
+    parse_tree.delete_tree(head);
+    return clean;
+}
+
+static std::string render(const IncrementalDocument &document)
+{
+    OutputBuffer out;
+    std::ostringstream err;
+    document.write_output(out, err);
+    return out.str() + "\n--- diagnostics ---\n" + err.str();
+}
+
+static uint64_t state = 1;
+
+static uint64_t next_random()
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+int main(int argc, char **argv)
+{
+    CorpusOptions options;
+    options.expressions = 20000;
+    options.depth = 4;
+    options.operators = "+-*^";
+    options.comment_density = 0.1;
+    size_t edits = 2000;
+    bool check = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--check") == 0)
+            check = true;
+        else if (strcmp(argv[i], "--expressions") == 0 && i + 1 < argc)
+            options.expressions = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--edits") == 0 && i + 1 < argc)
+            edits = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        else
+        {
+            std::cerr << "Usage: ./bench_incremental [--expressions N] [--edits N] [--seed N] [--check]" << std::endl;
+            return 1;
+        }
+    }
+    state = options.seed ? options.seed : 1;
+
+    std::string text = CorpusGenerator(options).generate();
+    IncrementalDocument document(compile_expression, true);
+    document.load(text);
+
+    IncrementalDocument full(compile_expression, true);
+    double full_ns = best_time([&]() {full.load(document.text());});
+
+    static const char typed[] = "0123456789+-*^() \n#\"<>~=xy";
+    std::vector<double> latencies;
+    size_t relexed = 0, compiled = 0, reused = 0;
+    bool undo = false;
+    size_t last_offset = 0, last_inserted = 0;
+    std::string last_removed;
+    for (size_t e = 0; e < edits; e++)
+    {
+        // Every other edit takes back the one before, as fixing a typo
+        // would, so the file keeps coming back to the valid corpus instead
+        // of drifting into an unterminated string for good.
+        size_t size = document.text().size();
+        size_t offset, removed = 0;
+        std::string inserted;
+        if (undo)
+        {
+            offset = last_offset;
+            removed = last_inserted;
+            inserted = last_removed;
+            undo = false;
+        }
+        else
+        {
+            offset = next_random() % (size + 1);
+            if (next_random() % 3 == 0)
+                removed = std::min<size_t>(size - offset, 1 + next_random() % 4);
+            else
+                inserted = typed[next_random() % (sizeof(typed) - 1)];
+            last_offset = offset;
+            last_inserted = inserted.size();
+            last_removed = document.text().substr(offset, removed);
+            undo = true;
+        }
+
+        Clock::time_point start = Clock::now();
+        document.edit(offset, removed, inserted);
+        latencies.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+
+        relexed += document.last_work().tokens_relexed;
+        compiled += document.last_work().expressions_compiled;
+        reused += document.last_work().expressions_reused;
+
+        if (check)
+        {
+            full.load(document.text());
+            std::string expected = render(full);
+            std::string got = render(document);
+            if (got != expected)
+            {
+                size_t at = 0;
+                while (at < got.size() && at < expected.size() && got[at] == expected[at])
+                    at++;
+                std::cerr << "Edit " << e << " (" << removed << " bytes removed and \"" << inserted
+                    << "\" inserted at " << offset << ") disagrees with a full compile at output byte "
+                    << at << ".\n--- incremental ---\n" << got.substr(at > 200 ? at - 200 : 0, 400)
+                    << "\n--- full ---\n" << expected.substr(at > 200 ? at - 200 : 0, 400)
+                    << "\n--- source ---\n" << document.text().substr(offset > 200 ? offset - 200 : 0, 400) << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double fraction) {
+        return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, (size_t)(fraction * latencies.size()))];
+    };
+
+    printf("source: %zu bytes, %zu tokens, %zu expressions\n", document.text().size(),
+        document.token_count(), document.expression_count());
+    printf("full compile: %.2f ms\n", full_ns / 1e6);
+    printf("edit latency: p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us over %zu edits\n",
+        percentile(0.5) / 1e3, percentile(0.9) / 1e3, percentile(0.99) / 1e3,
+        latencies.empty() ? 0.0 : latencies.back() / 1e3, latencies.size());
+    if (!latencies.empty())
+        printf("per edit: %.1f tokens relexed, %.1f expressions compiled, %.1f reused\n",
+            (double)relexed / edits, (double)compiled / edits, (double)reused / edits);
+    if (check)
+        printf("check: all %zu edits agree with a full compile\n", edits);
+    return 0;
+}
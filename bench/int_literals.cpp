@@ -0,0 +1,186 @@
+/**
+ * @file int_literals.cpp
+ * @author Jake Rogers (z1826513)
+ * @brief Measures how integer literals are lexed: the SWAR conversion in
+ * decimal.h against strtoll, and reading the digits a run at a time against
+ * a byte per peek and get, which is what IntegerState used to do.
+ *
+ * Before timing anything, parse_decimal is checked against strtoll on every
+ * boundary value and a few hundred thousand random literals (with leading
+ * zeros, and past the 64-bit limit), including agreeing on which overflow.
+ *
+ * Three timings are reported, each per literal:
+ *  - convert: the digits to a value, strtoll against parse_decimal.
+ *  - scan:    reading the digits off a stream and converting them.
+ *  - lex:     the whole lexer over a file of nothing but literals.
+ *
+ * Usage: ./bench_literals [--literals N] [--digits N (at most 18)] [--seed N]
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include "bench_common.h"
+#include "../decimal.h"
+
+static uint64_t state = 1;
+
+static uint64_t next_random()
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+// The old conversion: strtoll, with ERANGE as overflow.
+static bool parse_strtoll(const std::string &digits, int64_t &value)
+{
+    errno = 0;
+    int64_t result = strtoll(digits.c_str(), nullptr, 10);
+    if (errno == ERANGE)
+        return false;
+    value = result;
+    return true;
+}
+
+static bool agrees(const std::string &digits)
+{
+    int64_t expected = -1, got = -1;
+    bool expected_ok = parse_strtoll(digits, expected);
+    bool got_ok = parse_decimal(digits.data(), digits.size(), got);
+    if (expected_ok == got_ok && (!got_ok || expected == got))
+        return true;
+
+    std::cerr << "parse_decimal disagrees with strtoll on \"" << digits << "\": " << (got_ok ? std::to_string(got) : "overflow")
+        << " instead of " << (expected_ok ? std::to_string(expected) : "overflow") << std::endl;
+    return false;
+}
+
+static bool check()
+{
+    const char *edges[] = {"0", "00", "7", "10", "99999999", "100000000", "0000000000000000000000001",
+        "9223372036854775806", "9223372036854775807", "9223372036854775808", "09223372036854775807",
+        "9999999999999999999", "10000000000000000000", "18446744073709551615", "18446744073709551616",
+        "99999999999999999999999999"};
+    for (const char *edge : edges)
+        if (!agrees(edge))
+            return false;
+
+    for (int i = 0; i < 300000; i++)
+    {
+        std::string digits(1 + next_random() % 24, '0');
+        size_t zeros = (next_random() % 4 == 0) ? next_random() % digits.size() : 0;
+        for (size_t d = zeros; d < digits.size(); d++)
+            digits[d] = '0' + next_random() % 10;
+        if (!agrees(digits))
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    size_t literals = 200000;
+    size_t max_digits = 12;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--literals") == 0 && i + 1 < argc)
+            literals = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--digits") == 0 && i + 1 < argc)
+            max_digits = std::max(1ul, std::min(18ul, strtoul(argv[++i], nullptr, 10)));
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            state = std::max(1ull, strtoull(argv[++i], nullptr, 10));
+        else
+        {
+            std::cerr << "Usage: ./bench_literals [--literals N] [--digits N] [--seed N]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (!check())
+        return 1;
+    printf("check: parse_decimal agrees with strtoll\n");
+
+    // Literals of 1 to max_digits digits, evenly spread over the lengths.
+    std::vector<std::string> values(literals);
+    std::string source;
+    for (std::string &value : values)
+    {
+        size_t length = 1 + next_random() % max_digits;
+        value = std::to_string(1 + next_random() % 9);
+        while (value.size() < length)
+            value += '0' + next_random() % 10;
+        source += value;
+        source += '\n';
+    }
+
+    volatile int64_t sink = 0;
+    double old_ns = best_time([&]() {
+        for (const std::string &value : values)
+        {
+            int64_t result = 0;
+            parse_strtoll(value, result);
+            sink = result;
+        }
+    });
+    double new_ns = best_time([&]() {
+        for (const std::string &value : values)
+        {
+            int64_t result = 0;
+            parse_decimal(value.data(), value.size(), result);
+            sink = result;
+        }
+    });
+    printf("convert: strtoll %.2f ns, parse_decimal %.2f ns per literal (%.1fx)\n",
+        old_ns / literals, new_ns / literals, old_ns / new_ns);
+
+    old_ns = best_time([&]() {
+        std::istringstream stream(source);
+        LexerReader reader(stream);
+        while (reader)
+        {
+            std::string sequence;
+            while (isdigit(reader.peekNext()))
+                sequence.push_back(reader.advance());
+            int64_t result = 0;
+            parse_strtoll(sequence, result);
+            sink = result;
+            reader.advance();
+        }
+    });
+    new_ns = best_time([&]() {
+        std::istringstream stream(source);
+        LexerReader reader(stream);
+        while (reader)
+        {
+            std::string sequence;
+            char digits[64];
+            size_t count;
+            while ((count = reader.advanceDigits(digits, sizeof(digits))) > 0)
+                sequence.append(digits, count);
+            int64_t result = 0;
+            parse_decimal(sequence.data(), sequence.size(), result);
+            sink = result;
+            reader.advance();
+        }
+    });
+    printf("scan:    per byte %.2f ns, per run %.2f ns per literal (%.1fx)\n",
+        old_ns / literals, new_ns / literals, old_ns / new_ns);
+
+    size_t tokens = 0;
+    double lex_ns = best_time([&]() {
+        std::istringstream stream(source);
+        LexerReader reader(stream);
+        LexerFSM fsm(&reader);
+        while (reader)
+            fsm.processNextState();
+        fsm.addEOF();
+        tokens = fsm.tokens.size();
+    });
+    printf("lex:     %.2f ns per literal (%zu tokens, %zu bytes)\n", lex_ns / literals, tokens, source.size());
+    (void)sink;
+    return 0;
+}
@@ -0,0 +1,136 @@
+/**
+ * @file reassociate.cpp
+ * @author Jake Rogers (z1826513)
+ * @brief Measures what rebalancing '+' and '*' chains (see reassociate.h)
+ * does to the latency of running them.
+ *
+ * For each chain length, a chain of that many variables ("x0 + x1 + ..."
+ * and the same with '*', cycling through 16 variables) is generated,
+ * parsed, and assembled once as parsed (left-deep) and once rebalanced,
+ * for each tier. Each program is run 'runs' times back to back; since
+ * every run is one call, the time per run is the chain's latency. Both
+ * programs must give the same result, which is checked first.
+ *
+ * The interpreter is measured as well, though it gains nothing: it does one
+ * operation at a time whatever the tree's shape, which is why ncc only
+ * rebalances programs for the JIT.
+ *
+ * Usage: ./bench_reassoc [--runs N] [--max-length N (default 4096)]
+ */
+
+#include <cstring>
+
+#include "bench_common.h"
+#include "../encoded_program.h"
+#include "../reassociate.h"
+
+#define VARIABLES 16
+
+// 'length' variables joined by 'op'.
+static std::string chain(size_t length, char op)
+{
+    std::string text;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (i)
+            text += std::string(" ") + op + " ";
+        text += "x" + std::to_string(i % VARIABLES);
+    }
+    return text + "\n";
+}
+
+// Parse one generated expression.
+static Node *parse(tree_gen *&parse_tree, std::vector<Token> &tokens, const std::string &text)
+{
+    std::vector<Node *> heads;
+    if (!lex_text(text, tokens))
+        return nullptr;
+    parse_tree = new tree_gen(tokens);
+    if (!parse_tokens(*parse_tree, heads) || heads.size() != 1)
+        return nullptr;
+    return heads[0];
+}
+
+int main(int argc, char **argv)
+{
+    size_t runs = 200000;
+    size_t max_length = 4096;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+            runs = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--max-length") == 0 && i + 1 < argc)
+            max_length = strtoul(argv[++i], nullptr, 10);
+        else
+        {
+            std::cerr << "Usage: ./bench_reassoc [--runs N] [--max-length N]" << std::endl;
+            return 1;
+        }
+    }
+
+    ExecutionTier tiers[2] = {ExecutionTier::JIT, ExecutionTier::INTERPRETER};
+    const char *tier_names[2] = {"jit", "interp"};
+    const char ops[2] = {'+', '*'};
+
+    // Small odd values keep the products from collapsing to zero.
+    std::vector<int64_t> values;
+    for (int v = 0; v < VARIABLES; v++)
+        values.push_back(3 + 2 * v);
+
+    printf("%-7s %-3s %7s %12s %12s %9s\n", "tier", "op", "length", "parsed ns", "balanced ns", "speedup");
+    for (int t = 0; t < 2; t++)
+    {
+        if (tiers[t] == ExecutionTier::JIT && !EncodedProgram::jit_available())
+            continue;
+
+        for (char op : ops)
+        {
+            for (size_t length = 8; length <= max_length; length *= 4)
+            {
+                std::string text = chain(length, op);
+                std::vector<Token> parsed_tokens, balanced_tokens;
+                tree_gen *parsed_tree = nullptr, *balanced_tree = nullptr;
+                Node *parsed = parse(parsed_tree, parsed_tokens, text);
+                Node *balanced = parse(balanced_tree, balanced_tokens, text);
+                if (parsed == nullptr || balanced == nullptr)
+                    return 1;
+                reassociate(balanced);
+
+                EncodedProgram parsed_prog(parsed, tiers[t]);
+                EncodedProgram balanced_prog(balanced, tiers[t]);
+                parsed_prog.assemble();
+                balanced_prog.assemble();
+                if (parsed_prog.variables() != balanced_prog.variables()
+                    || parsed_prog.run(values.data()) != balanced_prog.run(values.data()))
+                {
+                    std::cerr << "Rebalanced " << tier_names[t] << " chain of " << length << " '" << op
+                        << "' gives a different result." << std::endl;
+                    return 1;
+                }
+
+                volatile int64_t sink;
+                size_t chain_runs = std::max<size_t>(1, runs * 8 / length);
+                double parsed_ns = best_time([&]() {
+                    for (size_t run = 0; run < chain_runs; run++)
+                        sink = parsed_prog.run(values.data());
+                }) / chain_runs;
+                double balanced_ns = best_time([&]() {
+                    for (size_t run = 0; run < chain_runs; run++)
+                        sink = balanced_prog.run(values.data());
+                }) / chain_runs;
+                (void)sink;
+
+                printf("%-7s %-3c %7zu %12.1f %12.1f %8.2fx\n", tier_names[t], op, length, parsed_ns, balanced_ns,
+                    parsed_ns / balanced_ns);
+
+                parsed_prog.release();
+                balanced_prog.release();
+                parsed_tree->delete_tree(parsed);
+                balanced_tree->delete_tree(balanced);
+                delete parsed_tree;
+                delete balanced_tree;
+            }
+        }
+    }
+    return 0;
+}
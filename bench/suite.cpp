@@ -0,0 +1,455 @@
+/**
+ * @file suite.cpp
+ * @author Jake Rogers (z1826513)
+ * @brief The benchmark suite: every stage of ncc timed on generated corpora
+ * (see corpus.h), with results written as JSON so two runs can be compared.
+ *
+ * Benchmarks, each run 'reps' times after a warm-up:
+ *   reader/advance LexerReader alone, one advance() per byte
+ *   lex/<state>    The whole lexer, on a corpus weighted towards one state
+ *                  (identifiers, integers, punctuation, strings, escapes,
+ *                  raw UTF-8 text, comments), and on the mixed corpus
+ *   parse          tree_gen over the lexed tokens
+ *   assemble/<tier>EncodedProgram::assemble for each tier
+ *   execute/<tier> Running every assembled expression once, for each tier
+ *   pipeline       Lex, parse, assemble and run in process, no output
+ *   process        ./ncc on the corpus as a child process (if ./ncc exists)
+ *
+ * Every corpus comes from a fixed seed, so runs on different days or
+ * machines time exactly the same input.
+ *
+ * Usage: ./bench_suite [--reps N] [--seed N] [--scale X] [--filter text]
+ *        [--json file] [--compare baseline.json [--threshold percent]]
+ *
+ * With --compare, any benchmark whose median is more than 'threshold'
+ * percent (default 5) slower than in the baseline is reported, and the exit
+ * status is 1.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench_common.h"
+#include "corpus.h"
+#include "../code_cache.h"
+#include "../encoded_program.h"
+
+struct Result
+{
+    std::string name;
+    size_t bytes;       // Source bytes per run, 0 if not meaningful
+    size_t items;       // Tokens, expressions or runs per run
+    const char *item_unit;
+    Samples samples;
+};
+
+struct SuiteOptions
+{
+    int repetitions = 15;
+    uint64_t seed = 1;
+    double scale = 1.0;
+    const char *filter = nullptr;
+    const char *json_path = nullptr;
+    const char *compare_path = nullptr;
+    double threshold = 5.0;
+};
+
+static SuiteOptions suite;
+static std::vector<Result> results;
+static std::string corpus_dir;
+
+static bool selected(const std::string &name)
+{
+    return suite.filter == nullptr || name.find(suite.filter) != std::string::npos;
+}
+
+static void report(const std::string &name, size_t bytes, size_t items, const char *item_unit, const Samples &samples)
+{
+    results.push_back({name, bytes, items, item_unit, samples});
+
+    double seconds = samples.median / 1e9;
+    fprintf(stderr, "%-22s %12.0f ns  +-%5.1f%%  %10.2f M%s/s", name.c_str(), samples.median,
+        100.0 * samples.stddev / samples.mean, items / seconds / 1e6, item_unit);
+    if (bytes != 0)
+        fprintf(stderr, "  %8.2f MB/s", bytes / seconds / 1e6);
+    fprintf(stderr, "\n");
+}
+
+static std::string make_corpus(const char *name, CorpusOptions options, size_t &bytes)
+{
+    options.seed = suite.seed;
+    options.expressions = std::max<size_t>(1, options.expressions * suite.scale);
+    std::string path = corpus_dir + "/" + name + ".txt";
+    bytes = write_corpus(options, path);
+    if (bytes == 0)
+    {
+        std::cerr << "Could not write corpus " << path << std::endl;
+        exit(1);
+    }
+    return path;
+}
+
+static void bench_reader(const std::string &path, size_t bytes)
+{
+    if (!selected("reader/advance"))
+        return;
+
+    report("reader/advance", bytes, bytes, "B", measure(suite.repetitions, [&]() {
+        LexerReader reader(path.c_str());
+        volatile char sink;
+        while (reader)
+            sink = reader.advance();
+        (void)sink;
+    }, []() {}));
+}
+
+static void bench_lexer(const char *name, const CorpusOptions &options)
+{
+    std::string full_name = std::string("lex/") + name;
+    if (!selected(full_name))
+        return;
+
+    size_t bytes;
+    std::string path = make_corpus(name, options, bytes);
+
+    std::vector<Token> tokens;
+    if (!lex_file(path.c_str(), tokens))
+        exit(1);
+
+    report(full_name, bytes, tokens.size(), "tok", measure(suite.repetitions, [&]() {
+        std::vector<Token> lexed;
+        lex_file(path.c_str(), lexed);
+    }, []() {}));
+}
+
+static void bench_parse(const std::vector<Token> &tokens, size_t bytes)
+{
+    if (!selected("parse"))
+        return;
+
+    std::vector<Node *> heads;
+    tree_gen *parse_tree = nullptr;
+    report("parse", bytes, tokens.size(), "tok", measure(suite.repetitions, [&]() {
+        parse_tree = new tree_gen(tokens);
+        parse_tokens(*parse_tree, heads);
+    }, [&]() {
+        for (Node *head : heads)
+            parse_tree->delete_tree(head);
+        heads.clear();
+        delete parse_tree;
+    }));
+}
+
+static void bench_backend(const std::vector<Node *> &heads)
+{
+    ExecutionTier tiers[2] = {ExecutionTier::JIT, ExecutionTier::INTERPRETER};
+    const char *tier_names[2] = {"jit", "interp"};
+
+    for (int t = 0; t < 2; t++)
+    {
+        std::vector<EncodedProgram *> programs;
+        auto release_all = [&]() {
+            for (EncodedProgram *prog : programs)
+            {
+                prog->release();
+                delete prog;
+            }
+            programs.clear();
+        };
+
+        std::string name = std::string("assemble/") + tier_names[t];
+        if (selected(name))
+        {
+            report(name, 0, heads.size(), "expr", measure(suite.repetitions, [&]() {
+                for (Node *head : heads)
+                {
+                    programs.push_back(new EncodedProgram(head, tiers[t]));
+                    programs.back()->assemble();
+                }
+            }, release_all));
+        }
+
+        name = std::string("execute/") + tier_names[t];
+        if (!selected(name))
+            continue;
+
+        for (Node *head : heads)
+        {
+            programs.push_back(new EncodedProgram(head, tiers[t]));
+            programs.back()->assemble();
+        }
+
+        std::vector<int64_t> values(64);
+        for (size_t i = 0; i < values.size(); i++)
+            values[i] = i + 1;
+
+        report(name, 0, programs.size(), "expr", measure(suite.repetitions, [&]() {
+            volatile int64_t sink;
+            for (EncodedProgram *prog : programs)
+                sink = prog->run(values.data());
+            (void)sink;
+        }, []() {}));
+        release_all();
+    }
+}
+
+static void bench_pipeline(const std::string &path, size_t bytes, size_t token_count)
+{
+    if (!selected("pipeline"))
+        return;
+
+    std::vector<int64_t> values(64, 7);
+    report("pipeline", bytes, token_count, "tok", measure(suite.repetitions, [&]() {
+        std::vector<Token> tokens;
+        lex_file(path.c_str(), tokens);
+        tree_gen parse_tree(tokens);
+        std::vector<Node *> heads;
+        parse_tokens(parse_tree, heads);
+
+        volatile int64_t sink;
+        for (Node *head : heads)
+        {
+            EncodedProgram prog(head);
+            prog.assemble();
+            sink = prog.run(values.data());
+            prog.release();
+            parse_tree.delete_tree(head);
+        }
+        (void)sink;
+    }, []() {}));
+}
+
+static void bench_process(const std::string &path, size_t bytes, size_t token_count)
+{
+    if (!selected("process") || access("./ncc", X_OK) != 0)
+        return;
+
+    report("process", bytes, token_count, "tok", measure(suite.repetitions, [&]() {
+        pid_t child = fork();
+        if (child == 0)
+        {
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            execl("./ncc", "./ncc", path.c_str(), (char *)nullptr);
+            _exit(127);
+        }
+        int status;
+        waitpid(child, &status, 0);
+    }, []() {}));
+}
+
+static void write_json(std::ostream &out)
+{
+    out << "{\"suite\":\"ncc-bench\",\"version\":\"" << NCC_VERSION << "\""
+        << ",\"compiler\":\"" << __VERSION__ << "\""
+        << ",\"seed\":" << suite.seed
+        << ",\"scale\":" << suite.scale
+        << ",\"repetitions\":" << suite.repetitions
+        << ",\"benchmarks\":[";
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result &r = results[i];
+        double seconds = r.samples.median / 1e9;
+        out << (i ? "," : "") << "\n{\"name\":\"" << r.name << "\""
+            << ",\"median_ns\":" << r.samples.median
+            << ",\"min_ns\":" << r.samples.min
+            << ",\"mean_ns\":" << r.samples.mean
+            << ",\"stddev_ns\":" << r.samples.stddev
+            << ",\"max_ns\":" << r.samples.max
+            << ",\"samples\":" << r.samples.count
+            << ",\"items\":" << r.items
+            << ",\"item_unit\":\"" << r.item_unit << "\""
+            << ",\"items_per_second\":" << r.items / seconds
+            << ",\"bytes\":" << r.bytes
+            << ",\"bytes_per_second\":" << r.bytes / seconds << "}";
+    }
+    out << "\n]}" << std::endl;
+}
+
+// Pull each benchmark's median out of a JSON file written by write_json().
+// Not a general JSON parser, it only has to read our own output back.
+static std::map<std::string, double> read_medians(const char *path)
+{
+    std::map<std::string, double> medians;
+    std::ifstream in(path);
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string text = buffer.str();
+
+    const std::string name_key = "\"name\":\"";
+    const std::string median_key = "\"median_ns\":";
+    size_t at = 0;
+    while ((at = text.find(name_key, at)) != std::string::npos)
+    {
+        at += name_key.size();
+        size_t name_end = text.find('"', at);
+        size_t median_at = text.find(median_key, name_end);
+        if (name_end == std::string::npos || median_at == std::string::npos)
+            break;
+        medians[text.substr(at, name_end - at)] = atof(text.c_str() + median_at + median_key.size());
+        at = median_at;
+    }
+    return medians;
+}
+
+// Returns the number of benchmarks that got slower than the threshold.
+static int compare(const char *baseline_path)
+{
+    std::map<std::string, double> baseline = read_medians(baseline_path);
+    if (baseline.empty())
+    {
+        std::cerr << "No results found in " << baseline_path << std::endl;
+        return 1;
+    }
+
+    int regressions = 0;
+    fprintf(stderr, "\n%-22s %14s %14s %9s\n", "benchmark", "baseline ns", "current ns", "change");
+    for (const Result &r : results)
+    {
+        auto found = baseline.find(r.name);
+        if (found == baseline.end() || found->second <= 0)
+            continue;
+
+        double change = (r.samples.median / found->second - 1.0) * 100.0;
+        bool regressed = change > suite.threshold;
+        regressions += regressed;
+        fprintf(stderr, "%-22s %14.0f %14.0f %+8.1f%%%s\n", r.name.c_str(), found->second, r.samples.median,
+            change, regressed ? "  REGRESSION" : "");
+    }
+    return regressions;
+}
+
+static bool parse_options(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+            return false;
+        const char *value = argv[i + 1];
+
+        if (strcmp(argv[i], "--reps") == 0)
+            suite.repetitions = atoi(value);
+        else if (strcmp(argv[i], "--seed") == 0)
+            suite.seed = strtoull(value, nullptr, 10);
+        else if (strcmp(argv[i], "--scale") == 0)
+            suite.scale = atof(value);
+        else if (strcmp(argv[i], "--filter") == 0)
+            suite.filter = value;
+        else if (strcmp(argv[i], "--json") == 0)
+            suite.json_path = value;
+        else if (strcmp(argv[i], "--compare") == 0)
+            suite.compare_path = value;
+        else if (strcmp(argv[i], "--threshold") == 0)
+            suite.threshold = atof(value);
+        else
+            return false;
+        i++;
+    }
+    return suite.repetitions > 0 && suite.scale > 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (!parse_options(argc, argv))
+    {
+        std::cerr << "Usage: ./bench_suite [--reps N] [--seed N] [--scale X] [--filter text] "
+            "[--json file] [--compare baseline.json [--threshold percent]]" << std::endl;
+        return 1;
+    }
+
+    char dir_template[] = "/tmp/ncc-bench-XXXXXX";
+    if (mkdtemp(dir_template) == nullptr)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    corpus_dir = dir_template;
+
+    // The main corpus: a realistic mix of everything the grammar accepts.
+    CorpusOptions mixed;
+    mixed.expressions = 2000;
+    mixed.depth = 5;
+    mixed.variables = 16;
+    mixed.variable_ratio = 0.3;
+    mixed.comment_density = 0.1;
+
+    size_t bytes;
+    std::string mixed_path = make_corpus("mixed", mixed, bytes);
+    std::vector<Token> tokens;
+    if (!lex_file(mixed_path.c_str(), tokens))
+        return 1;
+
+    bench_reader(mixed_path, bytes);
+
+    // One corpus per lexer state, each dominated by the tokens that state handles.
+    CorpusOptions idents = mixed;
+    idents.variable_ratio = 1.0;
+    idents.comment_density = 0;
+    bench_lexer("ident", idents);
+
+    CorpusOptions integers = idents;
+    integers.variables = 0;
+    bench_lexer("integer", integers);
+
+    CorpusOptions punctuation = integers;
+    punctuation.depth = 10;
+    bench_lexer("punctuation", punctuation);
+
+    CorpusOptions strings = integers;
+    strings.string_density = 1.0;
+    bench_lexer("string", strings);
+
+    CorpusOptions escapes = strings;
+    escapes.unicode_density = 0.5;
+    bench_lexer("escape", escapes);
+
+    CorpusOptions text = strings;
+    text.text_density = 0.5;
+    bench_lexer("utf8", text);
+
+    CorpusOptions comments = integers;
+    comments.depth = 1;
+    comments.comment_density = 1.0;
+    bench_lexer("comment", comments);
+
+    bench_lexer("mixed", mixed);
+
+    bench_parse(tokens, bytes);
+
+    tree_gen parse_tree(tokens);
+    std::vector<Node *> heads;
+    if (!parse_tokens(parse_tree, heads))
+        return 1;
+    bench_backend(heads);
+    for (Node *head : heads)
+        parse_tree.delete_tree(head);
+
+    bench_pipeline(mixed_path, bytes, tokens.size());
+    bench_process(mixed_path, bytes, tokens.size());
+
+    if (suite.json_path != nullptr)
+    {
+        std::ofstream out(suite.json_path);
+        write_json(out);
+    }
+    else
+    {
+        write_json(std::cout);
+    }
+
+    int regressions = (suite.compare_path != nullptr) ? compare(suite.compare_path) : 0;
+
+    std::string cleanup = "rm -rf " + corpus_dir;
+    if (system(cleanup.c_str()) != 0)
+        std::cerr << "Could not remove " << corpus_dir << std::endl;
+
+    return regressions ? 1 : 0;
+}
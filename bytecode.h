@@ -0,0 +1,70 @@
+/**
+ * @file bytecode.h
+ * @author Jake Rogers (z1826513)
+ * @brief A compact bytecode for arithmetic expressions, and an interpreter
+ * to run it without needing any executable memory.
+ *
+ * The bytecode mirrors the stack machine the JIT emits: operands are pushed,
+ * and each operator pops its operands and pushes its result. A program starts
+ * with one mode byte (BC_MODE_* flags), and with BC_MODE_LOCALS a byte
+ * giving the number of locals, then every opcode is one byte, followed by
+ * its immediate (if any) in little-endian order:
+ *
+ *   BC_PUSH8  imm8     Push a sign-extended 8-bit value
+ *   BC_PUSH32 imm32    Push a sign-extended 32-bit value
+ *   BC_PUSH64 imm64    Push a 64-bit value (wide mode only)
+ *   BC_LOAD   slot8    Push the value of the variable in the given slot
+ *   BC_ADD, BC_SUB, BC_MUL, BC_DIV, BC_MOD, BC_EXP
+ *                      Pop two values (right on top) and push the result
+ *   BC_NEG             Negate the top of the stack
+ *   BC_KEEP   local8   Copy the top of the stack to the given local
+ *   BC_REUSE  local8   Push the value of the given local
+ *   BC_RET             Return the top of the stack
+ *
+ * Arithmetic wraps around exactly like the x86 instructions the JIT uses (or
+ * reports STATUS_OVERFLOW in checked mode), so both tiers always agree on
+ * results. Where IDIV would fault (dividing by zero, or the most negative
+ * value by -1) the interpreter stops with STATUS_DIVIDE_BY_ZERO or
+ * STATUS_DIVISION_OVERFLOW instead, and returns the offset of the BC_DIV or
+ * BC_MOD from the start of the program.
+ */
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <cstdint>
+
+#include "execution_exception.h"
+
+enum Bytecode : uint8_t
+{
+    BC_RET,
+    BC_PUSH8,
+    BC_PUSH32,
+    BC_ADD,
+    BC_SUB,
+    BC_MUL,
+    BC_DIV,
+    BC_MOD,
+    BC_EXP,
+    BC_NEG,
+    BC_LOAD,
+    BC_PUSH64,
+    BC_KEEP,
+    BC_REUSE,
+    BC_COUNT
+};
+
+// Flags for the mode byte at the start of every bytecode program.
+#define BC_MODE_WIDE 0x01       // 64-bit arithmetic rather than 32-bit
+#define BC_MODE_CHECKED 0x02    // Stop with STATUS_OVERFLOW on signed overflow
+#define BC_MODE_LOCALS 0x04     // Locals for shared subexpressions, counted by the next byte
+
+// Run the bytecode program starting at 'code' and return its result.
+// 'stack' must have room for at least locals + max_depth + 1 values, where
+// max_depth is the deepest the operand stack gets while running the program
+// (the locals take the bottom of it).
+// Variables are read from 'variables', indexed by slot. How the run went is
+// written to 'status'.
+int64_t interpret(const unsigned char* code, int64_t* stack, const int64_t* variables, ExecutionStatus* status);
+
+#endif
@@ -0,0 +1,288 @@
+/**
+ * @file client.cpp
+ * @author Jake Rogers (z1826513)
+ * @brief A small client for the compile server (see server.h), for trying
+ * it out and measuring it locally.
+ *
+ * Sends each source file (or stdin) as an eval request, keeping up to
+ * --pipeline requests outstanding at once, and prints each reply's output
+ * and diagnostics in request order, just as ./ncc would have printed them.
+ * --repeat sends every file that many times over, and a latency summary
+ * (measured by the client, from sending a request to reading its reply) is
+ * printed to stderr at the end.
+ *
+ * Usage: ./ncc_client [--socket path] [--pipeline N] [--repeat N] [--quiet]
+ *        [--stats] [--shutdown] [src_file...]
+ *
+ * The socket defaults to $NCC_SOCKET, or /tmp/ncc.sock.
+ */
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Reply
+{
+    std::string id;
+    std::string status;
+    std::string output;
+    std::string diagnostics;
+};
+
+class ServerConnection
+{
+public:
+    bool connect_to(const char *path)
+    {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(address.sun_path))
+            return false;
+        strcpy(address.sun_path, path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        return fd >= 0 && connect(fd, (sockaddr *)&address, sizeof(address)) == 0;
+    }
+
+    ~ServerConnection()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool send(const std::string &verb, const std::string &id, const std::string &body)
+    {
+        std::string frame = verb + " " + id + " " + std::to_string(body.size()) + "\n" + body;
+        size_t written = 0;
+        while (written < frame.size())
+        {
+            ssize_t n = write(fd, frame.data() + written, frame.size() - written);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            written += n;
+        }
+        return true;
+    }
+
+    bool receive(Reply &reply)
+    {
+        size_t newline;
+        while ((newline = buffer.find('\n', start)) == std::string::npos)
+            if (!fill())
+                return false;
+
+        std::istringstream header(buffer.substr(start, newline - start));
+        start = newline + 1;
+        size_t output_length, diagnostics_length;
+        if (!(header >> reply.id >> reply.status >> output_length >> diagnostics_length))
+            return false;
+
+        while (buffer.size() - start < output_length + diagnostics_length)
+            if (!fill())
+                return false;
+
+        reply.output = buffer.substr(start, output_length);
+        reply.diagnostics = buffer.substr(start + output_length, diagnostics_length);
+        start += output_length + diagnostics_length;
+        return true;
+    }
+
+private:
+    bool fill()
+    {
+        buffer.erase(0, start);
+        start = 0;
+
+        char chunk[65536];
+        ssize_t n;
+        do
+            n = read(fd, chunk, sizeof(chunk));
+        while (n < 0 && errno == EINTR);
+
+        if (n <= 0)
+            return false;
+        buffer.append(chunk, n);
+        return true;
+    }
+
+    int fd = -1;
+    std::string buffer;
+    size_t start = 0;
+};
+
+bool read_source(const char *path, std::string &source)
+{
+    std::stringstream text;
+    if (strcmp(path, "-") == 0)
+    {
+        text << std::cin.rdbuf();
+    }
+    else
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+        text << file.rdbuf();
+    }
+    source = text.str();
+    return true;
+}
+
+double percentile(std::vector<double> &sorted, double fraction)
+{
+    size_t rank = std::min(sorted.size() - 1, (size_t)(fraction * sorted.size()));
+    return sorted[rank];
+}
+
+int main(int argc, char **argv)
+{
+    const char *socket_path = getenv("NCC_SOCKET") ? getenv("NCC_SOCKET") : "/tmp/ncc.sock";
+    size_t pipeline = 1;
+    size_t repeat = 1;
+    bool quiet = false;
+    bool stats = false;
+    bool shutdown = false;
+    std::vector<const char *> paths;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+            socket_path = argv[++i];
+        else if (strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc)
+            pipeline = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+            repeat = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--quiet") == 0)
+            quiet = true;
+        else if (strcmp(argv[i], "--stats") == 0)
+            stats = true;
+        else if (strcmp(argv[i], "--shutdown") == 0)
+            shutdown = true;
+        else if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0)
+            paths.push_back(argv[i]);
+        else
+        {
+            std::cerr << "Usage: ./ncc_client [--socket path] [--pipeline N] [--repeat N] [--quiet] [--stats] [--shutdown] [src_file...]" << std::endl;
+            return 1;
+        }
+    }
+    if (paths.empty() && !stats && !shutdown)
+        paths.push_back("-");
+
+    std::vector<std::string> sources(paths.size());
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        if (!read_source(paths[i], sources[i]))
+        {
+            std::cerr << "Failed to read " << paths[i] << std::endl;
+            return 1;
+        }
+    }
+
+    ServerConnection server;
+    if (!server.connect_to(socket_path))
+    {
+        perror(socket_path);
+        return 1;
+    }
+
+    // Requests are numbered in the order they're sent; replies may come back
+    // in any order, so they wait here until everything before them is printed.
+    size_t total = sources.size() * repeat;
+    std::vector<Clock::time_point> sent_at(total);
+    std::vector<double> latencies;
+    std::map<size_t, Reply> waiting;
+    size_t sent = 0;
+    size_t received = 0;
+    size_t printed = 0;
+    size_t errors = 0;
+
+    Clock::time_point start = Clock::now();
+    while (received < total)
+    {
+        while (sent < total && sent - received < pipeline)
+        {
+            sent_at[sent] = Clock::now();
+            if (!server.send("eval", std::to_string(sent), sources[sent % sources.size()]))
+            {
+                std::cerr << "Lost the connection to the server." << std::endl;
+                return 1;
+            }
+            sent++;
+        }
+
+        Reply reply;
+        if (!server.receive(reply))
+        {
+            std::cerr << "Lost the connection to the server." << std::endl;
+            return 1;
+        }
+        if (reply.status == "protocol")
+        {
+            std::cerr << "Protocol error: " << reply.diagnostics;
+            return 1;
+        }
+
+        size_t id = strtoull(reply.id.c_str(), nullptr, 10);
+        latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - sent_at[id]).count());
+        errors += reply.status != "ok";
+        received++;
+
+        if (quiet)
+            continue;
+        waiting[id] = reply;
+        for (auto next = waiting.find(printed); next != waiting.end(); next = waiting.find(++printed))
+        {
+            std::cout << next->second.output;
+            std::cout.flush();
+            std::cerr << next->second.diagnostics;
+            waiting.erase(next);
+        }
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if (total > 0)
+    {
+        std::sort(latencies.begin(), latencies.end());
+        char summary[256];
+        snprintf(summary, sizeof(summary),
+            "%zu requests (%zu with errors) in %.3f s, pipeline %zu: %.0f requests/s, "
+            "latency p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+            total, errors, seconds, pipeline, total / seconds,
+            percentile(latencies, 0.5), percentile(latencies, 0.9), percentile(latencies, 0.99), latencies.back());
+        std::cerr << summary;
+    }
+
+    if (stats)
+    {
+        Reply reply;
+        if (!server.send("stats", "stats", "") || !server.receive(reply))
+            return 1;
+        std::cout << reply.output;
+    }
+
+    if (shutdown)
+    {
+        Reply reply;
+        if (!server.send("shutdown", "shutdown", "") || !server.receive(reply))
+            return 1;
+    }
+    return errors ? 1 : 0;
+}
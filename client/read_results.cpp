@@ -0,0 +1,97 @@
+/**
+ * @file read_results.cpp
+ * @author Jake Rogers (z1826513)
+ * @brief Prints a --results file (see result_stream.h) as CSV, and doubles
+ * as an example of reading one: map it, check the header, and step through
+ * the records in place.
+ *
+ * Usage: ./ncc_results results_file
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include "../result_stream.h"
+
+static const char *status_name(uint32_t status)
+{
+    switch (status)
+    {
+    case RESULT_OK:                 return "ok";
+    case RESULT_OVERFLOW:           return "overflow";
+    case RESULT_DIVIDE_BY_ZERO:     return "divide_by_zero";
+    case RESULT_DIVISION_OVERFLOW:  return "division_overflow";
+    case RESULT_UNBOUND_VARIABLE:   return "unbound_variable";
+    case RESULT_ASSEMBLY_ERROR:     return "assembly_error";
+    case RESULT_SYNTAX_ERROR:       return "syntax_error";
+    case RESULT_LEXICAL_ERROR:      return "lexical_error";
+    default:                        return "unknown";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: ./ncc_results results_file\n");
+        return 1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    if ((size_t)st.st_size < sizeof(ResultStreamHeader))
+    {
+        fprintf(stderr, "%s: too short to be a results file\n", argv[1]);
+        return 1;
+    }
+
+    const unsigned char *file = (const unsigned char *)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    const ResultStreamHeader *header = (const ResultStreamHeader *)file;
+    if (memcmp(header->magic, RESULT_STREAM_MAGIC, sizeof(header->magic)) != 0
+        || header->version != RESULT_STREAM_VERSION || header->record_size < sizeof(ResultRecord))
+    {
+        fprintf(stderr, "%s: not a results file this reader understands\n", argv[1]);
+        return 1;
+    }
+
+    // A file that's still being written may end part way into a record.
+    size_t count = (st.st_size - sizeof(ResultStreamHeader)) / header->record_size;
+    bool timing = header->flags & RESULT_STREAM_TIMING;
+
+    printf("file,expression,row,status,value,code_size,first_line,first_column,end_line,end_column%s\n",
+        timing ? ",assemble_ns,execute_ns" : "");
+    for (size_t i = 0; i < count; i++)
+    {
+        const ResultRecord *record = (const ResultRecord *)(file + sizeof(ResultStreamHeader) + i * header->record_size);
+        if (record->expression == RESULT_NO_EXPRESSION)
+            printf("%u,,", record->file);
+        else
+            printf("%u,%u,%u,", record->file, record->expression, record->row);
+
+        printf("%s,%" PRId64 ",%u,%u,%u,%u,%u", status_name(record->status), record->value, record->code_size,
+            record->first_line, record->first_column, record->end_line, record->end_column);
+        if (timing)
+            printf(",%" PRIu64 ",%" PRIu64, record->assemble_ns, record->execute_ns);
+        printf("\n");
+    }
+
+    munmap((void *)file, st.st_size);
+    return 0;
+}
@@ -0,0 +1,55 @@
+#include "code_arena.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+CodeArena& CodeArena::instance()
+{
+    static CodeArena singleton;
+    return singleton;
+}
+
+CodeArena::CodeArena()
+{
+    stride = BLOCK_SIZE + sysconf(_SC_PAGESIZE);
+}
+
+unsigned char* CodeArena::allocate()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (free_blocks.empty())
+    {
+        TraceSpan mmap_span("mmap", "memory");
+        void* slab = mmap(
+            0,
+            stride * SLAB_BLOCKS,
+            PROT_EXEC | PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0);
+        mmap_span.stop();
+        Stats::instance().count_mmap();
+
+        if (slab == MAP_FAILED)
+            return nullptr;
+
+        for (size_t i = 0; i < SLAB_BLOCKS; i++)
+            mprotect((unsigned char*)slab + i * stride + BLOCK_SIZE, stride - BLOCK_SIZE, PROT_NONE);
+
+        // Hand out the lowest addresses first.
+        for (size_t i = SLAB_BLOCKS; i > 0; i--)
+            free_blocks.push_back((unsigned char*)slab + (i - 1) * stride);
+    }
+
+    unsigned char* block = free_blocks.back();
+    free_blocks.pop_back();
+    return block;
+}
+
+void CodeArena::release(unsigned char* block)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    free_blocks.push_back(block);
+}
@@ -0,0 +1,54 @@
+/**
+ * @file code_arena.h
+ * @author Jake Rogers (z1826513)
+ * @brief A process-wide pool of executable memory blocks for assembled
+ * programs.
+ *
+ * Every JIT-ed expression needs a buffer that is writable while it's being
+ * assembled and executable afterwards. Mapping a fresh one per expression
+ * costs two system calls (and a TLB shootdown on unmap) for what is often a
+ * few dozen bytes of code. The arena maps blocks a slab at a time and keeps
+ * released ones on a free list, so after warming up, assembling an
+ * expression makes no system calls at all.
+ *
+ * The arena is shared by every thread (allocate/release take a short lock),
+ * which is what lets batch mode reuse blocks across files. Slabs are never
+ * unmapped; the arena only ever grows to the peak number of programs alive
+ * at once.
+ *
+ * Programs check they fit in their block as they're encoded, but blocks of
+ * a slab are contiguous, so one which didn't would silently overwrite its
+ * neighbour, some other live program. Each block is followed by a PROT_NONE
+ * guard page so that can only ever fault.
+ */
+#ifndef CODE_ARENA_H
+#define CODE_ARENA_H
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+class CodeArena
+{
+public:
+    static CodeArena& instance();
+
+    // A readable, writable and executable block of BLOCK_SIZE bytes, or
+    // nullptr if no more memory could be mapped.
+    unsigned char* allocate();
+
+    // Hand a block from allocate() back for reuse.
+    void release(unsigned char* block);
+
+    static const size_t BLOCK_SIZE = 53248;     // Program buffer, rounded up to whole pages
+    static const size_t SLAB_BLOCKS = 16;       // Blocks mapped at a time
+
+private:
+    CodeArena();
+
+    size_t stride;              // BLOCK_SIZE plus its guard page
+    std::mutex lock;
+    std::vector<unsigned char*> free_blocks;
+};
+
+#endif
@@ -0,0 +1,290 @@
+#include "code_cache.h"
+#include "stats.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+CodeCache::CodeCache()
+{
+    const char* env_dir = getenv("NCC_CACHE_DIR");
+    if (env_dir != nullptr && env_dir[0] != '\0')
+    {
+        directory = env_dir;
+    }
+    else
+    {
+        const char* home = getenv("HOME");
+        directory = std::string(home ? home : ".") + "/.cache/ncc";
+    }
+
+    key = 0;
+    source_loaded = false;
+    mapping = nullptr;
+    mapping_size = 0;
+}
+
+CodeCache::~CodeCache()
+{
+    if (mapping != nullptr)
+    {
+        munmap(mapping, mapping_size);
+        Stats::instance().count_munmap();
+    }
+}
+
+uint64_t CodeCache::fnv1a(const void* data, size_t length, uint64_t hash)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+bool CodeCache::load_source(const char* src_path)
+{
+    int fd = open(src_path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    key = fnv1a(NCC_VERSION, strlen(NCC_VERSION), FNV_OFFSET_BASIS);
+
+    // An empty file can't be mapped, but it still has a perfectly good hash.
+    if (st.st_size > 0)
+    {
+        void* src = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        Stats::instance().count_mmap();
+        if (src == MAP_FAILED)
+        {
+            close(fd);
+            return false;
+        }
+        key = fnv1a(src, st.st_size, key);
+        munmap(src, st.st_size);
+        Stats::instance().count_munmap();
+    }
+
+    close(fd);
+    source_loaded = true;
+    return true;
+}
+
+bool CodeCache::load_text(const std::string& source)
+{
+    key = fnv1a(NCC_VERSION, strlen(NCC_VERSION), FNV_OFFSET_BASIS);
+    key = fnv1a(source.data(), source.size(), key);
+    source_loaded = true;
+    return true;
+}
+
+void CodeCache::add_key(const std::string& extra)
+{
+    key = fnv1a(extra.data(), extra.size(), key);
+}
+
+std::string CodeCache::entry_path()
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.ncc", (unsigned long long)key);
+    return directory + name;
+}
+
+bool CodeCache::lookup(std::vector<CachedExpression>& out)
+{
+    if (!source_loaded)
+        return false;
+
+    int fd = open(entry_path().c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;   // A plain miss.
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CacheHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    // Map the whole file as executable. If the cache directory lives on a
+    // noexec mount this fails, and we simply fall back to compiling.
+    void* base = mmap(0, st.st_size, PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+    Stats::instance().count_mmap();
+    close(fd);
+    if (base == MAP_FAILED)
+        return false;
+
+    const unsigned char* file = (const unsigned char*)base;
+    const CacheHeader* header = (const CacheHeader*)file;
+    size_t file_size = st.st_size;
+
+    // Validate everything before trusting a single offset.
+    bool valid = memcmp(header->magic, "NCCCACHE", 8) == 0
+        && header->key == key
+        && sizeof(CacheHeader) + (uint64_t)header->expression_count * sizeof(CacheEntry) <= file_size
+        && header->code_offset + header->code_size <= file_size
+        && header->text_offset + header->text_size <= file_size;
+
+    const CacheEntry* entries = (const CacheEntry*)(file + sizeof(CacheHeader));
+    for (uint32_t i = 0; valid && i < header->expression_count; i++)
+    {
+        valid = (uint64_t)entries[i].code_offset + entries[i].code_length <= header->code_size
+            && (uint64_t)entries[i].text_offset + entries[i].text_length <= header->text_size
+            && (uint64_t)entries[i].vars_offset + entries[i].vars_length <= header->text_size
+            && (uint64_t)entries[i].traps_offset + (uint64_t)entries[i].traps_count * sizeof(TrapSite)
+                <= header->text_size;
+    }
+
+    if (!valid)
+    {
+        munmap(base, file_size);
+        Stats::instance().count_munmap();
+        return false;
+    }
+
+    out.clear();
+    for (uint32_t i = 0; i < header->expression_count; i++)
+    {
+        CachedExpression expr;
+        expr.code = file + header->code_offset + entries[i].code_offset;
+        expr.code_length = entries[i].code_length;
+        expr.tree_text.assign(
+            (const char*)(file + header->text_offset + entries[i].text_offset),
+            entries[i].text_length);
+
+        const char* vars = (const char*)(file + header->text_offset + entries[i].vars_offset);
+        const char* vars_end = vars + entries[i].vars_length;
+        while (vars < vars_end)
+        {
+            const char* line_end = (const char*)memchr(vars, '\n', vars_end - vars);
+            if (line_end == nullptr)
+                line_end = vars_end;
+            expr.variables.push_back(std::string(vars, line_end));
+            vars = line_end + 1;
+        }
+
+        expr.traps.resize(entries[i].traps_count);
+        if (!expr.traps.empty())
+            memcpy(expr.traps.data(), file + header->text_offset + entries[i].traps_offset,
+                expr.traps.size() * sizeof(TrapSite));
+
+        out.push_back(expr);
+    }
+
+    if (mapping != nullptr)
+    {
+        munmap(mapping, mapping_size);
+        Stats::instance().count_munmap();
+    }
+    mapping = base;
+    mapping_size = file_size;
+    return true;
+}
+
+bool CodeCache::store(const std::vector<CachedExpression>& expressions)
+{
+    if (!source_loaded)
+        return false;
+
+    // Make sure the cache directory (and its parent, for the default
+    // location) exist. Failures here surface when opening the file below.
+    size_t parent_end = directory.find_last_of('/');
+    if (parent_end != std::string::npos && parent_end > 0)
+        mkdir(directory.substr(0, parent_end).c_str(), 0755);
+    mkdir(directory.c_str(), 0755);
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "NCCCACHE", 8);
+    header.key = key;
+    header.expression_count = expressions.size();
+
+    std::vector<CacheEntry> entries;
+    std::string code_blob;
+    std::string text_blob;
+    for (const CachedExpression& expr : expressions)
+    {
+        CacheEntry entry;
+        entry.code_offset = code_blob.size();
+        entry.code_length = expr.code_length;
+        entry.text_offset = text_blob.size();
+        entry.text_length = expr.tree_text.size();
+        text_blob.append(expr.tree_text);
+
+        entry.vars_offset = text_blob.size();
+        for (const std::string& name : expr.variables)
+            text_blob.append(name + "\n");
+        entry.vars_length = text_blob.size() - entry.vars_offset;
+
+        entry.traps_offset = text_blob.size();
+        entry.traps_count = expr.traps.size();
+        text_blob.append((const char*)expr.traps.data(), expr.traps.size() * sizeof(TrapSite));
+        entries.push_back(entry);
+
+        code_blob.append((const char*)expr.code, expr.code_length);
+    }
+
+    // Start the code blob on a page boundary, keeping the header and entry
+    // table off of the pages which hold code.
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t table_end = sizeof(CacheHeader) + entries.size() * sizeof(CacheEntry);
+    header.code_offset = (table_end + page - 1) / page * page;
+    header.code_size = code_blob.size();
+    header.text_offset = header.code_offset + header.code_size;
+    header.text_size = text_blob.size();
+
+    std::string file;
+    file.append((const char*)&header, sizeof(header));
+    if (!entries.empty())
+        file.append((const char*)entries.data(), entries.size() * sizeof(CacheEntry));
+    file.resize(header.code_offset, '\0');
+    file.append(code_blob);
+    file.append(text_blob);
+
+    std::string final_path = entry_path();
+    // A name of its own for every writer, threads of one process included,
+    // so two storing the same entry never write into each other's file.
+    std::string temp_path = final_path + ".XXXXXX";
+
+    int fd = mkstemp(&temp_path[0]);
+    if (fd < 0)
+        return false;
+    fchmod(fd, 0644);   // mkstemp makes it 0600
+
+    size_t written = 0;
+    while (written < file.size())
+    {
+        ssize_t n = write(fd, file.data() + written, file.size() - written);
+        if (n <= 0)
+        {
+            close(fd);
+            unlink(temp_path.c_str());
+            return false;
+        }
+        written += n;
+    }
+    close(fd);
+
+    if (rename(temp_path.c_str(), final_path.c_str()) != 0)
+    {
+        unlink(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,120 @@
+/**
+ * @file code_cache.h
+ * @author Jake Rogers (z1826513)
+ * @brief A persistent, content-addressed cache of assembled programs.
+ *
+ * Every run of ncc over the same source file does the exact same work: lex,
+ * parse, print and assemble each expression. The CodeCache keys a source file
+ * by a hash of its bytes (plus the compiler version), and stores the machine
+ * code of every expression it produced alongside the metadata needed to
+ * reproduce the output (the printed code tree) and bind its variables.
+ *
+ * The machine code emitted by EncodedProgram only ever uses the stack and
+ * registers, so it is position-independent. That means on a cache hit the
+ * cache file can be mmapped straight in as executable memory and each
+ * expression can be called right where it sits, skipping the front end
+ * entirely.
+ *
+ * Cache file layout (all offsets relative to the start of the file):
+ *
+ *   CacheHeader
+ *   CacheEntry[expression_count]
+ *   ...padding to a page boundary...
+ *   code blob  (code_offset, code_size)
+ *   text blob  (text_offset, text_size)
+ */
+#ifndef CODE_CACHE_H
+#define CODE_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "trap_handler.h"
+
+// Bump whenever the code generator changes what it emits, so stale
+// cache files are never mistaken for valid ones.
+#define NCC_VERSION "ncc-0.5"
+
+struct CacheHeader
+{
+    char magic[8];              // "NCCCACHE"
+    uint64_t key;               // Hash of the source bytes and compiler version
+    uint32_t expression_count;
+    uint32_t reserved;
+    uint64_t code_offset;
+    uint64_t code_size;
+    uint64_t text_offset;
+    uint64_t text_size;
+};
+
+struct CacheEntry
+{
+    uint32_t code_offset;       // Relative to the code blob
+    uint32_t code_length;
+    uint32_t text_offset;       // Relative to the text blob
+    uint32_t text_length;
+    uint32_t vars_offset;       // Variable names, one per line, in slot order.
+    uint32_t vars_length;       // Also relative to the text blob.
+    uint32_t traps_offset;      // TrapSites, as raw bytes. Also relative to
+    uint32_t traps_count;       // the text blob, and not aligned.
+};
+
+// One assembled expression, either about to be stored or just loaded.
+struct CachedExpression
+{
+    const unsigned char* code;
+    uint32_t code_length;
+    std::string tree_text;      // The pretty-printed code tree
+    std::vector<std::string> variables;     // Variable name of each slot
+    std::vector<TrapSite> traps;            // Where the code can fault
+};
+
+class CodeCache
+{
+public:
+    // Create a cache rooted at the directory named by $NCC_CACHE_DIR,
+    // or $HOME/.cache/ncc if that is unset.
+    CodeCache();
+
+    // Unmaps anything handed out by lookup().
+    ~CodeCache();
+
+    // Hashes the source file at src_path. Must be called before lookup or
+    // store. Returns false if the file could not be read.
+    bool load_source(const char* src_path);
+
+    // The same for source text that's already in memory, such as a request
+    // to the compile server. Always succeeds.
+    bool load_text(const std::string& source);
+
+    // Try to map the cache file for the loaded source. On a hit, 'out' is
+    // filled with one CachedExpression per expression whose code points into
+    // executable, read-only memory owned by the cache.
+    bool lookup(std::vector<CachedExpression>& out);
+
+    // Write the given expressions to the cache file for the loaded source.
+    // The file is written to a temporary name and renamed into place so a
+    // concurrent reader never observes a partial file.
+    bool store(const std::vector<CachedExpression>& expressions);
+
+    // Mix an additional string into the key, for options which change the
+    // code that is generated.
+    void add_key(const std::string& extra);
+
+private:
+    // 64-bit FNV-1a hash, continuing from 'hash'.
+    static uint64_t fnv1a(const void* data, size_t length, uint64_t hash);
+
+    // Full path of the cache file for the current key.
+    std::string entry_path();
+
+    std::string directory;
+    uint64_t key;
+    bool source_loaded;
+
+    void* mapping;              // Result of the last successful lookup
+    size_t mapping_size;
+};
+
+#endif
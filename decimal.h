@@ -0,0 +1,66 @@
+/**
+ * @file decimal.h
+ * @author Jake Rogers (z1826513)
+ * @brief Converts the digits of an integer literal to its value, eight
+ * digits at a time.
+ *
+ * The lexer has already checked that a literal is nothing but ASCII digits,
+ * so there's no sign, whitespace or locale to deal with, and no need for
+ * strtoll's generality. Eight digits are loaded as one 64-bit word and
+ * combined in three multiply-and-mask steps (SWAR, SIMD within a register):
+ * pairs of digits into 2-digit values, pairs of those into 4-digit values,
+ * then the two halves into the 8-digit value.
+ *
+ * Overflow is checked without trial multiplication: anything up to 19
+ * significant digits fits in a uint64_t, so it's enough to count the digits
+ * and compare the value against INT64_MAX.
+ */
+#ifndef DECIMAL_H
+#define DECIMAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * @brief The value of exactly eight ASCII digits, most significant first.
+ * Assumes a little-endian machine, as the JIT does.
+ */
+inline uint32_t parse_eight_digits(const char *digits)
+{
+    uint64_t word;
+    memcpy(&word, digits, sizeof(word));
+    word -= 0x3030303030303030ull;                                      // '0' from every byte
+    word = (word * 10 + (word >> 8)) & 0x00ff00ff00ff00ffull;           // 2-digit values in 16-bit lanes
+    word = (word * 100 + (word >> 16)) & 0x0000ffff0000ffffull;         // 4-digit values in 32-bit lanes
+    return (uint32_t)(word * 10000 + (word >> 32));
+}
+
+/**
+ * @brief Convert 'length' ASCII digits to a non-negative int64_t.
+ *
+ * @return false (leaving 'value' alone) if the literal doesn't fit in 63 bits.
+ */
+inline bool parse_decimal(const char *digits, size_t length, int64_t &value)
+{
+    while (length > 1 && *digits == '0')    // Leading zeros don't count towards the 19
+    {
+        digits++;
+        length--;
+    }
+    if (length > 19)
+        return false;
+
+    uint64_t result = 0;
+    for (; length >= 8; digits += 8, length -= 8)
+        result = result * 100000000 + parse_eight_digits(digits);
+    for (; length > 0; digits++, length--)
+        result = result * 10 + (*digits - '0');
+
+    if (result > (uint64_t)INT64_MAX)
+        return false;
+    value = (int64_t)result;
+    return true;
+}
+
+#endif
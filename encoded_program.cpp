@@ -1,47 +1,269 @@
 #include "encoded_program.h"
 
-EncodedProgram::EncodedProgram(Node *parse_tree_head)
+#include <cstring>
+
+#include "string_pool.h"
+
+// Shared subexpressions live in a frame of at most this many slots, as many
+// as a bytecode slot number can name. Any more are encoded every time.
+#define MAX_SHARED_SLOTS 255
+
+EncodedProgram::EncodedProgram(Node *parse_tree_head, ExecutionTier tier, ArithmeticMode mode,
+    bool share_subexpressions)
 {
     this->parse_tree_head = parse_tree_head;
+    this->tier = tier;
+    this->mode = mode;
+    this->share_subexpressions = share_subexpressions;
     initialize();
 }
 
+EncodedProgram::EncodedProgram(const unsigned char *code, int length, std::vector<std::string> variables,
+    ArithmeticMode mode, std::vector<TrapSite> traps)
+{
+    this->mode = mode;
+    variable_names = variables;
+    trap_sites = traps;
+    this->parse_tree_head = nullptr;
+    program = (unsigned char *)code;
+    program_offset = length;
+    owns_program = false;
+    tier = ExecutionTier::JIT;
+}
+
 void EncodedProgram::assemble()
 {
-    traverse(parse_tree_head);
+    try
+    {
+        encode_all();
+    }
+    catch (CodeBufferFull &e)
+    {
+        ir = IrFunction();
+        throw ParseException("Expression is too large, its code doesn't fit in " + std::to_string(PROGRAM_SIZE)
+            + " bytes.", parse_tree_head->token);
+    }
+}
+
+void EncodedProgram::encode_all()
+{
+    if (passes != nullptr)
+        plan_ir();
+    else if (share_subexpressions)
+        plan_sharing();
+
+    encode_program();
+    if (shared_slots == 0 || bytes_eliminated() > 0)
+    {
+        ir = IrFunction();
+        return;
+    }
+
+    // Keeping values cost more than reusing them saved (typically the
+    // frame, for one small reuse), so encode every value where it's used
+    // instead.
+    program_offset = 0;
+    overflow_stub = Label();
+    trap_sites.clear();
+    variable_names.clear();
+    variable_handles.clear();
+    stack_depth = max_stack_depth = 0;
+    shared_slot.assign(shared_slot.size(), -1);
+    kept.assign(kept.size(), false);
+    shared_slots = 0;
+    shared_nodes = removed_bytes = added_bytes = 0;
+    if (passes != nullptr)
+        adopt_ir_variables();
+
+    encode_program();
+    ir = IrFunction();
+}
+
+void EncodedProgram::encode_program()
+{
+    if (tier == ExecutionTier::INTERPRETER)
+    {
+        ENCODE (mode.wide ? BC_MODE_WIDE : 0) | (mode.check_overflow ? BC_MODE_CHECKED : 0)
+            | (shared_slots ? BC_MODE_LOCALS : 0);
+        if (shared_slots)
+        {
+            // The locals sit below the operand stack.
+            ENCODE (uint8_t)shared_slots;
+            added_bytes++;
+            stack_depth = max_stack_depth = shared_slots;
+        }
+        encode_expression();
+        ENCODE BC_RET;
+        return;
+    }
 
-    // The result should be the final item in the stack. Pop it out to EAX
+    // Checked programs keep their entry stack pointer in RBP, so the
+    // overflow stub can throw away whatever is left on the operand stack.
+    // Shared subexpressions are kept in slots just below it.
+    X86Assembler as = x86();
+    jit_depth = 0;
+    int frame_start = program_offset;
+    if (mode.check_overflow || shared_slots)
+    {
+        push_reg(Reg::RBP);
+        as.mov(Width::Q, Reg::RBP, Reg::RSP);
+    }
+
+    if (shared_slots)
+    {
+        as.sub(Width::Q, Reg::RSP, shared_slots * 8);
+        jit_depth += shared_slots;
+    }
+    int prologue = program_offset - frame_start;
+
+    encode_expression();
+
+    // The result should be the final item in the stack. Pop it out to RAX
     // and return it!
-    pop(0);
+    pop(Reg::RAX);
 
-    ENCODE 0xc3;   // RET
+    int epilogue_start = program_offset;
+    if (shared_slots)
+        as.mov(Width::Q, Reg::RSP, Reg::RBP);
+
+    if (mode.check_overflow || shared_slots)
+        pop(Reg::RBP);
+
+    // Whatever of the frame checked mode wouldn't have needed anyway.
+    if (shared_slots)
+        added_bytes += (prologue + program_offset - epilogue_start) - (mode.check_overflow ? 5 : 0);
+
+    as.ret();
+
+    if (overflow_stub.fixups.empty())
+        return;
+
+    // The shared overflow stub. Every JO lands here.
+    as.bind(overflow_stub);
+    as.mov(Width::D, Mem(Reg::RSI), STATUS_OVERFLOW);
+    as.mov(Width::Q, Reg::RSP, Reg::RBP);
+    pop(Reg::RBP);
+    as.ret();
 }
 
-void EncodedProgram::execute()
+void EncodedProgram::encode_expression()
 {
-    int value = 0;
-    
-    value = ((int(*)())program)();
-    printf("Program Length: %u bytes\n", program_offset);
-    printf("Output: %d\n", value);
+    if (passes != nullptr)
+        traverse_ir(ir.result);
+    else if (shared_slots)
+        traverse_dag(dag_root);
+    else
+        traverse(parse_tree_head);
+}
+
+void EncodedProgram::execute(const int64_t *variables, OutputBuffer &out)
+{
+    int64_t value = run(variables);
+    out << "Program Length: " << program_offset << " bytes\n";
+    out << "Output: " << value << "\n";
+
+    release();
+}
+
+int64_t EncodedProgram::run(const int64_t *variables)
+{
+    ExecutionStatus status = STATUS_OK;
+    int64_t value;
+
+    if (tier == ExecutionTier::INTERPRETER)
+    {
+        // Small expressions get by on a stack-allocated operand stack.
+        int64_t small_stack[64];
+        if (max_stack_depth < 64)
+        {
+            value = interpret(program, small_stack, variables, &status);
+        }
+        else
+        {
+            std::vector<int64_t> big_stack(max_stack_depth + 1);
+            value = interpret(program, big_stack.data(), variables, &status);
+        }
+    }
+    else if (trap_sites.empty())
+    {
+        value = ((CompiledExpression)program)(variables, &status);
+    }
+    else
+    {
+        TrapHandler::Scope scope(program, program_offset, trap_sites, mode.wide, &status);
+        value = ((CompiledExpression)program)(variables, &status);
+    }
+
+    switch (status)
+    {
+    case STATUS_OK:
+        break;
+    case STATUS_OVERFLOW:
+        throw ExecutionException(mode.wide ? "64-bit integer overflow." : "32-bit integer overflow.", status);
+    case STATUS_DIVIDE_BY_ZERO:
+    case STATUS_DIVISION_OVERFLOW:
+    {
+        // The result is the offset of the division which faulted.
+        std::string message = (status == STATUS_DIVIDE_BY_ZERO) ? "Division by zero"
+            : (mode.wide ? "64-bit division overflow" : "32-bit division overflow");
+        const TrapSite *site = TrapHandler::find(trap_sites, value);
+        if (site != nullptr)
+            message += " at " + std::to_string(site->line) + ":" + std::to_string(site->column);
+        throw ExecutionException(message + ".", status);
+    }
+    }
+
+    // Narrow programs only ever set EAX, the top half of RAX is junk.
+    if (tier == ExecutionTier::JIT && !mode.wide)
+        value = (int32_t)value;
+
+    return value;
+}
 
-    munmap(program, PROGRAM_SIZE);
+void EncodedProgram::release()
+{
+    if (owns_program && program != nullptr)
+    {
+        if (tier == ExecutionTier::INTERPRETER)
+            free(program);
+        else
+            CodeArena::instance().release(program);
+    }
+    program = nullptr;
+}
+
+bool EncodedProgram::jit_available()
+{
+    // A function-local static is initialized exactly once, even when batch
+    // mode's workers all ask at the same time.
+    static const bool available = []() {
+        void *probe = mmap(0, 4096, PROT_EXEC | PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (probe == MAP_FAILED)
+            return false;
+        munmap(probe, 4096);
+        return true;
+    }();
+    return available;
 }
 
 void EncodedProgram::initialize()
 {
     program_offset = 0;
-    program = (unsigned char *)mmap(
-        0,
-        PROGRAM_SIZE,
-        PROT_EXEC | PROT_READ | PROT_WRITE,
-        MAP_PRIVATE | MAP_ANONYMOUS,
-        -1,
-        0);
 
-    // std::cout << "Allocated " << PROGRAM_SIZE << " bytes at " << (int *)program << " for program." << std::endl;
+    // Bytecode doesn't need to be executable, plain heap memory will do.
+    if (tier == ExecutionTier::INTERPRETER)
+    {
+        program = (unsigned char *)malloc(PROGRAM_SIZE);
+        if (program == nullptr)
+            throw "Failed to allocate memory for program!";
+        return;
+    }
 
-    if (errno)
+    // Executable buffers come from the shared arena, which only maps memory
+    // when it has no released block to hand out.
+    program = CodeArena::instance().allocate();
+    if (program == nullptr)
     {
         perror("mmap");
         throw "Failed to allocate memory for program!";
@@ -59,14 +281,33 @@ void EncodedProgram::traverse(Node *n)
         traverse(n->child);
     }
 
+    if (tier == ExecutionTier::INTERPRETER)
+        emit_bytecode(n->token);
+    else
+        encode_node(n->token);
+
+    if (n->sibling != nullptr)
+    {
+        traverse(n->sibling);
+    }
+}
+
+void EncodedProgram::encode_node(const Token &token)
+{
     // Based on the ID of the current token, we'll want
     // to either encode a push of it's i-value if it's an integer,
     // or encode an operation on the previous two items in the stack
     // (unless it is unary, of course).
-    switch (n->token.id)
+    switch (token.id)
     {
     case (TypeID::INTEGER):
-        push_imm32(n->token.i_value);
+        if (!mode.wide && token.i_value > INT32_MAX)
+            throw ParseException("Integer literal does not fit in 32 bits (try --int64).", token);
+        push_imm(token.i_value);
+        break;
+
+    case (TypeID::IDENT):
+        push_variable(variable_slot(token));
         break;
 
     case ('+'):
@@ -82,11 +323,11 @@ void EncodedProgram::traverse(Node *n)
         break;
 
     case ('/'):
-        stack_divide(false);
+        stack_divide(false, token);
         break;
 
     case (TypeID::MOD):
-        stack_divide(true); // divide returns the remainder if parm1 is true.
+        stack_divide(true, token); // divide returns the remainder if parm1 is true.
         break;
 
     case ('^'):
@@ -102,15 +343,288 @@ void EncodedProgram::traverse(Node *n)
         break;
 
     default:    // Didn't recognize the ID? that's no good, throw an error!
-        throw ParseException("Encountered unsupported symbol during assembly.", n->token);
+        throw ParseException("Encountered unsupported symbol during assembly.", token);
         // exit(-1);
     }
-    
+}
 
-    if (n->sibling != nullptr)
+void EncodedProgram::emit_bytecode(const Token &token)
+{
+    switch (token.id)
     {
-        traverse(n->sibling);
+    case (TypeID::INTEGER):
+        // Most literals are small, so use the short form when we can.
+        if (!mode.wide && token.i_value > INT32_MAX)
+        {
+            throw ParseException("Integer literal does not fit in 32 bits (try --int64).", token);
+        }
+        else if (token.i_value >= INT8_MIN && token.i_value <= INT8_MAX)
+        {
+            ENCODE BC_PUSH8;
+            ENCODE (uint8_t)token.i_value;
+        }
+        else if (token.i_value >= INT32_MIN && token.i_value <= INT32_MAX)
+        {
+            ENCODE BC_PUSH32;
+            encode_imm32(token.i_value);
+        }
+        else
+        {
+            ENCODE BC_PUSH64;
+            encode_imm32(token.i_value & 0xffffffff);
+            encode_imm32(token.i_value >> 32);
+        }
+
+        stack_depth++;
+        if (stack_depth > max_stack_depth)
+            max_stack_depth = stack_depth;
+        return;
+
+    case (TypeID::IDENT):
+    {
+        int slot = variable_slot(token);
+        if (slot > UINT8_MAX)
+            throw ParseException("Too many variables in one expression for the bytecode tier.", token);
+        ENCODE BC_LOAD;
+        ENCODE (uint8_t)slot;
+
+        stack_depth++;
+        if (stack_depth > max_stack_depth)
+            max_stack_depth = stack_depth;
+        return;
     }
+
+    case ('+'):
+        ENCODE BC_ADD;
+        break;
+
+    case ('-'):
+        ENCODE BC_SUB;
+        break;
+
+    case ('*'):
+        ENCODE BC_MUL;
+        break;
+
+    case ('/'):
+        add_trap_site(token);
+        ENCODE BC_DIV;
+        break;
+
+    case (TypeID::MOD):
+        add_trap_site(token);
+        ENCODE BC_MOD;
+        break;
+
+    case ('^'):
+        ENCODE BC_EXP;
+        break;
+
+    case (TypeID::NEGATE):
+        ENCODE BC_NEG;
+        return;     // Unary, the stack depth doesn't change.
+
+    case (TypeID::UPLUS):
+        return;     // Nothing to encode at all.
+
+    default:
+        throw ParseException("Encountered unsupported symbol during assembly.", token);
+    }
+
+    // Binary operators pop two and push one.
+    stack_depth--;
+}
+
+void EncodedProgram::plan_sharing()
+{
+    dag_root = dag.add(parse_tree_head);
+    shared_slot.assign(dag.size(), -1);
+    kept.assign(dag.size(), false);
+    plain_bytes.assign(dag.size(), 0);
+
+    // A literal or variable costs about as much to push again as to reuse,
+    // and the same goes for an operator on just one of them, so only
+    // subexpressions of three or more nodes get a slot.
+    for (uint32_t id = 0; id < dag.size() && shared_slots < MAX_SHARED_SLOTS; id++)
+    {
+        const ExpressionDag::DagNode &n = dag.node(id);
+        if (n.uses > 1 && n.tree_nodes >= 3)
+            shared_slot[id] = shared_slots++;
+    }
+}
+
+void EncodedProgram::traverse_dag(uint32_t id)
+{
+    const ExpressionDag::DagNode &n = dag.node(id);
+    if (reuse_kept(id, n.tree_nodes))
+        return;
+
+    // Operands in order, then the node itself, as traverse() would.
+    uint64_t plain = 0;
+    for (uint32_t i = 0; i < n.operand_count; i++)
+    {
+        uint32_t operand = dag.operand(n, i);
+        traverse_dag(operand);
+        plain += plain_bytes[operand];
+    }
+
+    int node_start = program_offset;
+    encode_operation(n.token);
+    plain_bytes[id] = plain + (program_offset - node_start);
+    keep_if_worthwhile(id, n.uses);
+}
+
+void EncodedProgram::plan_ir()
+{
+    ir = lower_tree(parse_tree_head, mode.wide, mode.check_overflow);
+    passes->run(ir);
+    adopt_ir_variables();
+
+    // The passes leave each value computed once, so anything used twice is
+    // a candidate for a slot; whether it's worth one is up to
+    // keep_if_worthwhile(), as for the DAG. Literals and variables are
+    // never worth it.
+    ir_uses = ir.use_counts();
+    ir_tree_nodes.assign(ir.instrs.size(), 1);
+    shared_slot.assign(ir.instrs.size(), -1);
+    kept.assign(ir.instrs.size(), false);
+    plain_bytes.assign(ir.instrs.size(), 0);
+    for (uint32_t v = 0; v < ir.instrs.size(); v++)
+    {
+        const IrInstr &instr = ir.instrs[v];
+        for (unsigned i = 0; i < IrFunction::operand_count(instr.op); i++)
+            ir_tree_nodes[v] += ir_tree_nodes[instr.operands[i]];
+        if (ir_uses[v] > 1 && IrFunction::operand_count(instr.op) > 0 && shared_slots < MAX_SHARED_SLOTS)
+            shared_slot[v] = shared_slots++;
+    }
+}
+
+void EncodedProgram::adopt_ir_variables()
+{
+    // Every variable the source named keeps its slot, even one the passes
+    // optimised away, so binding (and failing to bind) it works as before.
+    for (uint32_t handle : ir.variable_handles)
+    {
+        variable_handles.push_back(handle);
+        variable_names.emplace_back(StringPool::instance().view(handle));
+    }
+}
+
+void EncodedProgram::traverse_ir(uint32_t v)
+{
+    const IrInstr &instr = ir.instrs[v];
+    if (reuse_kept(v, ir_tree_nodes[v]))
+        return;
+
+    uint64_t plain = 0;
+    for (unsigned i = 0; i < IrFunction::operand_count(instr.op); i++)
+    {
+        traverse_ir(instr.operands[i]);
+        plain += plain_bytes[instr.operands[i]];
+    }
+
+    int node_start = program_offset;
+    encode_operation(instr.token);
+    plain_bytes[v] = plain + (program_offset - node_start);
+    keep_if_worthwhile(v, ir_uses[v]);
+}
+
+void EncodedProgram::encode_operation(const Token &token)
+{
+    if (tier == ExecutionTier::INTERPRETER)
+        emit_bytecode(token);
+    else
+        encode_node(token);
+}
+
+bool EncodedProgram::reuse_kept(uint32_t id, uint64_t tree_nodes)
+{
+    int slot = shared_slot[id];
+    if (slot < 0 || !kept[id])
+        return false;
+
+    int reuse_start = program_offset;
+    reuse_shared(slot);
+    added_bytes += program_offset - reuse_start;
+    removed_bytes += plain_bytes[id];
+    shared_nodes += tree_nodes;
+    return true;
+}
+
+void EncodedProgram::keep_if_worthwhile(uint32_t id, uint64_t uses)
+{
+    int slot = shared_slot[id];
+    if (slot < 0)
+        return;
+
+    // Keep it if every later occurrence reusing it beats encoding it again,
+    // counting the copy to its slot. Otherwise forget the slot.
+    uint64_t reuses = uses - 1;
+    bool near = (tier == ExecutionTier::INTERPRETER || (slot + 1) * 8 <= 128);
+    uint64_t keep_cost = (tier == ExecutionTier::INTERPRETER) ? 2 : (near ? 4 : 7);
+    uint64_t reuse_cost = (tier == ExecutionTier::INTERPRETER) ? 2 : (near ? 3 : 6);
+    if (reuses * plain_bytes[id] <= keep_cost + reuses * reuse_cost)
+    {
+        shared_slot[id] = -1;
+        return;
+    }
+
+    int keep_start = program_offset;
+    keep_shared(slot);
+    added_bytes += program_offset - keep_start;
+    kept[id] = true;
+}
+
+void EncodedProgram::keep_shared(int slot)
+{
+    if (tier == ExecutionTier::INTERPRETER)
+    {
+        ENCODE BC_KEEP;
+        ENCODE (uint8_t)slot;
+        return;
+    }
+
+    if (VERBOSE)
+        printf("MOV [RBP - %d], r%d\n", (slot + 1) * 8, (int)last_pushed);
+
+    // The value just pushed is still in the register it was pushed from.
+    x86().mov(Width::Q, frame_slot(slot), last_pushed);
+}
+
+void EncodedProgram::reuse_shared(int slot)
+{
+    if (tier == ExecutionTier::INTERPRETER)
+    {
+        ENCODE BC_REUSE;
+        ENCODE (uint8_t)slot;
+
+        stack_depth++;
+        if (stack_depth > max_stack_depth)
+            max_stack_depth = stack_depth;
+        return;
+    }
+
+    if (VERBOSE)
+        printf("PUSH [RBP - %d]\n", (slot + 1) * 8);
+
+    x86().push(frame_slot(slot));
+    jit_depth++;
+}
+
+void EncodedProgram::add_trap_site(const Token &token)
+{
+    TrapSite site = {};
+    site.offset = program_offset;
+    site.stack_depth = jit_depth;
+    site.framed = mode.check_overflow || shared_slots;
+    site.line = token.line;
+    site.column = token.column;
+    trap_sites.push_back(site);
+}
+
+Mem EncodedProgram::frame_slot(int slot)
+{
+    return Mem(Reg::RBP, -(slot + 1) * 8);
 }
 
 void EncodedProgram::encode_imm32(int32_t value)
@@ -125,39 +639,70 @@ void EncodedProgram::encode_imm32(int32_t value)
     }
 }
 
-uint8_t EncodedProgram::mod_rm(uint8_t op1, uint8_t op2)
+int EncodedProgram::variable_slot(const Token &ident)
 {
-    // ModR/M ascends from 0xc0 to 0xFF in column-major order,
-    // so we can navigate it like a flattened 2D array!
-    return 0xc0 + (op1 * 8) + op2;
+    for (size_t slot = 0; slot < variable_handles.size(); slot++)
+        if (variable_handles[slot] == ident.text)
+            return slot;
+
+    int slot = variable_names.size();
+    variable_handles.push_back(ident.text);
+    variable_names.emplace_back(ident.value());
+    return slot;
 }
 
-void EncodedProgram::push_imm32(int32_t value)
+void EncodedProgram::push_variable(int slot)
 {
     if (VERBOSE)
-        printf("PUSH %d\n", value);
-    
-    // PUSH id
-    ENCODE 0x68;
-    encode_imm32(value);
+        printf("PUSH [RDI + %d]\n", slot * 8);
+
+    // The variables pointer arrives in RDI (System V). Load the slot into RAX
+    // (or just EAX when narrow), then push it.
+    x86().mov(width(), Reg::RAX, Mem(Reg::RDI, slot * 8));
+    push_reg(Reg::RAX);
 }
 
-void EncodedProgram::push_reg(uint8_t reg)
+void EncodedProgram::push_imm(int64_t value)
 {
     if (VERBOSE)
-        printf("PUSH r%d\n", reg);
+        printf("PUSH %lld\n", (long long)value);
 
-    // PUSH r#
-    ENCODE 0x50 + reg;
+    // PUSH imm8/imm32, sign-extended to 64 bits, so it works for both widths.
+    if (value >= INT32_MIN && value <= INT32_MAX)
+    {
+        x86().push((int32_t)value);
+        jit_depth++;
+        return;
+    }
+
+    // Values which don't fit go through RAX (wide mode only).
+    x86().mov(Reg::RAX, value);
+    push_reg(Reg::RAX);
+}
+
+void EncodedProgram::jump_on_overflow()
+{
+    if (mode.check_overflow)
+        x86().jcc(Cond::O, overflow_stub);
 }
 
-void EncodedProgram::pop(uint8_t reg)
+void EncodedProgram::push_reg(Reg reg)
 {
     if (VERBOSE)
-        printf("POP r%d\n", reg);
+        printf("PUSH r%d\n", (int)reg);
 
-    // POP r#
-    ENCODE 0x58 + reg;
+    x86().push(reg);
+    last_pushed = reg;
+    jit_depth++;
+}
+
+void EncodedProgram::pop(Reg reg)
+{
+    if (VERBOSE)
+        printf("POP r%d\n", (int)reg);
+
+    x86().pop(reg);
+    jit_depth--;
 }
 
 void EncodedProgram::stack_add()
@@ -166,16 +711,14 @@ void EncodedProgram::stack_add()
         printf("->STACK ADD\n");
 
     // Grab the two operands from the stack into EAX, ECX
-    pop(1);
-    pop(0);
+    pop(Reg::RCX);
+    pop(Reg::RAX);
 
-    // ADD EAX, ECX
-    ENCODE 0x01;
-    ENCODE mod_rm(1, 0);
+    x86().add(width(), Reg::RAX, Reg::RCX);
+    jump_on_overflow();
 
     // The result goes back on the stack.
-    // POP EAX
-    push_reg(0);
+    push_reg(Reg::RAX);
 
     if (VERBOSE)
         printf("<-STACK ADD\n");
@@ -187,15 +730,13 @@ void EncodedProgram::stack_subtract()
         printf("->STACK_SUB\n");
     
     // Grab the two operands from the stack into EAX, ECX. Order matters here.
-    pop(1); 
-    pop(0); 
+    pop(Reg::RCX);
+    pop(Reg::RAX);
 
-    // SUB EAX, ECX
-    ENCODE 0x29;
-    ENCODE mod_rm(1, 0);
+    x86().sub(width(), Reg::RAX, Reg::RCX);
+    jump_on_overflow();
 
-    // PUSH r0
-    push_reg(0);
+    push_reg(Reg::RAX);
 
     if (VERBOSE)
         printf("<-STACK_SUB\n");
@@ -206,40 +747,37 @@ void EncodedProgram::stack_multiply()
     if (VERBOSE)
         printf("->STACK_MULT\n");
 
-    pop(1);
-    pop(0);
+    pop(Reg::RCX);
+    pop(Reg::RAX);
 
-    // IMULT EAX, ECX
-    ENCODE 0x0f;
-    ENCODE 0xaf;
-    ENCODE mod_rm(0, 1);
+    x86().imul(width(), Reg::RAX, Reg::RCX);
+    jump_on_overflow();
 
-    push_reg(0);
+    push_reg(Reg::RAX);
 
     if (VERBOSE)
         printf("<-STACK_MULT\n");
 }
 
-void EncodedProgram::stack_divide(bool mod)
+void EncodedProgram::stack_divide(bool mod, const Token &token)
 {
     if (VERBOSE)
         printf("->STACK_DIV\n");
 
-    pop(1);
-    pop(0);
-
-    // Zero out EDX.
-    // XOR EDX, EDX
-    ENCODE 0x31;
-    ENCODE mod_rm(2, 2);
+    pop(Reg::RCX);
+    pop(Reg::RAX);
 
-    // IDIV EAX:EDX, ECX
-    ENCODE 0xf7;
-    ENCODE 0xf9;
+    // Sign-extend EAX into EDX, so negative dividends divide correctly,
+    // then IDIV EDX:EAX, ECX.
+    // IDIV faults on a zero divisor (or MIN / -1), which the TrapHandler
+    // catches by its site.
+    X86Assembler as = x86();
+    as.sign_extend_rax(width());
+    add_trap_site(token);
+    as.idiv(width(), Reg::RCX);
 
     // Push either EAX for the Quotient or EDX for the remainder.
-    uint8_t returned_reg = (mod) ? 2 : 0;
-    push_reg(returned_reg);
+    push_reg(mod ? Reg::RDX : Reg::RAX);
 
     if (VERBOSE)
         printf("<-STACK_DIV\n");
@@ -250,13 +788,13 @@ void EncodedProgram::stack_exponentiate()
     if (VERBOSE)
         printf("->STACK_EXP\n");
 
-    pop(1);
-    pop(0);
+    pop(Reg::RCX);
+    pop(Reg::RAX);
 
     // In the future, exponentiation will occur here!
     // For now, just return the left operand.
 
-    push_reg(0);
+    push_reg(Reg::RAX);
 
     if (VERBOSE)
         printf("<-STACK_EXP\n");
@@ -266,9 +804,9 @@ void EncodedProgram::stack_uplus()
 {
     // Grab the last value of the stack, do nothing with it,
     // and then push it back on the stack. A very apathetic operator.
-    pop(0);
+    pop(Reg::RAX);
 
-    push_reg(0);
+    push_reg(Reg::RAX);
 }
 
 void EncodedProgram::stack_negation()
@@ -276,13 +814,12 @@ void EncodedProgram::stack_negation()
     if (VERBOSE)
         printf("->STACK_NEG\n");
 
-    pop(0);
+    pop(Reg::RAX);
 
-    // NEG EAX
-    ENCODE 0xf7;
-    ENCODE 0xd8;
+    x86().neg(width(), Reg::RAX);
+    jump_on_overflow();
 
-    push_reg(0);
+    push_reg(Reg::RAX);
 
     if (VERBOSE)
         printf("<-STACK_NEG\n");
@@ -11,51 +11,226 @@
 #define ENCODED_PROGRAM_H
 
 #include <iostream>
+#include <vector>
+#include <string>
+#include <cstdlib>
 #include <sys/mman.h>
 
 #include "node.h"
+#include "expression_dag.h"
+#include "ir.h"
+#include "ir_passes.h"
 #include "parse_exception.h"
+#include "bytecode.h"
+#include "code_arena.h"
+#include "execution_exception.h"
+#include "output_buffer.h"
+#include "stats.h"
+#include "trap_handler.h"
+#include "x86_assembler.h"
 
 #define VERBOSE false   // Prints out heaps of debugging info, pretty ugly
-#define ENCODE program[program_offset++]=   // Shorthand for adding one byte to the program and advancing the pointer.
+#define ENCODE program[next_byte()]=   // Shorthand for adding one byte to the program and advancing the pointer.
+
+// Signature of an assembled JIT program. Each variable in the expression is
+// read from variables[slot], see EncodedProgram::variables(). Checked programs
+// report overflow through 'status' (unchecked ones never touch it).
+typedef int64_t (*CompiledExpression)(const int64_t *variables, ExecutionStatus *status);
+
+// How an EncodedProgram does its arithmetic. Narrow programs work on 32-bit
+// values (variables are still passed as 64 bits, only the low half is read);
+// wide ones on 64-bit values. Unchecked arithmetic wraps around, checked
+// arithmetic stops the program with an ExecutionException on overflow.
+struct ArithmeticMode
+{
+    bool wide = false;
+    bool check_overflow = false;
+};
+
+// How an EncodedProgram is run. JIT programs are x86 machine code in an
+// executable mapping, INTERPRETER programs are bytecode (see bytecode.h) in
+// ordinary heap memory.
+enum class ExecutionTier
+{
+    JIT,
+    INTERPRETER
+};
 
 class EncodedProgram
 {
 public:
     // Create a new program for the arithmetic expression described in
-    // parse_tree_head
-    EncodedProgram(Node* parse_tree_head);
+    // parse_tree_head, to be run by the given tier. With
+    // 'share_subexpressions', the tree is first hash-consed into an
+    // ExpressionDag, and a subexpression occurring more than once is
+    // evaluated once, kept in a stack slot (a local, for bytecode) and
+    // reused from there.
+    EncodedProgram(Node* parse_tree_head, ExecutionTier tier = ExecutionTier::JIT,
+        ArithmeticMode mode = ArithmeticMode(), bool share_subexpressions = false);
+
+    // Wrap code which has already been assembled and lives in executable
+    // memory owned by someone else (e.g. the CodeCache). Such a program is
+    // ready to execute, and execute() will not unmap it. 'variables' names
+    // the variable in each slot, as variables() would have after assembly,
+    // and 'mode' and 'traps' must be the mode the code was assembled with
+    // and the trap sites it came out with.
+    EncodedProgram(const unsigned char* code, int length,
+        std::vector<std::string> variables = std::vector<std::string>(),
+        ArithmeticMode mode = ArithmeticMode(), std::vector<TrapSite> traps = std::vector<TrapSite>());
+
+    // Lower the tree to IR (see ir.h) and run 'passes' over it before
+    // encoding, instead of encoding the tree as it is. Each value the
+    // optimised IR uses more than once is then kept in a slot, much as
+    // sharing subexpressions does (which this takes the place of). Call
+    // before assemble(); nullptr goes back to encoding the tree.
+    inline void optimize_with(const PassManager* passes) {this->passes = passes;}
 
     // Starts the traversal of the parse tree to encode the expression, then
-    // an instruction to return the EAX register.
+    // an instruction to return the RAX register. The finished program is a
+    // CompiledExpression taking a pointer to its variables. Throws a
+    // ParseException if the code would overflow the program buffer.
     void assemble();
 
     // Run the program and print the output and number of bytes taken to encode
-    // it. Also releases the memory for the program once finished.
-    void execute();
+    // it to 'out'. Also releases the memory for the program once finished.
+    void execute(const int64_t* variables, OutputBuffer& out);
+
+    // Run the program once with the given variable bindings (one per slot
+    // in variables()) and return the result. Assemble once, run() as many
+    // times as needed, then release(). Throws an ExecutionException if the
+    // program fails, e.g. on overflow in checked mode or dividing by zero.
+    int64_t run(const int64_t* variables);
+
+    // Free the memory holding the program. Done for you by execute().
+    void release();
+
+    // The names of the expression's variables, indexed by the slot each one
+    // is read from. Filled in order of first appearance during assembly.
+    inline const std::vector<std::string>& variables() const {return variable_names;}
+
+    // The assembled machine code and its length in bytes.
+    inline const unsigned char* code() const {return program;}
+    inline int length() const {return program_offset;}
+    inline ExecutionTier get_tier() const {return tier;}
+
+    // Every division in the code, by offset, with the token it was encoded
+    // for and (for machine code) what the TrapHandler needs to return from
+    // the program if it faults.
+    inline const std::vector<TrapSite>& traps() const {return trap_sites;}
+    inline ArithmeticMode get_mode() const {return mode;}
+
+    // What sharing subexpressions saved: how many parse tree nodes were
+    // never compiled, and how many code bytes that was net of the code
+    // keeping and reusing shared values. When sharing wouldn't have made
+    // the program any shorter it isn't done, and these are all zero.
+    inline uint64_t nodes_eliminated() const {return shared_nodes;}
+    inline int64_t bytes_eliminated() const {return (int64_t)removed_bytes - (int64_t)added_bytes;}
+    inline uint64_t bytes_removed() const {return removed_bytes;}
+    inline uint64_t bytes_added() const {return added_bytes;}
+
+    // True if this process is allowed to map memory as executable. Probed
+    // once, on the first call.
+    static bool jit_available();
 private:
     // Use mmap to space from memory for our program.
     void initialize();
 
+    // Encode the whole program for assemble(), sharing subexpressions if
+    // plan_sharing() gave any a slot.
+    void encode_program();
+
+    // Encode just the expression's value, from the IR, the DAG or the tree.
+    void encode_expression();
+
     // Traversing the parse tree in post-order, create an appropriate encoding
     // per each node visited. More info in the definition.
     void traverse(Node* n);
 
+    // Encode the operation for a single visited node, by calling the
+    // appropriate stack_* function below.
+    void encode_node(const Token& token);
+
+    // The bytecode tier's counterpart to encode_node().
+    void emit_bytecode(const Token& token);
+
+    // Build the ExpressionDag for the tree and give a slot to each shared
+    // subexpression worth keeping (see the definition).
+    void plan_sharing();
+
+    // traverse() over the DAG: encode the node 'id' and its operands, or
+    // reuse its value if it's been kept already.
+    void traverse_dag(uint32_t id);
+
+    // Lower and optimise the tree, then give a slot to each value used
+    // more than once.
+    void plan_ir();
+
+    // Give the variables the IR found their slots, in the same order.
+    void adopt_ir_variables();
+
+    // traverse() over the IR: encode value 'v' and its operands, or reuse
+    // it if it's been kept already.
+    void traverse_ir(uint32_t v);
+
+    // Encode 'token' with encode_node() or emit_bytecode(), for the tier.
+    void encode_operation(const Token& token);
+
+    // For traverse_dag() and traverse_ir(): push value 'id' from its slot
+    // if it's been kept there, returning false if not; and after encoding
+    // it, keep it in its slot if its 'uses' make that worth it.
+    bool reuse_kept(uint32_t id, uint64_t tree_nodes);
+    void keep_if_worthwhile(uint32_t id, uint64_t uses);
+
+    // Copy the value on top of the stack to shared 'slot', or push the
+    // value kept there.
+    void keep_shared(int slot);
+    void reuse_shared(int slot);
+
+    // [RBP - 8 * (slot + 1)], the frame slot holding shared 'slot'.
+    static Mem frame_slot(int slot);
+
     // Helper function to add four bytes representing 'value' to the program
-    // in little-endian order.
+    // in little-endian order (for bytecode; machine code goes through x86()).
     void encode_imm32(int32_t value);
 
-    // Returns the mod_rm byte for the two given register operands (order matters,
-    // of course!)
-    uint8_t mod_rm(uint8_t op1, uint8_t op2);
+    // An assembler writing machine code at the end of the program.
+    inline X86Assembler x86() {return X86Assembler(program, program_offset, PROGRAM_SIZE);}
+
+    // The offset ENCODE writes its byte at, advancing past it. Throws
+    // CodeBufferFull rather than write past the end of the program.
+    inline int next_byte()
+    {
+        if (program_offset >= (int)PROGRAM_SIZE)
+            throw CodeBufferFull();
+        return program_offset++;
+    }
+
+    // All of assemble(), which only turns running out of room into a
+    // ParseException.
+    void encode_all();
+
+    // Operand size of the program's arithmetic.
+    inline Width width() const {return mode.wide ? Width::Q : Width::D;}
+
+    // Returns the slot for the named variable, giving it the next one if
+    // this is its first appearance.
+    int variable_slot(const Token& ident);
+
+    // Push the value of the variable in 'slot' to the stack.
+    void push_variable(int slot);
 
     // Push value directly to the stack by passing value as an immediate.
-    void push_imm32(int32_t value);
+    // Values which don't fit in 32 bits go through RAX (wide mode only).
+    void push_imm(int64_t value);
+
+    // In checked mode, jump to the overflow stub if the last operation
+    // overflowed. Does nothing otherwise.
+    void jump_on_overflow();
 
-    void push_reg(uint8_t reg);
+    void push_reg(Reg reg);
 
     // Pop a value off the stack into the specified register.
-    void pop(uint8_t reg);
+    void pop(Reg reg);
 
     // The following stack operators perform their respective operation
     // on the last two values in the stack (or just one value in the case
@@ -65,8 +240,11 @@ private:
     void stack_multiply();
     
     // mod = false will return the quotient, mod = true will return the
-    // remainder.
-    void stack_divide(bool mod);
+    // remainder. 'token' is the one the trap site is for.
+    void stack_divide(bool mod, const Token& token);
+
+    // Record the instruction about to be encoded as a trap site for 'token'.
+    void add_trap_site(const Token& token);
     void stack_exponentiate();
     void stack_uplus();
     void stack_negation();
@@ -74,7 +252,35 @@ private:
     Node* parse_tree_head;      // Parse tree to build the program from.
     unsigned char * program;    // Address of our program in memory
     int program_offset = 0;     // offset to 'program' shows where the next encoded byte should go.
-    const unsigned int PROGRAM_SIZE = 50000;    // Big buffer for our program!
+    bool owns_program = true;   // False when 'program' was handed to us already assembled.
+    ExecutionTier tier;
+    ArithmeticMode mode;
+    Label overflow_stub;        // Every JO jumps here, bound once the code is done.
+    std::vector<TrapSite> trap_sites;   // Every division, in code order
+    int jit_depth = 0;          // Qwords the machine code has pushed so far
+    std::vector<std::string> variable_names;                // Slot -> name
+    std::vector<uint32_t> variable_handles;                 // Slot -> name's StringPool handle, searched in order (expressions have few)
+    Reg last_pushed = Reg::RAX; // Register of the last push_reg(), where a result just pushed still is.
+
+    // Sharing subexpressions, or encoding from the IR, only. The per-id
+    // vectors are indexed by DAG id or IR value.
+    bool share_subexpressions = false;
+    ExpressionDag dag;
+    uint32_t dag_root = 0;
+    const PassManager* passes = nullptr;
+    IrFunction ir;                          // Released after assembly
+    std::vector<uint32_t> ir_uses;
+    std::vector<uint64_t> ir_tree_nodes;    // Value -> nodes in the tree it stands for
+    std::vector<int> shared_slot;           // Id -> slot, or -1 to encode it every time
+    std::vector<bool> kept;                 // Id -> its value is in its slot already
+    std::vector<uint64_t> plain_bytes;      // Id -> bytes encoding it costs without sharing
+    int shared_slots = 0;
+    uint64_t shared_nodes = 0;
+    uint64_t removed_bytes = 0;
+    uint64_t added_bytes = 0;
+    int stack_depth = 0;        // Bytecode only: current and deepest operand stack depth.
+    int max_stack_depth = 0;
+    const unsigned int PROGRAM_SIZE = 50000;    // Big buffer for our program! (At most CodeArena::BLOCK_SIZE)
 };
 
 #endif
\ No newline at end of file
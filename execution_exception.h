@@ -0,0 +1,51 @@
+/**
+ * @file execution_exception.h
+ * @author Jake Rogers (z1826513)
+ * @brief Used to report errors which happen while an assembled program is
+ * running, such as an overflow caught in checked arithmetic mode or a
+ * division by zero. Assembled code can't throw on its own, so it reports an
+ * ExecutionStatus back to EncodedProgram, which turns it into one of these.
+ */
+#ifndef EXECUTION_EXCEPTION_H
+#define EXECUTION_EXCEPTION_H
+
+#include <string>
+#include <exception>
+
+// Written by assembled programs (JIT or bytecode) to tell their caller how
+// the run went. Anything but STATUS_OK means the result is meaningless,
+// except that after a division fault it's the offset of the division in the
+// code (see trap_handler.h).
+enum ExecutionStatus
+{
+    STATUS_OK = 0,
+    STATUS_OVERFLOW = 1,
+    STATUS_DIVIDE_BY_ZERO = 2,
+    STATUS_DIVISION_OVERFLOW = 3    // The most negative value divided by -1
+};
+
+class ExecutionException : public std::exception
+{
+public:
+    ExecutionException(std::string msg, ExecutionStatus status)
+    {
+        this->msg = msg;
+        this->status = status;
+    }
+
+    std::string message()
+    {
+        return "Runtime Error: " + msg;
+    }
+
+    ExecutionStatus get_status()
+    {
+        return status;
+    }
+
+private:
+    std::string msg;
+    ExecutionStatus status;
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include "expression_dag.h"
+
+#define INITIAL_INDEX 64    // A power of two
+
+ExpressionDag::ExpressionDag()
+    : index(INITIAL_INDEX, 0), added_tree_nodes(0)
+{
+}
+
+uint32_t ExpressionDag::add(Node *head)
+{
+    uint32_t id = add_node(head);
+    nodes[id].uses++;
+    added_tree_nodes += nodes[id].tree_nodes;
+    return id;
+}
+
+uint32_t ExpressionDag::add_node(Node *n)
+{
+    // Operands are added first (pushed on 'pending' above anything our
+    // callers are still collecting), then looked up together with the token.
+    size_t base = pending.size();
+    uint32_t tree_nodes = 1;
+    for (Node *child = n->child; child != nullptr; child = child->sibling)
+    {
+        uint32_t id = add_node(child);
+        pending.push_back(id);
+        tree_nodes += nodes[id].tree_nodes;
+    }
+
+    uint32_t id = intern(n->token, pending.data() + base, pending.size() - base, tree_nodes);
+    pending.resize(base);
+    return id;
+}
+
+uint32_t ExpressionDag::intern(const Token &token, const uint32_t *operands, uint32_t count, uint32_t tree_nodes)
+{
+    size_t mask = index.size() - 1;
+    size_t slot = hash(token, operands, count) & mask;
+    for (; index[slot]; slot = (slot + 1) & mask)
+        if (matches(nodes[index[slot] - 1], token, operands, count))
+            return index[slot] - 1;
+
+    uint32_t id = nodes.size();
+    nodes.push_back({token, (uint32_t)operand_ids.size(), count, 0, tree_nodes});
+    for (uint32_t i = 0; i < count; i++)
+    {
+        operand_ids.push_back(operands[i]);
+        nodes[operands[i]].uses++;
+    }
+    index[slot] = id + 1;
+
+    // Keep the index under half full so probes stay short.
+    if (nodes.size() * 2 > index.size())
+        grow();
+    return id;
+}
+
+uint64_t ExpressionDag::hash(const Token &token, const uint32_t *operands, uint32_t count)
+{
+    const uint64_t multiplier = 0x9e3779b97f4a7c15ull;
+    uint64_t h = (uint8_t)token.id * multiplier;
+    h = (h ^ (uint64_t)token.i_value) * multiplier;
+    h = (h ^ token.text) * multiplier;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        h = (h ^ operands[i]) * multiplier;
+        h ^= h >> 29;
+    }
+    return h ^ (h >> 32);
+}
+
+bool ExpressionDag::matches(const DagNode &n, const Token &token, const uint32_t *operands, uint32_t count) const
+{
+    // Interned text makes the token comparison three integer compares.
+    if (n.token.id != token.id || n.token.i_value != token.i_value || n.token.text != token.text
+        || n.operand_count != count)
+        return false;
+    for (uint32_t i = 0; i < count; i++)
+        if (operand_ids[n.first_operand + i] != operands[i])
+            return false;
+    return true;
+}
+
+void ExpressionDag::grow()
+{
+    index.assign(index.size() * 2, 0);
+    size_t mask = index.size() - 1;
+    for (uint32_t id = 0; id < nodes.size(); id++)
+    {
+        const DagNode &n = nodes[id];
+        size_t slot = hash(n.token, operand_ids.data() + n.first_operand, n.operand_count) & mask;
+        while (index[slot])
+            slot = (slot + 1) & mask;
+        index[slot] = id + 1;
+    }
+}
+
+void ExpressionDag::clear()
+{
+    nodes.clear();
+    operand_ids.clear();
+    index.assign(INITIAL_INDEX, 0);
+    added_tree_nodes = 0;
+}
@@ -0,0 +1,78 @@
+/**
+ * @file expression_dag.h
+ * @author Jake Rogers (z1826513)
+ * @brief A hash-consing node factory, which turns parse trees into a DAG
+ * where every distinct subexpression appears exactly once.
+ *
+ * tree_gen builds a fresh Node for every occurrence of a subexpression, so
+ * "(a*b+c) - (a*b+c)" is two identical trees of five nodes each. Adding a
+ * tree to an ExpressionDag looks each node up by its token (id, value and
+ * text) and the DAG nodes of its operands: a node seen before gets the same
+ * id back, so both "a*b+c" above become one DAG node used twice, and the
+ * "a*b" inside it one node used once.
+ *
+ * DAG nodes are stored in a vector and named by index. Operands always
+ * come before the nodes using them, so walking ids upwards is a valid
+ * evaluation order. The lookup table is open addressed, like StringPool's.
+ */
+#ifndef EXPRESSION_DAG_H
+#define EXPRESSION_DAG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "node.h"
+
+class ExpressionDag
+{
+public:
+    struct DagNode
+    {
+        Token token;                // That of the first occurrence, for error messages
+        uint32_t first_operand;     // Where its operand ids start, see operand()
+        uint32_t operand_count;
+        uint32_t uses;              // How many operands of other nodes (or add() calls) it is
+        uint32_t tree_nodes;        // How many tree nodes one occurrence of it stands for
+    };
+
+    ExpressionDag();
+
+    /**
+     * @brief Add the expression rooted at 'head' (its children, but not its
+     * siblings), sharing every subexpression already in the DAG.
+     *
+     * @return The id of the expression's DAG node.
+     */
+    uint32_t add(Node *head);
+
+    inline const DagNode& node(uint32_t id) const {return nodes[id];}
+    inline uint32_t operand(const DagNode& n, uint32_t i) const {return operand_ids[n.first_operand + i];}
+
+    // How many distinct nodes there are, and how many tree nodes were added
+    // in all. The difference is what sharing saved.
+    inline size_t size() const {return nodes.size();}
+    inline uint64_t tree_nodes() const {return added_tree_nodes;}
+    inline uint64_t nodes_eliminated() const {return added_tree_nodes - nodes.size();}
+
+    void clear();
+
+private:
+    uint32_t add_node(Node *n);
+
+    // The id of the node with this token and these operands, creating it if
+    // there isn't one yet.
+    uint32_t intern(const Token& token, const uint32_t *operands, uint32_t count, uint32_t tree_nodes);
+
+    static uint64_t hash(const Token& token, const uint32_t *operands, uint32_t count);
+    bool matches(const DagNode& n, const Token& token, const uint32_t *operands, uint32_t count) const;
+    void grow();
+
+    std::vector<DagNode> nodes;
+    std::vector<uint32_t> operand_ids;
+    std::vector<uint32_t> index;    // Open addressing: id + 1, 0 when empty
+    std::vector<uint32_t> pending;  // Operand ids of the nodes being added, innermost last
+    uint64_t added_tree_nodes;
+};
+
+#endif
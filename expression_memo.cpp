@@ -0,0 +1,81 @@
+#include "expression_memo.h"
+
+#include "stats.h"
+#include "string_pool.h"
+
+ExpressionMemo::ExpressionMemo(size_t capacity)
+    : capacity(capacity)
+{
+}
+
+ExpressionMemo::~ExpressionMemo()
+{
+    for (Entry &entry : entries)
+        entry.program.release();
+}
+
+void ExpressionMemo::append_key(Node *n, std::vector<uint64_t> &key)
+{
+    // The child count goes with the id, filled in once the children are in.
+    size_t header = key.size();
+    key.push_back((uint8_t)n->token.id);
+    key.push_back(n->token.text);
+    key.push_back((uint64_t)n->token.i_value);
+
+    uint64_t children = 0;
+    for (Node *child = n->child; child != nullptr; child = child->sibling, children++)
+        append_key(child, key);
+    key[header] |= children << 8;
+}
+
+ExpressionMemo::Entry* ExpressionMemo::find(Node *head)
+{
+    Stats &stats = Stats::instance();
+    stats.count(stats.memo_lookups);
+
+    pending_key.clear();
+    append_key(head, pending_key);
+    pending_hash = StringPool::hash((const char *)pending_key.data(), pending_key.size() * sizeof(uint64_t));
+
+    auto found = index.find(pending_hash);
+    if (found == index.end() || found->second->key != pending_key)
+        return nullptr;
+
+    // Move it to the front, it's the most recently used now.
+    entries.splice(entries.begin(), entries, found->second);
+    stats.count(stats.memo_hits);
+    if (found->second->known)
+        stats.count(stats.memo_results);
+    return &*found->second;
+}
+
+ExpressionMemo::Entry* ExpressionMemo::insert(const EncodedProgram &program)
+{
+    // A different expression with the same hash makes way for this one.
+    auto found = index.find(pending_hash);
+    if (found != index.end())
+    {
+        found->second->program.release();
+        entries.erase(found->second);
+        index.erase(found);
+    }
+
+    if (entries.size() >= capacity && !entries.empty())
+    {
+        Entry &oldest = entries.back();
+        oldest.program.release();
+        index.erase(oldest.hash);
+        entries.pop_back();
+        Stats::instance().count(Stats::instance().memo_evictions);
+    }
+
+    entries.emplace_front(std::move(pending_key), pending_hash, program);
+    index[pending_hash] = entries.begin();
+    pending_key.clear();
+    return &entries.front();
+}
+
+void ExpressionMemo::forget_code(Entry *entry)
+{
+    entry->program.release();
+}
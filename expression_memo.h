@@ -0,0 +1,80 @@
+/**
+ * @file expression_memo.h
+ * @author Jake Rogers (z1826513)
+ * @brief Remembers the expressions already compiled from one source file,
+ * so a duplicate isn't assembled (or, if it's constant, run) again.
+ *
+ * Generated files repeat the same expression text often. Each parse tree
+ * is reduced to a canonical key: its nodes in pre-order, each as its token
+ * (id, value and text handle) and number of children. Line and column are
+ * left out, and so are redundant parentheses, which the parser never turns
+ * into nodes. Two expressions with the same key compile to the same code,
+ * so the memo hands back the program assembled for the first one.
+ *
+ * A program with no variables always gives the same result, so once it has
+ * run the result is kept instead and its code released; duplicates of it
+ * are never run at all. Programs with variables (which --bind or --rows
+ * may give different values) keep their code and are run again.
+ *
+ * The memo holds at most 'capacity' expressions, dropping the least
+ * recently used one to make room. It belongs to one thread: each file (or
+ * server request) being compiled gets its own.
+ */
+#ifndef EXPRESSION_MEMO_H
+#define EXPRESSION_MEMO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "encoded_program.h"
+#include "node.h"
+
+class ExpressionMemo
+{
+public:
+    struct Entry
+    {
+        std::vector<uint64_t> key;
+        uint64_t hash;
+        EncodedProgram program;     // Owned by the memo, released on eviction
+        bool known = false;         // The program is constant and has run once
+        int64_t value = 0;          // Its result, if known
+
+        Entry(std::vector<uint64_t> key, uint64_t hash, const EncodedProgram& program)
+            : key(std::move(key)), hash(hash), program(program) {}
+    };
+
+    explicit ExpressionMemo(size_t capacity);
+    ~ExpressionMemo();
+
+    /**
+     * @brief Look up the expression rooted at 'head'.
+     *
+     * @return Its entry, or nullptr if it hasn't been compiled yet (in which
+     * case its key is kept for insert()).
+     */
+    Entry* find(Node *head);
+
+    // Keep 'program', assembled from the expression last passed to find(),
+    // and return its entry. The memo owns the program from now on.
+    Entry* insert(const EncodedProgram& program);
+
+    // A constant program's result has been recorded in 'entry', so its code
+    // isn't needed any more.
+    void forget_code(Entry *entry);
+
+private:
+    static void append_key(Node *n, std::vector<uint64_t>& key);
+
+    size_t capacity;
+    std::list<Entry> entries;   // Most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;     // By hash
+    std::vector<uint64_t> pending_key;  // Of the last find()
+    uint64_t pending_hash = 0;
+};
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * @file keywords.h
+ * @author Jake Rogers (z1826513)
+ * @brief Recognises the identifiers that are really keywords.
+ *
+ * Keywords are looked up in a perfect hash table built at compile time, so
+ * an identifier costs one hash (of its length and its first and last
+ * bytes), one length check and at most one memcmp, however many keywords
+ * there are, and nothing is allocated. Adding a keyword is adding a line to
+ * KEYWORDS; if the new keyword collides with another, the static_assert
+ * below fails and KEYWORD_SALT needs bumping until it doesn't.
+ */
+#ifndef KEYWORDS_H
+#define KEYWORDS_H
+
+#include <cstddef>
+#include <cstring>
+
+#include "../token.h"
+
+struct Keyword
+{
+    const char *name;
+    size_t length;
+    char id;
+};
+
+static constexpr Keyword KEYWORDS[] = {
+    {"mod", 3, TypeID::MOD},
+};
+
+#define KEYWORD_SLOTS 16        // A power of two, comfortably above the keyword count
+#define KEYWORD_SALT 7
+
+constexpr size_t keyword_slot(const char *name, size_t length)
+{
+    return (length * KEYWORD_SALT + (unsigned char)name[0] * 3 + (unsigned char)name[length - 1]) & (KEYWORD_SLOTS - 1);
+}
+
+// Slot -> index into KEYWORDS plus one, 0 for an empty slot.
+struct KeywordTable
+{
+    unsigned char slots[KEYWORD_SLOTS] = {};
+    bool perfect = true;
+
+    constexpr KeywordTable()
+    {
+        for (size_t i = 0; i < sizeof(KEYWORDS) / sizeof(KEYWORDS[0]); i++)
+        {
+            size_t slot = keyword_slot(KEYWORDS[i].name, KEYWORDS[i].length);
+            if (slots[slot])
+                perfect = false;
+            slots[slot] = i + 1;
+        }
+    }
+};
+
+static constexpr KeywordTable KEYWORD_TABLE;
+static_assert(KEYWORD_TABLE.perfect, "Two keywords share a slot; change KEYWORD_SALT");
+
+/**
+ * @brief The TypeID of the identifier 'name' (not NUL-terminated): its
+ * keyword's, or IDENT if it isn't one.
+ */
+inline char keyword_id(const char *name, size_t length)
+{
+    if (length == 0)
+        return TypeID::IDENT;
+    unsigned char entry = KEYWORD_TABLE.slots[keyword_slot(name, length)];
+    if (entry == 0)
+        return TypeID::IDENT;
+    const Keyword &keyword = KEYWORDS[entry - 1];
+    if (keyword.length != length || memcmp(keyword.name, name, length) != 0)
+        return TypeID::IDENT;
+    return keyword.id;
+}
+
+#endif
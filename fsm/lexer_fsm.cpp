@@ -12,6 +12,11 @@ LexerFSM::~LexerFSM()
 {
 }
 
+LexerState* LexerFSM::getCurrentState() const
+{
+    return current_state;
+}
+
 void LexerFSM::processNextState()
 {
     current_state->process(this);
@@ -88,8 +88,9 @@ public:
 
     // Self explaintory inline functions
     inline LexerReader* getReader() {return reader;}
-    inline std::string getSequence() {return sequence;}
+    inline const std::string& getSequence() {return sequence;}
     inline void appendSequence(const char c) {sequence.push_back(c);}
+    inline void appendSequence(const char* bytes, size_t length) {sequence.append(bytes, length);}
     inline void appendByte(int byte) {sequence += byte;}
     inline void clearSequence() {sequence.clear();}
     inline bool emptySequence() {return sequence.empty();}
@@ -10,6 +10,13 @@
 
 #include "lexer_states.h"
 
+#include <algorithm>
+#include <stdexcept>
+
+#include "keywords.h"
+#include "../decimal.h"
+#include "../utf8.h"
+
 // Shorthand for the parent fsm's file reader
 #define BUFFER parent_state->getReader()
 
@@ -19,13 +26,12 @@
 
 /**
  * @brief Reads in the next 6 characters from the file as
- * a UTF-8 code point and returns a vector containing
- * its encoded bytes.
- * 
- * The bytes need to be read in reverse order to be printed
- * properly!
+ * a code point and appends its UTF-8 encoding to the
+ * sequence.
  */
-std::vector<uint8_t> getEncodedUnicode(LexerFSM* parent_state);
+void appendEncodedUnicode(LexerFSM* parent_state);
+
+void throwError(LexerFSM* parent_state, char bad_char, const char * msg);
 
 /**
  * @brief Tokenizes the current sequence, set the token's
@@ -41,21 +47,43 @@ std::vector<uint8_t> getEncodedUnicode(LexerFSM* parent_state);
  */
 void finishAndClearToken(LexerFSM* parent_state, char id)
 {   
-    std::string value = "";
+    const std::string& sequence = parent_state->getSequence();
+    Token * finished_tok = &parent_state->tokens.back();
+    finished_tok->id = id;
     if (id == TypeID::IDENT || id == TypeID::INTEGER 
         || id == TypeID::STRING || id == TypeID::REAL
     )
     {
-        value = parent_state->getSequence();
+        finished_tok->length = (uint16_t)std::min<size_t>(sequence.size(), UINT16_MAX);
     }
 
-    Token * finished_tok = &parent_state->tokens.back();
-    finished_tok->setContent(value, id);
+    // Only names and strings keep their text: a number's value is in
+    // i_value, and interning every distinct one would grow the pool forever.
+    if (id == TypeID::IDENT || id == TypeID::STRING)
+    {
+        try
+        {
+            finished_tok->setValue(sequence);
+        }
+        catch (const std::length_error& e)
+        {
+            ReaderPosition start = {finished_tok->line, finished_tok->column};
+            parent_state->tokens.pop_back();
+            throw LexicalException(e.what(), start);
+        }
+    }
     
-    if (finished_tok->id == TypeID::INTEGER)
+    if (id == TypeID::INTEGER)
     {
-        finished_tok->i_value = 
-            std::stoi(finished_tok->value, nullptr, 10);
+        // Integers are just digits (IntegerState sees to that), so the only
+        // way this can fail is a literal too big for 64 bits.
+        if (!parse_decimal(sequence.data(), sequence.size(), finished_tok->i_value))
+        {
+            // Report the whole literal, where it starts.
+            ReaderPosition start = {finished_tok->line, finished_tok->column};
+            parent_state->tokens.pop_back();    // Don't leave a bogus value for the parser.
+            throw LexicalException("Integer literal does not fit in 64 bits: " + sequence, start);
+        }
     }
     else
     {
@@ -63,12 +91,9 @@ void finishAndClearToken(LexerFSM* parent_state, char id)
         finished_tok->i_value = INT32_MIN;
     }
 
-    if (finished_tok->id == TypeID::IDENT)
+    if (id == TypeID::IDENT)
     {
-        if (finished_tok->value == "mod")
-        {
-            finished_tok->id = TypeID::MOD;
-        }
+        finished_tok->id = keyword_id(sequence.data(), sequence.size());
     }
 
     parent_state->clearSequence();
@@ -169,7 +194,11 @@ void IntegerState::process(LexerFSM* parent_state)
     char peek = BUFFER->peekNext();
     if (isdigit(peek))  // Neutral ensures first is a digit, Accept digits to continue sequence or a '.' to transition to a real number.
     {
-        parent_state->appendSequence(BUFFER->advance());
+        // Take the whole run of digits at once rather than one per call.
+        char digits[64];
+        size_t count;
+        while ((count = BUFFER->advanceDigits(digits, sizeof(digits))) > 0)
+            parent_state->appendSequence(digits, count);
     }
     else if (WS_PUNCT_EOF(peek))
     {
@@ -296,6 +325,16 @@ void StringState::process(LexerFSM* parent_state)
     }
     else if (peek == '"')
     {
+        // Raw bytes and escapes alike have to add up to valid UTF-8.
+        const std::string& value = parent_state->getSequence();
+        size_t bad = validate_utf8(value.data(), value.size());
+        if (bad != value.size())
+        {
+            Token& string_start = parent_state->tokens.back();
+            std::string msg = "Encountered invalid UTF-8 at byte " + std::to_string(bad) + " of string literal:";
+            throw LexicalException(msg, (uint8_t)value[bad], {string_start.line, string_start.column});
+        }
+
         BUFFER->advance();  // Advance past the " and discard.
         finishAndClearToken(parent_state, TypeID::STRING);
         parent_state->setState(NeutralState::getInstance());
@@ -306,7 +345,10 @@ void StringState::process(LexerFSM* parent_state)
     }
     else
     {
-        parent_state->appendSequence(BUFFER->advance());
+        // Take everything up to the next quote or escape at once.
+        char bytes[256];
+        size_t count = BUFFER->advanceStringBytes(bytes, sizeof(bytes));
+        parent_state->appendSequence(bytes, count);
     }
 }
 
@@ -355,11 +397,7 @@ void EscapedCharacterState::process(LexerFSM* parent_state)
     else if (peek == 'u')
     {
         BUFFER->advance();  // Skip past the 'u'
-        std::vector<uint8_t> encoded_bytes = getEncodedUnicode(parent_state);
-        for (auto it = encoded_bytes.rbegin(); it != encoded_bytes.rend(); it++)
-        {
-            parent_state->appendByte(*it);
-        }
+        appendEncodedUnicode(parent_state);
     }
     else {
         throwError(parent_state, peek, "Encountered illegal escape code!");
@@ -441,9 +479,9 @@ LexerState& MultiLineCommentState::getInstance()
     return singleton;
 }
 
-std::vector<uint8_t> getEncodedUnicode(LexerFSM* parent_state)
+void appendEncodedUnicode(LexerFSM* parent_state)
 {
-    char code_point[6];
+    uint32_t code_point = 0;
     for (int i = 0; i < 6; i++)
     {
         char next = BUFFER->advance();
@@ -453,86 +491,16 @@ std::vector<uint8_t> getEncodedUnicode(LexerFSM* parent_state)
             throwError(parent_state, next, "Encountered illegal character during six-digit unicode sequence.");
         }
 
-        code_point[i] = next;
-    }
-
-    unsigned int unicode_int = 0;   // The value of this unicode character's code point as an integer
-    for (int i = 0; i < 6; i++)
-    {
-        if (isdigit(code_point[i]))
-        {
-            unicode_int = unicode_int * 16 + (code_point[i] - '0');
-            // printf("%c = %d | ", code_point[i], code_point[i] - '0');
-        }
-        else
-        {
-            unicode_int = unicode_int * 16 + (tolower(code_point[i]) - 'a' + 10);
-            // printf("%c = %d | ", code_point[i], code_point[i] - 'a' + 10);
-        }
-
-        //printf("%d ", unicode_int);
+        // Digits are 0x30-0x39, letters 0x41-0x46 or 0x61-0x66, so the low
+        // nibble is the value, plus 9 for a letter.
+        code_point = code_point * 16 + (next & 0xf) + (next >> 6) * 9;
     }
 
-    // printf("\n%s as integer: %d\n", code_point, unicode_int);
-
-    std::queue<uint8_t> bit_masks;
-    std::queue<uint8_t> fix_masks;
-    std::vector<uint8_t> encoded_bytes;
-    int unicode_length = 0;
-
-    if (unicode_int < 0x80)
-    {
-        bit_masks.push(0x7f);      // 0111 1111
-        fix_masks.push(0x80);      // 1000 0000
-        unicode_length = 1;
-    }
-    else if (unicode_int < 0x800)
-    {
-        bit_masks.push(0x3f);      // 0011 1111
-        fix_masks.push(0x80);      // 1000 0000
-
-        bit_masks.push(0x1f);      // 0001 1111
-        fix_masks.push(0xc0);      // 1100 0000
-
-        unicode_length = 2;
-        
-    }
-    else if (unicode_int < 0x10000)
-    {
-        bit_masks.push(0x3f);      // 0011 1111
-        fix_masks.push(0x80);      // 1000 0000
-
-        bit_masks.push(0x3f);      // 0011 1111
-        fix_masks.push(0x80);      // 1000 0000
-
-        bit_masks.push(0x0f);      // 0000 1111
-        fix_masks.push(0xe0);      // 1110 0000
-
-        unicode_length = 3;
-    }
-    else
+    char encoded[UTF8_MAX_LENGTH];
+    size_t length = encode_utf8(code_point, encoded);
+    if (length == 0)
     {
         throwError(parent_state, ' ', "Unicode code point out of range.");
     }
-
-
-    for (int i = 0; i < unicode_length; i++)
-    {
-        uint8_t next_byte = 0;
-        next_byte = (unicode_int & bit_masks.front());      // Mask the first bits of the current byte into the encode
-
-        next_byte = (next_byte | fix_masks.front());        // Set the highest order bits of the current byte
-        
-        encoded_bytes.push_back(next_byte);                      // Add this to the queue of encoded bytes.
-
-        if (bit_masks.size() != 1)                          // Shift out the now irrelevant bits
-        {
-            unicode_int >>= 6;
-        }
-        
-        bit_masks.pop();
-        fix_masks.pop();
-    }
-
-    return encoded_bytes;
+    parent_state->appendSequence(encoded, length);
 }
\ No newline at end of file
@@ -0,0 +1,707 @@
+/**
+ * @file differential.cpp
+ * @author Jake Rogers (z1826513)
+ * @brief Differential fuzzer: every input goes through the lexer, the parser
+ * and every execution engine, and everything they produce is checked against
+ * the reference model in reference.h.
+ *
+ * The first byte of an input picks how the rest is used:
+ *   - Even: the rest is source text as-is. The lexer and parser only have to
+ *     fail cleanly (with their own exceptions) or succeed; whatever parses is
+ *     then executed and compared against the reference evaluator.
+ *   - Odd: the rest drives GrammarGenerator, which produces source text along
+ *     with the exact tokens and trees it must lex and parse to. Token
+ *     streams, tree shapes and results are all compared.
+ *
+ * Each parsed expression is run for several sets of variable values through
+ * the JIT and the interpreter in all four arithmetic modes (each from the
+ * tree as it is, sharing subexpressions, and through the IR passes), through
+ * an ExpressionMemo shared by the input's expressions, rebalanced as with
+ * --reassociate (unchecked modes only), and through BatchProgram at every
+ * SIMD level the CPU has. Grammar-aware inputs sometimes repeat an
+ * expression, so the memo has something to find. Rows the reference
+ * says would divide by zero (or MIN by -1) are run too, and must stop with
+ * the matching ExecutionStatus.
+ *
+ * Any disagreement prints what differed and aborts, after saving the input
+ * as crash-<hash> in the working directory.
+ *
+ * Built normally this has its own driver, with libFuzzer's flags:
+ *
+ *     ./fuzz_diff [-runs=N] [-max_total_time=S] [-max_len=N] [-seed=N] [corpus_dir...]
+ *
+ * which replays every file in the corpus directories, then runs random and
+ * mutated inputs, printing executions per second as it goes. Defining
+ * NCC_LIBFUZZER drops the driver so the harness can be linked with
+ * -fsanitize=fuzzer instead.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include "reference.h"
+#include "../batch_program.h"
+#include "../encoded_program.h"
+#include "../expression_memo.h"
+#include "../fsm/lexer_fsm.h"
+#include "../lexer_error.h"
+#include "../lexer_reader.h"
+#include "../parse_exception.h"
+#include "../reassociate.h"
+#include "../tree_gen.h"
+
+#define MAX_EXPRESSIONS 4   // Per grammar-aware input
+#define MAX_DEPTH 8
+#define MAX_ROWS 11         // Enough to leave a tail after an AVX2 block
+#define MEMO_ENTRIES 2      // Small, so inputs evict from it too
+
+struct FuzzCounters
+{
+    uint64_t executions = 0;
+    uint64_t lex_errors = 0;
+    uint64_t parse_errors = 0;
+    uint64_t expressions = 0;
+    uint64_t comparisons = 0;
+    uint64_t traps = 0;         // Comparisons which expected a division fault
+};
+
+static FuzzCounters counters;
+static const uint8_t *current_input;
+static size_t current_size;
+static int source_fd = -1;
+static char source_path[64];
+
+static uint64_t fnv1a(const uint8_t *data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+// Report a disagreement, keep the input that caused it, and stop.
+static void mismatch(const std::string &what, const std::string &source)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "crash-%016llx", (unsigned long long)fnv1a(current_input, current_size));
+    FILE *file = fopen(name, "wb");
+    if (file != nullptr)
+    {
+        fwrite(current_input, 1, current_size, file);
+        fclose(file);
+    }
+
+    fprintf(stderr, "\n==== MISMATCH ====\n%s\n---- source ----\n%s\n---- input saved as %s ----\n",
+        what.c_str(), source.c_str(), name);
+    abort();
+}
+
+// The lexer only reads files, so every input is written to one in-memory
+// file and read back through /proc.
+static void write_source(const std::string &text)
+{
+    if (source_fd == -1)
+    {
+        source_fd = memfd_create("ncc-fuzz", 0);
+        if (source_fd == -1)
+        {
+            perror("memfd_create");
+            exit(1);
+        }
+        snprintf(source_path, sizeof(source_path), "/proc/self/fd/%d", source_fd);
+    }
+
+    if (ftruncate(source_fd, 0) != 0 || pwrite(source_fd, text.data(), text.size(), 0) != (ssize_t)text.size())
+    {
+        perror("write_source");
+        exit(1);
+    }
+}
+
+static bool lex(std::vector<Token> &tokens)
+{
+    LexerReader reader(source_path);
+    LexerFSM fsm(&reader);
+    try
+    {
+        while (reader)
+            fsm.processNextState();
+        fsm.addEOF();
+    }
+    catch (LexicalException &e)
+    {
+        counters.lex_errors++;
+        return false;
+    }
+    tokens = fsm.tokens;
+    return true;
+}
+
+static bool parse(tree_gen &parse_tree, std::vector<Node *> &heads)
+{
+    try
+    {
+        while (!parse_tree.finished())
+        {
+            Node *head;
+            parse_tree.create_parse_tree(head);
+            heads.push_back(head);
+        }
+    }
+    catch (ParseException &e)
+    {
+        counters.parse_errors++;
+        return false;
+    }
+    return true;
+}
+
+// The status a run must end with for the reference's result.
+static ExecutionStatus expected_status(const RefResult &result)
+{
+    switch (result.outcome)
+    {
+    case REF_OVERFLOW:
+        return STATUS_OVERFLOW;
+    case REF_DIVIDE_BY_ZERO:
+        return STATUS_DIVIDE_BY_ZERO;
+    case REF_DIVISION_OVERFLOW:
+        return STATUS_DIVISION_OVERFLOW;
+    default:
+        return STATUS_OK;
+    }
+}
+
+static std::string describe_result(ExecutionStatus status, int64_t value)
+{
+    switch (status)
+    {
+    case STATUS_OVERFLOW:
+        return "overflow";
+    case STATUS_DIVIDE_BY_ZERO:
+        return "divide by zero";
+    case STATUS_DIVISION_OVERFLOW:
+        return "division overflow";
+    default:
+        return std::to_string(value);
+    }
+}
+
+static std::string describe_row(const std::map<std::string, int64_t> &row)
+{
+    std::string text;
+    for (auto &variable : row)
+        text += variable.first + "=" + std::to_string(variable.second) + " ";
+    return text;
+}
+
+// Assemble 'prog' for 'engine', which must refuse exactly the literals the
+// reference says are too wide. Returns false (with 'prog' released) if it
+// was refused.
+static bool assemble_checked(EncodedProgram &prog, const std::string &engine, const std::vector<RefResult> &expected,
+    const std::string &expression, const std::string &source)
+{
+    try
+    {
+        prog.assemble();
+    }
+    catch (ParseException &e)
+    {
+        if (expected[0].outcome != REF_TOO_WIDE)
+            mismatch(engine + " refused " + expression + ": " + e.message(), source);
+        prog.release();
+        return false;
+    }
+    if (expected[0].outcome == REF_TOO_WIDE)
+        mismatch(engine + " accepted a literal too wide for it in " + expression, source);
+    return true;
+}
+
+// Run 'prog' on every row and compare with the reference. With 'memo', the
+// program is the memo's, and is run the way ncc runs one: a program without
+// variables is run once, its result is kept and its code released.
+static void compare_rows(EncodedProgram &prog, const std::string &engine, const std::vector<RefResult> &expected,
+    const std::vector<std::map<std::string, int64_t>> &rows, const std::string &expression, const std::string &source,
+    ExpressionMemo *memo = nullptr, ExpressionMemo::Entry *entry = nullptr)
+{
+    for (size_t r = 0; r < rows.size(); r++)
+    {
+        std::vector<int64_t> values;
+        for (const std::string &name : prog.variables())
+            values.push_back(rows[r].at(name));
+
+        ExecutionStatus status = STATUS_OK;
+        int64_t actual = 0;
+        try
+        {
+            if (entry && entry->known)
+            {
+                actual = entry->value;
+            }
+            else
+            {
+                actual = prog.run(values.data());
+                if (entry && values.empty())
+                {
+                    entry->known = true;
+                    entry->value = actual;
+                    memo->forget_code(entry);
+                }
+            }
+        }
+        catch (ExecutionException &e)
+        {
+            status = e.get_status();
+        }
+
+        counters.comparisons++;
+        ExecutionStatus expect = expected_status(expected[r]);
+        if (expect == STATUS_DIVIDE_BY_ZERO || expect == STATUS_DIVISION_OVERFLOW)
+            counters.traps++;
+        if (status != expect || (status == STATUS_OK && actual != expected[r].value))
+        {
+            mismatch(engine + " on " + expression + " with " + describe_row(rows[r]) + "\n  expected "
+                + describe_result(expect, expected[r].value) + ", got " + describe_result(status, actual),
+                source);
+        }
+    }
+}
+
+// Run one parsed expression through every engine and compare each result
+// with the reference. 'memos' holds one memo per arithmetic mode, shared by
+// every expression of the input as ncc shares one between a file's.
+static void check_engines(Node *head, const std::vector<std::map<std::string, int64_t>> &rows, const std::string &source,
+    std::vector<std::unique_ptr<ExpressionMemo>> &memos)
+{
+    RefTree tree;
+    tree.root = from_parse_tree(head, tree);
+    std::string expression = shape(tree, tree.root);
+
+    ExecutionTier tiers[2] = {ExecutionTier::JIT, ExecutionTier::INTERPRETER};
+    const char *tier_names[2] = {"jit", "interp"};
+    int first_tier = EncodedProgram::jit_available() ? 0 : 1;
+
+    std::vector<RefResult> expected[4];
+    for (int m = 0; m < 4; m++)
+    {
+        ArithmeticMode mode;
+        mode.wide = m & 1;
+        mode.check_overflow = m & 2;
+        std::string mode_name = std::string(mode.wide ? "int64" : "int32") + (mode.check_overflow ? "/checked" : "");
+
+        ReferenceEvaluator reference(tree, mode);
+        for (auto &row : rows)
+            expected[m].push_back(reference.evaluate(row));
+
+        // Each tier, as the tree is, with shared subexpressions, and optimised.
+        for (int e = 0; e < 6; e++)
+        {
+            int t = e & 1;
+            bool share = (e >> 1) == 1;
+            bool optimize = (e >> 1) == 2;
+            if (t < first_tier)
+                continue;
+
+            std::string engine = std::string(tier_names[t]) + (share ? "/cse " : optimize ? "/opt " : " ") + mode_name;
+            EncodedProgram prog(head, tiers[t], mode, share);
+            if (optimize)
+                prog.optimize_with(&PassManager::standard());
+            if (!assemble_checked(prog, engine, expected[m], expression, source))
+                continue;
+            compare_rows(prog, engine, expected[m], rows, expression, source);
+            prog.release();
+        }
+
+        // Through the memo: assembled the first time the input has this
+        // expression, and reused from then on (here, straight away too).
+        ExpressionMemo &memo = *memos[m];
+        std::string engine = std::string(tier_names[first_tier]) + "/memo " + mode_name;
+        for (int pass = 0; pass < 2; pass++)
+        {
+            ExpressionMemo::Entry *entry = memo.find(head);
+            if (entry == nullptr)
+            {
+                EncodedProgram prog(head, tiers[first_tier], mode);
+                if (!assemble_checked(prog, engine, expected[m], expression, source))
+                    break;
+                entry = memo.insert(prog);
+            }
+            else if (expected[m][0].outcome == REF_TOO_WIDE)
+            {
+                mismatch(engine + " found a literal too wide for it in " + expression, source);
+            }
+            compare_rows(entry->program, engine, expected[m], rows, expression, source, &memo, entry);
+        }
+
+        // Batch programs are 32-bit wrap-around only.
+        if (m != 0 || !EncodedProgram::jit_available())
+            continue;
+
+        for (int level = (int)SimdLevel::SCALAR; level <= (int)BatchProgram::best_simd_level(); level++)
+        {
+            BatchProgram batch(head, (SimdLevel)level);
+            try
+            {
+                batch.assemble();
+            }
+            catch (ParseException &e)
+            {
+                if (expected[m][0].outcome != REF_TOO_WIDE)
+                    mismatch("batch refused " + expression + ": " + e.message(), source);
+                continue;
+            }
+            if (expected[m][0].outcome == REF_TOO_WIDE)
+                mismatch("batch accepted a literal too wide for it in " + expression, source);
+
+            std::vector<std::vector<int>> columns(batch.variables().size());
+            std::vector<const int *> column_ptrs;
+            for (size_t slot = 0; slot < columns.size(); slot++)
+            {
+                for (auto &row : rows)
+                    columns[slot].push_back(row.at(batch.variables()[slot]));
+                column_ptrs.push_back(columns[slot].data());
+            }
+
+            std::vector<int> out(rows.size());
+            std::vector<std::pair<size_t, ExecutionException>> failures;
+            batch.evaluate(column_ptrs.data(), out.data(), rows.size(), &failures);
+            size_t next_failure = 0;
+            for (size_t r = 0; r < rows.size(); r++)
+            {
+                ExecutionStatus status = STATUS_OK;
+                if (next_failure < failures.size() && failures[next_failure].first == r)
+                    status = failures[next_failure++].second.get_status();
+
+                counters.comparisons++;
+                ExecutionStatus expect = expected_status(expected[m][r]);
+                if (status != expect || (status == STATUS_OK && out[r] != expected[m][r].value))
+                {
+                    mismatch("batch level " + std::to_string(level) + " on " + expression + " with "
+                        + describe_row(rows[r]) + "\n  expected " + describe_result(expect, expected[m][r].value)
+                        + ", got " + describe_result(status, out[r]), source);
+                }
+            }
+        }
+    }
+
+    // Rebalanced, as --reassociate does (for unchecked arithmetic only). The
+    // tree is rebalanced in place, so this comes last.
+    if (reassociate(head) == 0)
+        return;
+    for (int m = 0; m < 2; m++)
+    {
+        ArithmeticMode mode;
+        mode.wide = m & 1;
+        for (int t = first_tier; t < 2; t++)
+        {
+            std::string engine = std::string(tier_names[t]) + "/reassoc " + (mode.wide ? "int64" : "int32");
+            EncodedProgram prog(head, tiers[t], mode);
+            if (!assemble_checked(prog, engine, expected[m], expression, source))
+                continue;
+            compare_rows(prog, engine, expected[m], rows, expression, source);
+            prog.release();
+        }
+    }
+}
+
+// One empty memo per arithmetic mode, for the expressions of one input.
+static std::vector<std::unique_ptr<ExpressionMemo>> make_memos()
+{
+    std::vector<std::unique_ptr<ExpressionMemo>> memos;
+    for (int m = 0; m < 4; m++)
+        memos.emplace_back(new ExpressionMemo(MEMO_ENTRIES));
+    return memos;
+}
+
+// Pick values for every variable the generator can name, from 'source'.
+static std::vector<std::map<std::string, int64_t>> make_rows(ByteSource &source)
+{
+    std::vector<std::map<std::string, int64_t>> rows(1 + source.byte() % MAX_ROWS);
+    for (auto &row : rows)
+    {
+        for (int v = 0; v < 5; v++)
+            row["v" + std::to_string(v)] = interesting_values[source.byte() % INTERESTING_COUNT];
+    }
+    return rows;
+}
+
+// Raw source text: anything goes, as long as failures are clean ones.
+static void fuzz_raw(const uint8_t *data, size_t size)
+{
+    std::string source((const char *)data, size);
+    write_source(source);
+
+    std::vector<Token> tokens;
+    if (!lex(tokens))
+        return;
+
+    tree_gen parse_tree(tokens);
+    std::vector<Node *> heads;
+    parse(parse_tree, heads);
+
+    // Variables can be named anything here, so give every name in the
+    // program a value derived from the input.
+    uint64_t seed = fnv1a(data, size);
+    std::vector<std::map<std::string, int64_t>> rows(1 + seed % MAX_ROWS);
+    for (const Token &token : tokens)
+    {
+        if (token.id != TypeID::IDENT)
+            continue;
+        for (auto &row : rows)
+        {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            row[std::string(token.value())] = interesting_values[(seed >> 33) % INTERESTING_COUNT];
+        }
+    }
+
+    std::vector<std::unique_ptr<ExpressionMemo>> memos = make_memos();
+    for (Node *head : heads)
+    {
+        counters.expressions++;
+        check_engines(head, rows, source, memos);
+        parse_tree.delete_tree(head);
+    }
+}
+
+// Grammar-aware: we know exactly what every stage must produce.
+static void fuzz_grammar(const uint8_t *data, size_t size)
+{
+    ByteSource bytes(data, size);
+    GrammarGenerator generator(bytes);
+
+    int count = 1 + bytes.byte() % MAX_EXPRESSIONS;
+    std::vector<RefTree> trees(count);
+    std::string source;
+    std::vector<ExpectedToken> expected_tokens;
+    for (size_t i = 0; i < trees.size(); i++)
+    {
+        // Now and then repeat an earlier expression, for the memo to find.
+        if (i > 0 && bytes.byte() % 4 == 3)
+            trees[i] = trees[bytes.byte() % i];
+        else
+            trees[i].root = generator.expression(trees[i], MAX_DEPTH);
+        generator.print(trees[i], source, expected_tokens);
+        source += '\n';
+    }
+    std::vector<std::map<std::string, int64_t>> rows = make_rows(bytes);
+    write_source(source);
+
+    std::vector<Token> tokens;
+    if (!lex(tokens))
+        mismatch("lexer rejected a valid program", source);
+
+    // The lexer ends the stream with an EOF token of its own.
+    if (tokens.size() != expected_tokens.size() + 1)
+    {
+        mismatch("lexer found " + std::to_string(tokens.size() - 1) + " tokens, expected "
+            + std::to_string(expected_tokens.size()), source);
+    }
+    for (size_t i = 0; i < expected_tokens.size(); i++)
+    {
+        const Token &actual = tokens[i];
+        const ExpectedToken &expected = expected_tokens[i];
+        bool same = (actual.id == expected.id);
+        if (same && expected.id == TypeID::INTEGER)
+            same = (actual.i_value == expected.i_value);
+        if (same && (expected.id == TypeID::IDENT || expected.id == TypeID::MOD))
+            same = (actual.value() == expected.value);
+        if (!same)
+        {
+            mismatch("token " + std::to_string(i) + " is id " + std::to_string(actual.id) + " '" + std::string(actual.value())
+                + "', expected id " + std::to_string(expected.id) + " '" + expected.value + "'", source);
+        }
+    }
+
+    tree_gen parse_tree(tokens);
+    std::vector<Node *> heads;
+    if (!parse(parse_tree, heads))
+        mismatch("parser rejected a valid program", source);
+    if (heads.size() != trees.size())
+    {
+        mismatch("parser found " + std::to_string(heads.size()) + " expressions, expected "
+            + std::to_string(trees.size()), source);
+    }
+
+    std::vector<std::unique_ptr<ExpressionMemo>> memos = make_memos();
+    for (size_t i = 0; i < heads.size(); i++)
+    {
+        RefTree parsed;
+        parsed.root = from_parse_tree(heads[i], parsed);
+        std::string expected = shape(trees[i], trees[i].root);
+        std::string actual = shape(parsed, parsed.root);
+        if (expected != actual)
+            mismatch("expression " + std::to_string(i) + " parsed as " + actual + "\n  expected " + expected, source);
+
+        counters.expressions++;
+        check_engines(heads[i], rows, source, memos);
+        parse_tree.delete_tree(heads[i]);
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    current_input = data;
+    current_size = size;
+    counters.executions++;
+
+    if (size == 0)
+        return 0;
+    if (data[0] & 1)
+        fuzz_grammar(data + 1, size - 1);
+    else
+        fuzz_raw(data + 1, size - 1);
+    return 0;
+}
+
+#ifndef NCC_LIBFUZZER
+
+typedef std::chrono::steady_clock Clock;
+
+static uint64_t rng_state;
+static uint64_t rng()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void load_corpus(const char *dir_path, std::vector<std::vector<uint8_t>> &corpus)
+{
+    DIR *dir = opendir(dir_path);
+    if (dir == nullptr)
+    {
+        perror(dir_path);
+        return;
+    }
+
+    while (dirent *entry = readdir(dir))
+    {
+        std::string path = std::string(dir_path) + "/" + entry->d_name;
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == nullptr || entry->d_name[0] == '.')
+        {
+            if (file != nullptr)
+                fclose(file);
+            continue;
+        }
+
+        std::vector<uint8_t> input;
+        int c;
+        while ((c = fgetc(file)) != EOF)
+            input.push_back(c);
+        fclose(file);
+        corpus.push_back(input);
+    }
+    closedir(dir);
+}
+
+// A few of libFuzzer's cheaper mutations.
+static void mutate(std::vector<uint8_t> &input, size_t max_len)
+{
+    int mutations = 1 + rng() % 4;
+    for (int i = 0; i < mutations; i++)
+    {
+        switch (rng() % 4)
+        {
+        case 0:     // Flip a bit
+            if (!input.empty())
+                input[rng() % input.size()] ^= 1 << (rng() % 8);
+            break;
+        case 1:     // Replace a byte
+            if (!input.empty())
+                input[rng() % input.size()] = rng();
+            break;
+        case 2:     // Insert a byte
+            if (input.size() < max_len)
+                input.insert(input.begin() + rng() % (input.size() + 1), (uint8_t)rng());
+            break;
+        default:    // Erase a byte
+            if (input.size() > 1)
+                input.erase(input.begin() + rng() % input.size());
+            break;
+        }
+    }
+}
+
+static void print_status(const char *what, Clock::time_point start)
+{
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    fprintf(stderr, "#%llu\t%s exec/s: %.0f expressions: %llu comparisons: %llu lex-errors: %llu parse-errors: %llu traps: %llu\n",
+        (unsigned long long)counters.executions, what, counters.executions / (seconds > 0 ? seconds : 1),
+        (unsigned long long)counters.expressions, (unsigned long long)counters.comparisons,
+        (unsigned long long)counters.lex_errors, (unsigned long long)counters.parse_errors,
+        (unsigned long long)counters.traps);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t runs = 100000;
+    double max_time = 0;
+    size_t max_len = 512;
+    rng_state = 0x9e3779b97f4a7c15ULL;
+    std::vector<std::vector<uint8_t>> corpus;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "-runs=", 6) == 0)
+            runs = strtoull(argv[i] + 6, nullptr, 10);
+        else if (strncmp(argv[i], "-max_total_time=", 16) == 0)
+            max_time = atof(argv[i] + 16);
+        else if (strncmp(argv[i], "-max_len=", 9) == 0)
+            max_len = strtoull(argv[i] + 9, nullptr, 10);
+        else if (strncmp(argv[i], "-seed=", 6) == 0)
+            rng_state = strtoull(argv[i] + 6, nullptr, 10) | 1;
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "Usage: %s [-runs=N] [-max_total_time=S] [-max_len=N] [-seed=N] [corpus_dir...]\n", argv[0]);
+            return 1;
+        }
+        else
+            load_corpus(argv[i], corpus);
+    }
+
+    Clock::time_point start = Clock::now();
+    for (const std::vector<uint8_t> &input : corpus)
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    if (!corpus.empty())
+        print_status("INITED", start);
+
+    Clock::time_point last_status = Clock::now();
+    std::vector<uint8_t> input;
+    for (uint64_t run = 0; run < runs; run++)
+    {
+        if (!corpus.empty() && rng() % 2)
+        {
+            input = corpus[rng() % corpus.size()];
+            mutate(input, max_len);
+        }
+        else
+        {
+            input.resize(1 + rng() % max_len);
+            for (uint8_t &byte : input)
+                byte = rng();
+        }
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+
+        if (Clock::now() - last_status > std::chrono::seconds(1))
+        {
+            print_status("pulse ", start);
+            last_status = Clock::now();
+        }
+        if (max_time > 0 && std::chrono::duration<double>(Clock::now() - start).count() > max_time)
+            break;
+    }
+
+    print_status("DONE  ", start);
+    return 0;
+}
+
+#endif
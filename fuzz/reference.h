@@ -0,0 +1,446 @@
+/**
+ * @file reference.h
+ * @author Jake Rogers (z1826513)
+ * @brief The slow, obviously correct side of the differential fuzzer: an
+ * expression tree of its own, a generator which turns fuzzer bytes into
+ * source text (along with the tokens and trees it must produce), and an
+ * evaluator for the language's arithmetic.
+ *
+ * Nothing here shares code with the lexer, parser or either execution tier.
+ * The evaluator does every operation exactly in 128 bits and then wraps or
+ * range checks the result, rather than relying on the overflow builtins the
+ * interpreter uses, so a bug in one can't hide behind the same bug in the
+ * other.
+ */
+#ifndef REFERENCE_H
+#define REFERENCE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../encoded_program.h"
+#include "../node.h"
+#include "../token.h"
+
+struct RefNode
+{
+    int op;                 // A TypeID for leaves and unary operators, else the operator's character
+    int64_t value = 0;      // INTEGER
+    std::string name;       // IDENT
+    int left = -1;          // Operand of unary operators
+    int right = -1;
+};
+
+struct RefTree
+{
+    std::vector<RefNode> nodes;
+    int root = -1;
+
+    int add(const RefNode &node)
+    {
+        nodes.push_back(node);
+        return nodes.size() - 1;
+    }
+};
+
+// A fully parenthesized rendering of a tree, e.g. "(+ 1 (u- v0))", so the
+// parser's trees can be compared to the generator's by string.
+inline std::string shape(const RefTree &tree, int n)
+{
+    const RefNode &node = tree.nodes[n];
+    switch (node.op)
+    {
+    case TypeID::INTEGER:
+        return std::to_string(node.value);
+    case TypeID::IDENT:
+        return node.name;
+    case TypeID::NEGATE:
+        return "(u- " + shape(tree, node.left) + ")";
+    case TypeID::UPLUS:
+        return "(u+ " + shape(tree, node.left) + ")";
+    case TypeID::MOD:
+        return "(mod " + shape(tree, node.left) + " " + shape(tree, node.right) + ")";
+    default:
+        return std::string("(") + (char)node.op + " " + shape(tree, node.left) + " " + shape(tree, node.right) + ")";
+    }
+}
+
+// Convert one of tree_gen's child/sibling trees: an operator's child is its
+// left operand, and that operand's sibling is the right one.
+inline int from_parse_tree(Node *n, RefTree &tree)
+{
+    RefNode node;
+    node.op = n->token.id;
+    if (node.op == TypeID::INTEGER)
+        node.value = n->token.i_value;
+    else if (node.op == TypeID::IDENT)
+        node.name = std::string(n->token.value());
+
+    if (n->child != nullptr)
+    {
+        node.left = from_parse_tree(n->child, tree);
+        if (n->child->sibling != nullptr)
+            node.right = from_parse_tree(n->child->sibling, tree);
+    }
+    return tree.add(node);
+}
+
+/**
+ * Hands out fuzzer bytes as decisions. Once the input runs out every
+ * decision is 0, which always steers the generator towards a leaf, so any
+ * input (even an empty one) generates a finite program.
+ */
+class ByteSource
+{
+public:
+    ByteSource(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+    uint8_t byte() {return (position < size) ? data[position++] : 0;}
+    uint64_t below(uint64_t n)
+    {
+        uint64_t value = byte();
+        value = (value << 8) | byte();
+        return value % n;
+    }
+    bool exhausted() const {return position >= size;}
+
+private:
+    const uint8_t *data;
+    size_t size;
+    size_t position = 0;
+};
+
+struct ExpectedToken
+{
+    char id;
+    int64_t i_value;
+    std::string value;
+};
+
+// Values where arithmetic gets interesting: zero, signs, and the edges of
+// both widths.
+static const int64_t interesting_values[] = {
+    0, 1, -1, 2, -2, 3, 7, 10, 100, -100, 65535, 65536,
+    INT32_MAX, INT32_MIN, (int64_t)INT32_MAX + 1, (int64_t)INT32_MIN - 1,
+    INT64_MAX, INT64_MIN, 0x100000000LL, 46341, -46341
+};
+#define INTERESTING_COUNT (sizeof(interesting_values) / sizeof(interesting_values[0]))
+
+/**
+ * Builds random expression trees from a ByteSource and prints them as
+ * source text, recording the tokens the lexer has to find in it. Printing
+ * uses as few parentheses as the grammar allows (plus some redundant ones),
+ * so the parser's precedence and associativity get tested rather than
+ * bypassed, and puts random whitespace and comments between tokens.
+ */
+class GrammarGenerator
+{
+public:
+    GrammarGenerator(ByteSource &source) : source(source) {}
+
+    int expression(RefTree &tree, int depth)
+    {
+        uint8_t choice = source.byte();
+        if (depth == 0 || choice < 64)
+            return leaf(tree);
+
+        RefNode node;
+        if (choice < 88)
+        {
+            node.op = (choice & 1) ? TypeID::NEGATE : TypeID::UPLUS;
+            node.left = expression(tree, depth - 1);
+            return tree.add(node);
+        }
+
+        static const int operators[] = {'+', '-', '*', '/', TypeID::MOD, '^'};
+        node.op = operators[choice % 6];
+        node.left = expression(tree, depth - 1);
+        node.right = expression(tree, depth - 1);
+        return tree.add(node);
+    }
+
+    // Print a whole top-level expression.
+    void print(const RefTree &tree, std::string &text, std::vector<ExpectedToken> &tokens)
+    {
+        // A leading sign would carry on the previous expression, so an
+        // expression that would start with one is parenthesized.
+        print_node(tree, tree.root, starts_with_sign(tree, tree.root), text, tokens);
+    }
+
+private:
+    int leaf(RefTree &tree)
+    {
+        RefNode node;
+        uint8_t choice = source.byte();
+        if (choice & 1)
+        {
+            node.op = TypeID::IDENT;
+            node.name = "v" + std::to_string(choice % 5);
+        }
+        else
+        {
+            node.op = TypeID::INTEGER;
+            int64_t value = interesting_values[(choice >> 1) % INTERESTING_COUNT];
+            node.value = (value < 0) ? -(value + 1) : value;    // Literals are never negative
+        }
+        return tree.add(node);
+    }
+
+    // Does the unparenthesized text of node 'n' start with a unary sign?
+    static bool starts_with_sign(const RefTree &tree, int n)
+    {
+        const RefNode &node = tree.nodes[n];
+        if (node.op == TypeID::NEGATE || node.op == TypeID::UPLUS)
+            return true;
+        if (node.right == -1)
+            return false;
+        return starts_with_sign(tree, node.left);
+    }
+
+    // Binding strength: higher binds tighter.
+    static int precedence(int op)
+    {
+        switch (op)
+        {
+        case '+':
+        case '-':
+            return 1;
+        case '*':
+        case '/':
+        case TypeID::MOD:
+            return 2;
+        case '^':
+            return 3;
+        case TypeID::NEGATE:
+        case TypeID::UPLUS:
+            return 4;
+        default:
+            return 5;   // Leaves
+        }
+    }
+
+    void print_node(const RefTree &tree, int n, bool parenthesize, std::string &text, std::vector<ExpectedToken> &tokens)
+    {
+        const RefNode &node = tree.nodes[n];
+
+        // Throw in redundant parentheses now and then.
+        if (!parenthesize && (source.byte() & 0x7) == 0)
+            parenthesize = true;
+
+        if (parenthesize)
+            emit(text, tokens, {'(', INT32_MIN, ""}, "(");
+
+        switch (node.op)
+        {
+        case TypeID::INTEGER:
+            emit(text, tokens, {TypeID::INTEGER, node.value, std::to_string(node.value)}, std::to_string(node.value));
+            break;
+
+        case TypeID::IDENT:
+            emit(text, tokens, {TypeID::IDENT, INT32_MIN, node.name}, node.name);
+            break;
+
+        case TypeID::NEGATE:
+        case TypeID::UPLUS:
+        {
+            // A sign only applies to a unit: a literal, variable or
+            // parenthesized expression.
+            emit(text, tokens, {node.op == TypeID::NEGATE ? '-' : '+', INT32_MIN, ""}, node.op == TypeID::NEGATE ? "-" : "+");
+            print_node(tree, node.left, precedence(tree.nodes[node.left].op) < 5, text, tokens);
+            break;
+        }
+
+        default:
+        {
+            int mine = precedence(node.op);
+            int left = precedence(tree.nodes[node.left].op);
+            int right = precedence(tree.nodes[node.right].op);
+
+            // '^' is right-associative, everything else is left-associative.
+            bool right_assoc = (node.op == '^');
+            print_node(tree, node.left, right_assoc ? left <= mine : left < mine, text, tokens);
+
+            if (node.op == TypeID::MOD)
+                emit(text, tokens, {TypeID::MOD, INT32_MIN, "mod"}, "mod");
+            else
+                emit(text, tokens, {(char)node.op, INT32_MIN, ""}, std::string(1, (char)node.op));
+
+            print_node(tree, node.right, right_assoc ? right < mine : right <= mine, text, tokens);
+            break;
+        }
+        }
+
+        if (parenthesize)
+            emit(text, tokens, {')', INT32_MIN, ""}, ")");
+    }
+
+    static bool is_word(char id)
+    {
+        return id == TypeID::INTEGER || id == TypeID::IDENT || id == TypeID::MOD;
+    }
+
+    void emit(std::string &text, std::vector<ExpectedToken> &tokens, const ExpectedToken &token, const std::string &spelling)
+    {
+        // Two words in a row need something between them.
+        bool needs_space = !tokens.empty() && is_word(tokens.back().id) && is_word(token.id);
+
+        switch (source.byte() & 0xf)
+        {
+        case 0:
+            text += " # a comment\n";
+            break;
+        case 1:
+            text += " <<- a block\ncomment ->> ";
+            break;
+        case 2:
+            text += "\n";
+            break;
+        case 3:
+            text += "\t";
+            break;
+        case 4:
+        case 5:
+            if (needs_space)
+                text += " ";
+            break;
+        default:
+            text += " ";
+            break;
+        }
+
+        text += spelling;
+        tokens.push_back(token);
+    }
+
+    ByteSource &source;
+};
+
+// Exact intermediate results: any product of two 64-bit values fits.
+__extension__ typedef __int128 wide_int;
+__extension__ typedef unsigned __int128 wide_uint;
+
+enum RefOutcome
+{
+    REF_VALUE,      // Ran to completion, 'value' is the result
+    REF_OVERFLOW,   // Checked mode: some operation overflowed
+    REF_DIVIDE_BY_ZERO,         // IDIV would fault, ncc reports it instead
+    REF_DIVISION_OVERFLOW,      // The same for MIN / -1
+    REF_TOO_WIDE    // A literal doesn't fit the mode, assembly must refuse it
+};
+
+struct RefResult
+{
+    RefOutcome outcome;
+    int64_t value;
+};
+
+/**
+ * Evaluates expressions exactly like ncc promises to: in 32 or 64 bits,
+ * wrapping around or reporting overflow, operands left to right. '^' isn't
+ * implemented by the compiler yet and keeps its left operand, but its right
+ * operand is still evaluated (and can still overflow or trap).
+ */
+class ReferenceEvaluator
+{
+public:
+    ReferenceEvaluator(const RefTree &tree, ArithmeticMode mode) : tree(tree), mode(mode)
+    {
+        bits = mode.wide ? 64 : 32;
+        min = mode.wide ? (wide_int)INT64_MIN : (wide_int)INT32_MIN;
+        max = mode.wide ? (wide_int)INT64_MAX : (wide_int)INT32_MAX;
+    }
+
+    RefResult evaluate(const std::map<std::string, int64_t> &variables)
+    {
+        this->variables = &variables;
+        if (too_wide(tree.root))
+            return {REF_TOO_WIDE, 0};
+
+        outcome = REF_VALUE;
+        wide_int value = eval(tree.root);
+        return {outcome, (outcome == REF_VALUE) ? (int64_t)value : 0};
+    }
+
+private:
+    bool too_wide(int n)
+    {
+        const RefNode &node = tree.nodes[n];
+        if (node.op == TypeID::INTEGER && node.value > max)
+            return true;
+        return (node.left != -1 && too_wide(node.left)) || (node.right != -1 && too_wide(node.right));
+    }
+
+    // Wrap an exact result to the mode's width, or flag it in checked mode.
+    wide_int wrap(wide_int exact)
+    {
+        if (exact >= min && exact <= max)
+            return exact;
+        if (mode.check_overflow && outcome == REF_VALUE)
+            outcome = REF_OVERFLOW;
+
+        wide_uint mask = ((wide_uint)1 << bits) - 1;
+        wide_uint low = (wide_uint)exact & mask;
+        if (low >> (bits - 1))
+            return (wide_int)low - ((wide_int)1 << bits);
+        return (wide_int)low;
+    }
+
+    wide_int eval(int n)
+    {
+        const RefNode &node = tree.nodes[n];
+        if (node.op == TypeID::INTEGER)
+            return node.value;
+        if (node.op == TypeID::IDENT)
+        {
+            // Narrow programs only ever look at the low 32 bits of a variable.
+            int64_t value = variables->at(node.name);
+            return mode.wide ? (wide_int)value : (wide_int)(int32_t)value;
+        }
+
+        wide_int a = eval(node.left);
+        if (outcome != REF_VALUE)
+            return 0;
+
+        if (node.op == TypeID::NEGATE)
+            return wrap(-a);
+        if (node.op == TypeID::UPLUS)
+            return a;
+
+        wide_int b = eval(node.right);
+        if (outcome != REF_VALUE)
+            return 0;
+
+        switch (node.op)
+        {
+        case '+':
+            return wrap(a + b);
+        case '-':
+            return wrap(a - b);
+        case '*':
+            return wrap(a * b);
+        case '/':
+        case TypeID::MOD:
+            // IDIV faults on both of these, checked or not.
+            if (b == 0 || (a == min && b == -1))
+            {
+                outcome = (b == 0) ? REF_DIVIDE_BY_ZERO : REF_DIVISION_OVERFLOW;
+                return 0;
+            }
+            return (node.op == '/') ? a / b : a % b;
+        default:    // '^'
+            return a;
+        }
+    }
+
+    const RefTree &tree;
+    ArithmeticMode mode;
+    const std::map<std::string, int64_t> *variables = nullptr;
+    RefOutcome outcome = REF_VALUE;
+    int bits;
+    wide_int min;
+    wide_int max;
+};
+
+#endif
@@ -0,0 +1,363 @@
+#include "incremental.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+#include <streambuf>
+
+#include "fsm/lexer_fsm.h"
+#include "fsm/lexer_states.h"
+#include "lexer_error.h"
+#include "parse_exception.h"
+#include "stats.h"
+
+// Reads straight out of the document's text, so re-lexing near the end of a
+// large file doesn't copy the rest of it first.
+class TextBuffer : public std::streambuf
+{
+public:
+    TextBuffer(const char* begin, const char* end)
+    {
+        setg(const_cast<char*>(begin), const_cast<char*>(begin), const_cast<char*>(end));
+    }
+};
+
+// Replace the elements [first, last) of 'v' with those of 'replacement',
+// moving the ones after them along once (not at all if the counts match).
+template <typename T>
+static void splice(std::vector<T>& v, size_t first, size_t last, std::vector<T>& replacement)
+{
+    size_t count = replacement.size();
+    if (count < last - first)
+        v.erase(v.begin() + first + count, v.begin() + last);
+    else if (count > last - first)
+        v.insert(v.begin() + last, count - (last - first), T());
+    std::move(replacement.begin(), replacement.end(), v.begin() + first);
+}
+
+IncrementalDocument::IncrementalDocument(Compiler compiler, bool headers)
+    : compiler(compiler), headers(headers)
+{
+    memset(&work, 0, sizeof(work));
+}
+
+void IncrementalDocument::load(const std::string& text)
+{
+    source = text;
+    line_starts.assign(1, 0);
+    for (const char* at = source.data(); (at = (const char*)memchr(at, '\n', source.data() + source.size() - at)); at++)
+        line_starts.push_back(at - source.data() + 1);
+
+    tokens.clear();
+    token_offsets.clear();
+    token_neutral.clear();
+    active_tokens = 0;
+    lex_error.clear();
+    expressions.clear();
+    parse_error.clear();
+    dormant.clear();
+    memset(&work, 0, sizeof(work));
+
+    Shift nothing = {0, 0, SIZE_MAX, 0, 0};
+    int changed_end, token_delta;
+    relex(0, 0, 0, nothing, changed_end, token_delta);
+    reparse(0, changed_end, token_delta);
+}
+
+bool IncrementalDocument::edit(size_t offset, size_t removed, const std::string& inserted)
+{
+    if (offset > source.size() || removed > source.size() - offset)
+        return false;
+    memset(&work, 0, sizeof(work));
+
+    // Restart at the last token the lexer started, from the neutral state,
+    // strictly before the edit: the token before it was finished by looking
+    // at most at the byte the restart token starts on, so it can't change.
+    int first = std::lower_bound(token_offsets.begin(), token_offsets.begin() + active_tokens, (uint32_t)offset)
+        - token_offsets.begin() - 1;
+    while (first >= 0 && !token_neutral[first])
+        first--;
+    size_t restart = 0;
+    if (first >= 0)
+        restart = token_offsets[first];
+    else
+        first = 0;
+
+    // After a lexical error, the file's tokens from the restart on are
+    // about to be replaced anyway, and the old tokens to agree with past
+    // the edit are the dormant ones. Expressions parsed from the replaced
+    // tokens can't be reused (-1 never matches).
+    if (!lex_error.empty())
+    {
+        int dropped = active_tokens - first;
+        tokens.erase(tokens.begin() + first, tokens.begin() + active_tokens);
+        token_offsets.erase(token_offsets.begin() + first, token_offsets.begin() + active_tokens);
+        token_neutral.erase(token_neutral.begin() + first, token_neutral.begin() + active_tokens);
+        active_tokens = first;
+        for (Expression& e : expressions)
+            if (e.first_token >= first)
+                e.first_token = -1;
+        for (Expression& e : dormant)
+        {
+            e.first_token -= dropped;
+            e.end_token -= dropped;
+        }
+    }
+
+    // Work out how the edit moves everything after it, on both sides of
+    // bringing the line table up to date: drop the lines the edit removed,
+    // move the rest along and add the ones it inserted.
+    Shift shift;
+    shift.old_end = offset + removed;
+    shift.bytes = (long)inserted.size() - (long)removed;
+    ReaderPosition old_end = position_of(shift.old_end);
+    auto next_line = std::upper_bound(line_starts.begin(), line_starts.end(), shift.old_end);
+    shift.line_end = (next_line == line_starts.end()) ? SIZE_MAX : *next_line;
+
+    source.replace(offset, removed, inserted);
+    auto removed_lines = std::upper_bound(line_starts.begin(), line_starts.end(), offset);
+    size_t insert_at = line_starts.erase(removed_lines, next_line) - line_starts.begin();
+    for (size_t i = insert_at; i < line_starts.size(); i++)
+        line_starts[i] += shift.bytes;
+    std::vector<size_t> added;
+    for (size_t i = 0; i < inserted.size(); i++)
+        if (inserted[i] == '\n')
+            added.push_back(offset + i + 1);
+    line_starts.insert(line_starts.begin() + insert_at, added.begin(), added.end());
+
+    ReaderPosition new_end = position_of(offset + inserted.size());
+    shift.lines = new_end.line - old_end.line;
+    shift.columns = new_end.column - old_end.column;
+
+    int changed_end, token_delta;
+    relex(restart, first, offset + inserted.size(), shift, changed_end, token_delta);
+
+    // Every expression up to the one holding the token before the first
+    // changed one is untouched: the parser only ever looks one token past
+    // an expression, and for those that's still an old token.
+    size_t from = 0;
+    if (first > 0)
+    {
+        from = std::lower_bound(expressions.begin(), expressions.end(), first,
+            [](const Expression& e, int token) {return e.end_token < token;}) - expressions.begin();
+    }
+    reparse(from, changed_end, token_delta);
+    return true;
+}
+
+ReaderPosition IncrementalDocument::position_of(size_t offset) const
+{
+    size_t line = std::upper_bound(line_starts.begin(), line_starts.end(), offset) - line_starts.begin();
+    return {(uint16_t)line, (uint16_t)(offset - line_starts[line - 1] + 1)};
+}
+
+void IncrementalDocument::relex(size_t restart, int first, size_t edit_end, const Shift& shift,
+    int& changed_end, int& token_delta)
+{
+    PhaseTimer lex_timer(Phase::LEX);
+    TextBuffer text(source.data() + restart, source.data() + source.size());
+    std::istream stream(&text);
+    LexerReader reader(stream, position_of(restart));
+    LexerFSM fsm(&reader);
+
+    std::vector<uint32_t> offsets;
+    std::vector<char> neutral_starts;
+    const LexerState* neutral_state = &NeutralState::getInstance();
+
+    int old_count = tokens.size();
+    int resume = -1;        // The old token the lexer agreed with again
+
+    lex_error.clear();
+    try
+    {
+        int old = first;
+        while (reader)
+        {
+            size_t at = restart + reader.getOffset();
+            bool neutral = fsm.getCurrentState() == neutral_state && fsm.emptySequence();
+
+            // Neutral with nothing pending, the lexer's next move depends
+            // only on the text from here on. Past the edit that's the same
+            // text as before, so if the old lexer started a token from the
+            // same place, it's all the same from here.
+            if (neutral && at >= edit_end)
+            {
+                size_t old_at = at - shift.bytes;
+                while (old < old_count && (token_offsets[old] < old_at
+                    || (token_offsets[old] == old_at && !token_neutral[old])))
+                    old++;
+                if (old < old_count && token_offsets[old] == old_at)
+                {
+                    resume = old;
+                    break;
+                }
+            }
+
+            size_t before = fsm.tokens.size();
+            fsm.processNextState();
+            for (size_t t = before; t < fsm.tokens.size(); t++)
+            {
+                offsets.push_back(at);
+                neutral_starts.push_back(neutral && t == before);
+            }
+            offsets.resize(fsm.tokens.size());      // A block comment takes back its '<'
+            neutral_starts.resize(fsm.tokens.size());
+        }
+
+        if (resume < 0)
+        {
+            fsm.addEOF();
+            offsets.push_back(source.size());
+            neutral_starts.push_back(false);
+        }
+    }
+    catch (LexicalException& e)
+    {
+        lex_error = e.message() + "\n";
+        offsets.resize(fsm.tokens.size());
+        neutral_starts.resize(fsm.tokens.size());
+    }
+    work.tokens_relexed = fsm.tokens.size();
+    Stats::instance().count(Stats::instance().tokens, fsm.tokens.size());
+
+    // The old tokens kept: the rest of them once the lexer agreed with them
+    // again, or after a lexical error, the ones past the edit (as dormant
+    // tokens, for a later edit to agree with).
+    int kept = old_count;
+    if (resume >= 0)
+        kept = resume;
+    else if (!lex_error.empty())
+        kept = std::lower_bound(token_offsets.begin() + first, token_offsets.end(), (uint32_t)shift.old_end) - token_offsets.begin();
+
+    // Move them to where the edit put them.
+    for (int t = kept; t < old_count; t++)
+    {
+        if (token_offsets[t] < shift.line_end)
+            tokens[t].column += shift.columns;
+        tokens[t].line += shift.lines;
+        token_offsets[t] += shift.bytes;
+    }
+
+    splice(tokens, first, kept, fsm.tokens);
+    splice(token_offsets, first, kept, offsets);
+    splice(token_neutral, first, kept, neutral_starts);
+
+    changed_end = first + fsm.tokens.size();
+    token_delta = changed_end - kept;
+    active_tokens = (resume >= 0) ? tokens.size() : changed_end;
+    lex_timer.arg("tokens", fsm.tokens.size());
+}
+
+void IncrementalDocument::reparse(size_t from, int changed_end, int token_delta)
+{
+    PhaseTimer parse_timer(Phase::PARSE);
+    std::vector<Expression> old(std::make_move_iterator(expressions.begin() + from),
+        std::make_move_iterator(expressions.end()));
+    old.insert(old.end(), std::make_move_iterator(dormant.begin()), std::make_move_iterator(dormant.end()));
+    expressions.resize(from);
+    dormant.clear();
+    parse_error.clear();
+
+    // An old expression is still good if all its tokens are: if it starts
+    // at or past 'changed_end' once moved along.
+    size_t next_old = 0;
+    tree_gen parse_tree(tokens, from ? expressions.back().end_token : 0, active_tokens);
+    while (!parse_tree.finished())
+    {
+        int first_token = parse_tree.token_position();
+
+        // An expression starting where a good old one did is parsed exactly
+        // as it was, and prints what it did, unless its diagnostics name
+        // positions.
+        if (first_token >= changed_end)
+        {
+            int old_first = first_token - token_delta;
+            while (next_old < old.size() && old[next_old].first_token < old_first)
+                next_old++;
+            if (next_old < old.size() && old[next_old].first_token == old_first && old[next_old].diagnostics.empty())
+            {
+                // So is every one that follows on from it, up to the next
+                // one to re-report: take them over in one go.
+                do
+                {
+                    Expression& reused = old[next_old++];
+                    reused.first_token += token_delta;
+                    reused.end_token += token_delta;
+                    expressions.push_back(std::move(reused));
+                    work.expressions_reused++;
+                } while (next_old < old.size() && old[next_old].first_token + token_delta == expressions.back().end_token
+                    && old[next_old].diagnostics.empty());
+                parse_tree.seek(expressions.back().end_token);
+                continue;
+            }
+        }
+
+        Node* head;
+        try
+        {
+            parse_tree.create_parse_tree(head);
+        }
+        catch (ParseException& e)
+        {
+            parse_error = e.message() + "\n"
+                + "Attempting to print and execute any completed expressions up to this point.\n\n";
+            break;
+        }
+
+        Expression compiled = {first_token, parse_tree.token_position(), "", "", true};
+        OutputBuffer out;
+        std::ostringstream err;
+        try
+        {
+            compiled.clean = compiler(parse_tree, head, out, err);
+        }
+        catch (const char* message)     // Allocation failures in the code generator
+        {
+            err << message << "\n";
+            compiled.clean = false;
+        }
+        compiled.output = out.take();
+        compiled.diagnostics = err.str();
+        expressions.push_back(std::move(compiled));
+        work.expressions_compiled++;
+    }
+    parse_timer.stop();
+
+    // If an error cut the file short, whatever's left that's still good is
+    // kept for when it's fixed.
+    if (lex_error.empty() && parse_error.empty())
+        return;
+    for (; next_old < old.size(); next_old++)
+    {
+        Expression& later = old[next_old];
+        if (later.first_token + token_delta < changed_end || !later.diagnostics.empty())
+            continue;
+        later.first_token += token_delta;
+        later.end_token += token_delta;
+        dormant.push_back(std::move(later));
+    }
+}
+
+void IncrementalDocument::write_output(OutputBuffer& out, std::ostream& err) const
+{
+    out << lex_error;
+    err << parse_error;
+    for (size_t i = 0; i < expressions.size(); i++)
+    {
+        if (headers)
+            out << "EXPRESSION #" << i << '\n';
+        out << expressions[i].output;
+        err << expressions[i].diagnostics;
+    }
+}
+
+bool IncrementalDocument::clean() const
+{
+    if (!lex_error.empty() || !parse_error.empty())
+        return false;
+    for (const Expression& e : expressions)
+        if (!e.clean)
+            return false;
+    return true;
+}
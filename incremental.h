@@ -0,0 +1,157 @@
+/**
+ * @file incremental.h
+ * @author Jake Rogers (z1826513)
+ * @brief A source file kept compiled across edits, for editors that
+ * recompile on every keystroke.
+ *
+ * An IncrementalDocument holds on to everything a full compile of its text
+ * produced: the tokens, where in the text each one was lexed from, which
+ * tokens each top-level expression was parsed from, and the text each
+ * expression printed. An edit then only redoes the work near it:
+ *
+ *  - Lexing restarts at the last token that began before the edit, and
+ *    stops as soon as the lexer is back in its neutral state at a point
+ *    where it was also neutral (and about to start a token) before the
+ *    edit. From there on the old tokens are reused, shifted to their new
+ *    positions.
+ *  - Parsing restarts at the expression holding the token before the first
+ *    changed one, and stops as soon as an expression boundary lines up with
+ *    an old one past the changed tokens. From there on the old expressions
+ *    (and their printed results) are reused.
+ *
+ * Only the re-parsed expressions are printed, assembled and run again, so
+ * the cost of an edit follows the size of the edit rather than the file;
+ * what's left in proportion to the file is moving the text, tokens and
+ * expressions along by the edit's length.
+ *
+ * The output and diagnostics always match what a full compile of the
+ * current text would print. Anything that bakes positions into a message is
+ * redone rather than reused: an expression that failed to assemble is
+ * re-parsed, and lexical and syntax errors are re-reported from where the
+ * lexer or parser restarted.
+ *
+ * Errors stop a full compile part way, but the document keeps what lies
+ * past them: the tokens after a lexical error and the expressions after a
+ * syntax error stay on (dormant), moved along with every edit, so typing
+ * the quote that opens a string and then the one that closes it doesn't
+ * re-lex and recompile the rest of the file.
+ */
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "token.h"
+#include "lexer_reader.h"
+#include "tree_gen.h"
+#include "output_buffer.h"
+
+class IncrementalDocument
+{
+public:
+    /**
+     * Print, assemble and run one expression, writing everything a full
+     * compile prints for it after its "EXPRESSION #i" line, and delete its
+     * tree. Returns false if it had errors.
+     */
+    typedef std::function<bool(tree_gen& parse_tree, Node* head, OutputBuffer& out, std::ostream& err)> Compiler;
+
+    // With 'headers', each expression's output is preceded by its
+    // "EXPRESSION #i" line (ncc without --quiet).
+    IncrementalDocument(Compiler compiler, bool headers);
+
+    // Replace the whole text and compile it from scratch.
+    void load(const std::string& text);
+
+    // Replace the 'removed' bytes at 'offset' with 'inserted' and bring
+    // everything up to date. Returns false (changing nothing) if the range
+    // isn't within the text.
+    bool edit(size_t offset, size_t removed, const std::string& inserted);
+
+    // What a full compile of the current text would print.
+    void write_output(OutputBuffer& out, std::ostream& err) const;
+
+    // Whether the text compiled without errors.
+    bool clean() const;
+
+    const std::string& text() const {return source;}
+
+    // How much the last load or edit redid, for benchmarks and tests.
+    struct Work
+    {
+        size_t tokens_relexed;
+        size_t expressions_compiled;
+        size_t expressions_reused;
+    };
+    const Work& last_work() const {return work;}
+
+    size_t token_count() const {return active_tokens;}
+    size_t expression_count() const {return expressions.size();}
+
+private:
+    // A top-level expression: the tokens [first_token, end_token) and what
+    // compiling it printed.
+    struct Expression
+    {
+        int first_token;
+        int end_token;
+        std::string output;
+        std::string diagnostics;
+        bool clean;
+    };
+
+    // How an edit moved the text after it.
+    struct Shift
+    {
+        size_t old_end;         // Where the edit ended, before it
+        long bytes;             // Offsets after the edit move by this much
+        size_t line_end;        // Where the edit's last line ended, before it
+        uint16_t lines;         // Lines after the edit move down this much...
+        uint16_t columns;       // ...and those on its last line right this much.
+    };
+
+    // The line and column of a byte offset in the text, as the lexer counts them.
+    ReaderPosition position_of(size_t offset) const;
+
+    // Re-lex the text from 'restart', where the lexer was neutral before
+    // token 'first', up to the end of the text or until the lexer agrees
+    // with the old tokens again past the edit ending at 'edit_end', and
+    // splice the new tokens in. Returns how the tokens moved: the old ones
+    // from index 'changed_end' - 'token_delta' on are still good, and now
+    // start at 'changed_end'. Old tokens before that from 'first' on are gone.
+    void relex(size_t restart, int first, size_t edit_end, const Shift& shift,
+        int& changed_end, int& token_delta);
+
+    // Re-parse from expression 'from' onwards, taking over old expressions
+    // whose tokens are still good once a boundary lines up with theirs.
+    void reparse(size_t from, int changed_end, int token_delta);
+
+    Compiler compiler;
+    bool headers;
+
+    std::string source;
+    std::vector<size_t> line_starts;        // Offset of every line, first is 0
+
+    // The tokens [0, active_tokens) are the file's; any after them are the
+    // dormant ones past a lexical error.
+    std::vector<Token> tokens;
+    std::vector<uint32_t> token_offsets;    // Where the lexer was when it started each token
+    std::vector<char> token_neutral;        // Whether it was in the neutral state then
+    int active_tokens;
+    std::string lex_error;                  // Printed for a lexical error, else empty
+
+    std::vector<Expression> expressions;
+    std::string parse_error;                // Diagnostics for a syntax error, else empty
+
+    // The expressions an error cut off, kept for when it's fixed. Their
+    // token ranges are kept up to date like everything else's.
+    std::vector<Expression> dormant;
+
+    Work work;
+};
+
+#endif
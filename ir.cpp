@@ -0,0 +1,151 @@
+#include "ir.h"
+
+#include "parse_exception.h"
+
+void IrInstr::make_constant(int64_t constant)
+{
+    op = IrOp::CONST;
+    value = constant;
+    token.id = TypeID::INTEGER;
+    token.i_value = constant;
+    token.text = 0;
+}
+
+unsigned IrFunction::operand_count(IrOp op)
+{
+    switch (op)
+    {
+    case IrOp::CONST:
+    case IrOp::LOAD:
+        return 0;
+    case IrOp::NEG:
+        return 1;
+    default:
+        return 2;
+    }
+}
+
+std::vector<uint32_t> IrFunction::use_counts() const
+{
+    std::vector<uint32_t> uses(instrs.size(), 0);
+    for (const IrInstr &instr : instrs)
+        for (unsigned i = 0; i < operand_count(instr.op); i++)
+            uses[instr.operands[i]]++;
+    if (!instrs.empty())
+        uses[result]++;
+    return uses;
+}
+
+void IrFunction::replace_uses(const std::vector<uint32_t> &replacement)
+{
+    for (IrInstr &instr : instrs)
+        for (unsigned i = 0; i < operand_count(instr.op); i++)
+            instr.operands[i] = replacement[instr.operands[i]];
+    result = replacement[result];
+}
+
+void IrFunction::print(OutputBuffer &out) const
+{
+    static const char *op_names[] = {"const", "load", "add", "sub", "mul", "div", "mod", "exp", "neg"};
+
+    for (size_t v = 0; v < instrs.size(); v++)
+    {
+        const IrInstr &instr = instrs[v];
+        out << "%" << (uint64_t)v << " = " << op_names[(int)instr.op] << (instr.type == IrType::I64 ? " i64" : " i32");
+        if (instr.op == IrOp::CONST)
+            out << " " << instr.value;
+        else if (instr.op == IrOp::LOAD)
+            out << " " << instr.token.value();
+        for (unsigned i = 0; i < operand_count(instr.op); i++)
+            out << (i ? ", %" : " %") << (uint64_t)instr.operands[i];
+        out << '\n';
+    }
+    out << "ret %" << (uint64_t)result << '\n';
+}
+
+// Lowering state: the function being built, and the parse tree walk.
+struct Lowering
+{
+    IrFunction &function;
+
+    uint32_t add(IrOp op, const Token &token, uint32_t left = 0, uint32_t right = 0, int64_t value = 0)
+    {
+        IrInstr instr;
+        instr.op = op;
+        instr.type = function.type;
+        instr.operands[0] = left;
+        instr.operands[1] = right;
+        instr.value = value;
+        instr.token = token;
+        function.instrs.push_back(instr);
+        return function.instrs.size() - 1;
+    }
+
+    // Slots in order of first appearance, as EncodedProgram gives them.
+    int64_t slot(const Token &ident)
+    {
+        std::vector<uint32_t> &handles = function.variable_handles;
+        for (size_t s = 0; s < handles.size(); s++)
+            if (handles[s] == ident.text)
+                return s;
+        handles.push_back(ident.text);
+        return handles.size() - 1;
+    }
+
+    // Operands first, in order, then the node itself: the same post-order
+    // traverse() takes, so the same error is found first.
+    uint32_t lower(Node *n)
+    {
+        uint32_t operands[2] = {0, 0};
+        unsigned count = 0;
+        for (Node *child = n->child; child != nullptr; child = child->sibling, count++)
+        {
+            uint32_t operand = lower(child);
+            if (count < 2)
+                operands[count] = operand;
+        }
+
+        IrOp op;
+        switch (n->token.id)
+        {
+        case (TypeID::INTEGER):
+            if (function.type == IrType::I32 && n->token.i_value > INT32_MAX)
+                throw ParseException("Integer literal does not fit in 32 bits (try --int64).", n->token);
+            return add(IrOp::CONST, n->token, 0, 0, n->token.i_value);
+
+        case (TypeID::IDENT):
+            return add(IrOp::LOAD, n->token, 0, 0, slot(n->token));
+
+        case (TypeID::UPLUS):
+            if (count != 1)
+                throw ParseException("Encountered unsupported symbol during assembly.", n->token);
+            return operands[0];
+
+        case ('+'):         op = IrOp::ADD; break;
+        case ('-'):         op = IrOp::SUB; break;
+        case ('*'):         op = IrOp::MUL; break;
+        case ('/'):         op = IrOp::DIV; break;
+        case (TypeID::MOD): op = IrOp::MOD; break;
+        case ('^'):         op = IrOp::EXP; break;
+        case (TypeID::NEGATE): op = IrOp::NEG; break;
+
+        default:
+            throw ParseException("Encountered unsupported symbol during assembly.", n->token);
+        }
+
+        if (count != IrFunction::operand_count(op))
+            throw ParseException("Encountered unsupported symbol during assembly.", n->token);
+        return add(op, n->token, operands[0], operands[1]);
+    }
+};
+
+IrFunction lower_tree(Node *head, bool wide, bool checked)
+{
+    IrFunction function;
+    function.type = wide ? IrType::I64 : IrType::I32;
+    function.checked = checked;
+
+    Lowering lowering{function};
+    function.result = lowering.lower(head);
+    return function;
+}
@@ -0,0 +1,96 @@
+/**
+ * @file ir.h
+ * @author Jake Rogers (z1826513)
+ * @brief A small typed SSA intermediate representation of one expression,
+ * between the parse tree and EncodedProgram.
+ *
+ * An IrFunction is a list of instructions, each defining one value, named
+ * by its index. Every operand is a value defined earlier in the list, so
+ * the list is always in a valid evaluation order and each value is
+ * assigned exactly once. Values are typed (I32 or I64, as the
+ * ArithmeticMode says), and the function's result is one of them.
+ *
+ * lower_tree() builds the IR from a parse tree, one instruction per node
+ * ('+' in front of an operand does nothing and gets none). The passes in
+ * ir_passes.h then rewrite it, and EncodedProgram turns what's left into
+ * code for either tier. A value used more than once is computed once and
+ * kept in a slot.
+ *
+ * Each instruction keeps the token it came from: that's what errors are
+ * reported against, and what EncodedProgram encodes, so an instruction's
+ * token id always matches its op (a folded constant's token is turned into
+ * an INTEGER).
+ */
+#ifndef IR_H
+#define IR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "node.h"
+#include "output_buffer.h"
+
+enum class IrOp : uint8_t
+{
+    CONST,      // 'value' is the constant
+    LOAD,       // 'value' is the variable's slot
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    MOD,
+    EXP,        // Like the code generator, just the left operand for now
+    NEG
+};
+
+enum class IrType : uint8_t
+{
+    I32,
+    I64
+};
+
+struct IrInstr
+{
+    IrOp op;
+    IrType type;
+    uint32_t operands[2];   // Value ids, as many as operand_count(op)
+    int64_t value;          // CONST and LOAD only
+    Token token;
+
+    // Turn this instruction into the constant 'constant', in place.
+    void make_constant(int64_t constant);
+};
+
+struct IrFunction
+{
+    IrType type = IrType::I32;
+    bool checked = false;               // Signed overflow stops the program
+    std::vector<IrInstr> instrs;
+    uint32_t result = 0;
+    std::vector<uint32_t> variable_handles;     // Slot -> name's StringPool handle
+
+    // How many operands instructions with 'op' take.
+    static unsigned operand_count(IrOp op);
+
+    // How many times each value is used (as an operand, or as the result).
+    std::vector<uint32_t> use_counts() const;
+
+    // Replace every use of value v by replacement[v], for each v. A value
+    // whose replacement is itself is left alone.
+    void replace_uses(const std::vector<uint32_t>& replacement);
+
+    // Print the instructions one per line, for debugging passes.
+    void print(OutputBuffer& out) const;
+};
+
+/**
+ * @brief Lower the expression rooted at 'head' (its children, but not its
+ * siblings) to IR, with the arithmetic of 'wide' and 'checked'.
+ *
+ * Throws a ParseException, with the same message and token encode_node()
+ * would give, for a symbol which can't be compiled or a literal too wide.
+ */
+IrFunction lower_tree(Node *head, bool wide, bool checked);
+
+#endif
@@ -0,0 +1,307 @@
+#include "ir_passes.h"
+
+#include <chrono>
+#include <unordered_map>
+
+#include "stats.h"
+#include "trace.h"
+
+// Fold 'op' on constants of type T, as the code would compute it. Returns
+// false if the program must be left to fail at run time instead.
+template <typename T>
+static bool fold(IrOp op, bool checked, T left, T right, T &folded)
+{
+    const T min = std::numeric_limits<T>::min();
+    bool overflow = false;
+    switch (op)
+    {
+    case IrOp::ADD:
+        overflow = __builtin_add_overflow(left, right, &folded);
+        break;
+    case IrOp::SUB:
+        overflow = __builtin_sub_overflow(left, right, &folded);
+        break;
+    case IrOp::MUL:
+        overflow = __builtin_mul_overflow(left, right, &folded);
+        break;
+    case IrOp::NEG:
+        overflow = __builtin_sub_overflow((T)0, left, &folded);
+        break;
+    case IrOp::DIV:
+    case IrOp::MOD:
+        // IDIV faults on both of these, checked or not.
+        if (right == 0 || (left == min && right == -1))
+            return false;
+        folded = (op == IrOp::DIV) ? left / right : left % right;
+        break;
+    case IrOp::EXP:
+        folded = left;
+        break;
+    default:
+        return false;
+    }
+    return !(checked && overflow);
+}
+
+size_t ConstantPropagation::run(IrFunction &function) const
+{
+    size_t changes = 0;
+    for (IrInstr &instr : function.instrs)
+    {
+        unsigned count = IrFunction::operand_count(instr.op);
+        if (count == 0)
+            continue;
+
+        const IrInstr &left = function.instrs[instr.operands[0]];
+        const IrInstr &right = function.instrs[instr.operands[count - 1]];
+        if (left.op != IrOp::CONST || right.op != IrOp::CONST)
+            continue;
+
+        bool folded;
+        int64_t value;
+        if (instr.type == IrType::I64)
+        {
+            folded = fold<int64_t>(instr.op, function.checked, left.value, right.value, value);
+        }
+        else
+        {
+            int32_t narrow;
+            folded = fold<int32_t>(instr.op, function.checked, left.value, right.value, narrow);
+            value = narrow;
+        }
+
+        if (folded)
+        {
+            instr.make_constant(value);
+            changes++;
+        }
+    }
+    return changes;
+}
+
+// A value's identity for numbering: op and operands, or the constant or slot.
+struct ValueKey
+{
+    IrOp op;
+    uint32_t left;
+    uint32_t right;
+    int64_t value;
+
+    bool operator==(const ValueKey &other) const
+    {
+        return op == other.op && left == other.left && right == other.right && value == other.value;
+    }
+};
+
+struct ValueKeyHash
+{
+    size_t operator()(const ValueKey &key) const
+    {
+        const uint64_t multiplier = 0x9e3779b97f4a7c15ull;
+        uint64_t h = ((uint64_t)key.op * multiplier) ^ key.left;
+        h = (h * multiplier) ^ key.right;
+        h = (h * multiplier) ^ (uint64_t)key.value;
+        h *= multiplier;
+        return h ^ (h >> 32);
+    }
+};
+
+size_t CommonSubexpressionElimination::run(IrFunction &function) const
+{
+    std::vector<uint32_t> replacement(function.instrs.size());
+    std::unordered_map<ValueKey, uint32_t, ValueKeyHash> numbers;
+    size_t changes = 0;
+
+    for (uint32_t v = 0; v < function.instrs.size(); v++)
+    {
+        IrInstr &instr = function.instrs[v];
+        unsigned count = IrFunction::operand_count(instr.op);
+        for (unsigned i = 0; i < count; i++)
+            instr.operands[i] = replacement[instr.operands[i]];
+
+        ValueKey key = {instr.op, 0, 0, (count == 0) ? instr.value : 0};
+        if (count > 0)
+            key.left = instr.operands[0];
+        if (count > 1)
+            key.right = instr.operands[1];
+        if ((instr.op == IrOp::ADD || instr.op == IrOp::MUL) && key.left > key.right)
+            std::swap(key.left, key.right);
+
+        auto found = numbers.emplace(key, v);
+        replacement[v] = found.first->second;
+        if (!found.second)
+            changes++;
+    }
+
+    function.result = replacement[function.result];
+    return changes;
+}
+
+size_t AlgebraicSimplification::run(IrFunction &function) const
+{
+    std::vector<uint32_t> replacement(function.instrs.size());
+    std::vector<bool> trap_free(function.instrs.size());
+    size_t changes = 0;
+
+    for (uint32_t v = 0; v < function.instrs.size(); v++)
+    {
+        IrInstr &instr = function.instrs[v];
+        unsigned count = IrFunction::operand_count(instr.op);
+        for (unsigned i = 0; i < count; i++)
+            instr.operands[i] = replacement[instr.operands[i]];
+        replacement[v] = v;
+
+        // Whether computing the value can ever stop the program, which a
+        // value we drop mustn't.
+        bool operands_trap_free = true;
+        for (unsigned i = 0; i < count; i++)
+            operands_trap_free = operands_trap_free && trap_free[instr.operands[i]];
+        switch (instr.op)
+        {
+        case IrOp::CONST:
+        case IrOp::LOAD:
+            trap_free[v] = true;
+            break;
+        case IrOp::DIV:
+        case IrOp::MOD:
+            trap_free[v] = false;
+            break;
+        case IrOp::EXP:
+            trap_free[v] = operands_trap_free;
+            break;
+        default:
+            trap_free[v] = operands_trap_free && !function.checked;
+            break;
+        }
+
+        if (count == 0)
+            continue;
+
+        uint32_t x = instr.operands[0];
+        uint32_t y = instr.operands[count - 1];
+        const IrInstr &left = function.instrs[x];
+        const IrInstr &right = function.instrs[y];
+        auto is_constant = [](const IrInstr &operand, int64_t value) {
+            return operand.op == IrOp::CONST && operand.value == value;
+        };
+        auto negate = [&](uint32_t operand) {
+            instr.op = IrOp::NEG;
+            instr.token.id = TypeID::NEGATE;
+            instr.operands[0] = operand;
+        };
+
+        bool changed = true;
+        if ((instr.op == IrOp::ADD && is_constant(right, 0)) || (instr.op == IrOp::SUB && is_constant(right, 0))
+            || (instr.op == IrOp::MUL && is_constant(right, 1)) || (instr.op == IrOp::DIV && is_constant(right, 1)))
+            replacement[v] = x;
+        else if ((instr.op == IrOp::ADD && is_constant(left, 0)) || (instr.op == IrOp::MUL && is_constant(left, 1)))
+            replacement[v] = y;
+        else if (instr.op == IrOp::MUL && is_constant(right, 0) && trap_free[x])
+            instr.make_constant(0);
+        else if (instr.op == IrOp::MUL && is_constant(left, 0) && trap_free[y])
+            instr.make_constant(0);
+        else if (instr.op == IrOp::SUB && x == y && trap_free[x])
+            instr.make_constant(0);
+        else if (instr.op == IrOp::MOD && is_constant(right, 1) && trap_free[x])
+            instr.make_constant(0);
+        else if (instr.op == IrOp::EXP && trap_free[y])
+            replacement[v] = x;
+        else if (instr.op == IrOp::SUB && is_constant(left, 0))
+            negate(y);      // Overflows exactly when the subtraction would.
+        else if (instr.op == IrOp::MUL && is_constant(right, -1))
+            negate(x);
+        else if (instr.op == IrOp::MUL && is_constant(left, -1))
+            negate(y);
+        else if (instr.op == IrOp::NEG && left.op == IrOp::NEG && !function.checked)
+            replacement[v] = left.operands[0];
+        else
+            changed = false;
+
+        if (changed)
+        {
+            changes++;
+            if (replacement[v] != v)
+                trap_free[v] = trap_free[replacement[v]];
+            else if (instr.op == IrOp::CONST)
+                trap_free[v] = true;
+        }
+    }
+
+    function.result = replacement[function.result];
+    return changes;
+}
+
+size_t DeadCodeElimination::run(IrFunction &function) const
+{
+    std::vector<IrInstr> &instrs = function.instrs;
+    if (instrs.empty())
+        return 0;
+
+    // Operands come before their users, so one pass backwards finds
+    // everything the result needs.
+    std::vector<bool> live(instrs.size(), false);
+    live[function.result] = true;
+    for (size_t v = instrs.size(); v-- > 0;)
+    {
+        if (!live[v])
+            continue;
+        for (unsigned i = 0; i < IrFunction::operand_count(instrs[v].op); i++)
+            live[instrs[v].operands[i]] = true;
+    }
+
+    std::vector<uint32_t> renumbered(instrs.size());
+    size_t kept = 0;
+    for (size_t v = 0; v < instrs.size(); v++)
+    {
+        if (!live[v])
+            continue;
+        renumbered[v] = kept;
+        instrs[kept++] = instrs[v];
+    }
+
+    size_t removed = instrs.size() - kept;
+    instrs.resize(kept);
+    function.replace_uses(renumbered);
+    return removed;
+}
+
+const PassManager& PassManager::standard()
+{
+    static const PassManager *pipeline = []() {
+        PassManager *passes = new PassManager();
+        passes->add(std::unique_ptr<IrPass>(new ConstantPropagation()));
+        passes->add(std::unique_ptr<IrPass>(new CommonSubexpressionElimination()));
+        passes->add(std::unique_ptr<IrPass>(new AlgebraicSimplification()));
+        passes->add(std::unique_ptr<IrPass>(new DeadCodeElimination()));
+        return passes;
+    }();
+    return *pipeline;
+}
+
+void PassManager::run(IrFunction &function) const
+{
+    Stats &stats = Stats::instance();
+    for (const std::unique_ptr<IrPass> &pass : passes)
+    {
+        TraceSpan span(pass->name(), "optimize");
+        size_t before = function.instrs.size();
+        bool timed = stats.enabled || hook;
+        std::chrono::steady_clock::time_point start;
+        if (timed)
+            start = std::chrono::steady_clock::now();
+
+        size_t changes = pass->run(function);
+
+        span.arg("changes", changes);
+        span.stop();
+        if (!timed)
+            continue;
+
+        PassReport report = {pass.get(),
+            (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(),
+            changes, before, function.instrs.size()};
+        stats.add_pass(report.pass->name(), report.wall_ns, changes, before - report.instructions_after);
+        if (hook)
+            hook(report);
+    }
+}
@@ -0,0 +1,110 @@
+/**
+ * @file ir_passes.h
+ * @author Jake Rogers (z1826513)
+ * @brief Optimisation passes over the IR (see ir.h), and the PassManager
+ * which runs them.
+ *
+ * Every pass rewrites an IrFunction in place and returns how many changes
+ * it made. None of them changes what a program computes, including whether
+ * it fails: a division which could divide by zero (or INT_MIN by -1) is
+ * never folded or dropped, and neither is arithmetic which could overflow
+ * when the function is checked.
+ *
+ *  - ConstantPropagation folds operations on constants, with the
+ *    function's wrap-around (or checked) arithmetic.
+ *  - CommonSubexpressionElimination numbers values by their op and
+ *    operands ('+' and '*' in either order), so each is computed once.
+ *  - AlgebraicSimplification applies identities: x + 0, x * 1, x * 0,
+ *    x - x, 0 - x, - -x and so on.
+ *  - DeadCodeElimination drops every value the result doesn't depend on,
+ *    which is where the others leave what they replaced.
+ *
+ * The PassManager runs a list of passes in order, timing each one. With
+ * --stats every pass's time, changes and instructions removed are added to
+ * the report (and each run is a span when tracing); a hook can also be
+ * given to see each run as it happens.
+ */
+#ifndef IR_PASSES_H
+#define IR_PASSES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "ir.h"
+
+class IrPass
+{
+public:
+    virtual ~IrPass() {}
+
+    // Short lower case name, as used in reports and traces.
+    virtual const char* name() const = 0;
+
+    // Rewrite 'function', returning the number of changes made.
+    virtual size_t run(IrFunction& function) const = 0;
+};
+
+class ConstantPropagation : public IrPass
+{
+public:
+    const char* name() const override {return "constprop";}
+    size_t run(IrFunction& function) const override;
+};
+
+class CommonSubexpressionElimination : public IrPass
+{
+public:
+    const char* name() const override {return "cse";}
+    size_t run(IrFunction& function) const override;
+};
+
+class AlgebraicSimplification : public IrPass
+{
+public:
+    const char* name() const override {return "simplify";}
+    size_t run(IrFunction& function) const override;
+};
+
+class DeadCodeElimination : public IrPass
+{
+public:
+    const char* name() const override {return "dce";}
+    size_t run(IrFunction& function) const override;
+};
+
+// What one run of one pass did, for the PassManager's hook.
+struct PassReport
+{
+    const IrPass* pass;
+    uint64_t wall_ns;
+    size_t changes;
+    size_t instructions_before;
+    size_t instructions_after;
+};
+
+class PassManager
+{
+public:
+    typedef std::function<void(const PassReport&)> Hook;
+
+    // The pipeline --optimize uses: constprop, cse, simplify, dce. Passes
+    // keep no state, so it's shared by every thread.
+    static const PassManager& standard();
+
+    void add(std::unique_ptr<IrPass> pass) {passes.push_back(std::move(pass));}
+
+    // Called after every pass run, from the thread running it.
+    void set_hook(Hook hook) {this->hook = hook;}
+
+    // Run every pass over 'function', in order.
+    void run(IrFunction& function) const;
+
+private:
+    std::vector<std::unique_ptr<IrPass>> passes;
+    Hook hook;
+};
+
+#endif
@@ -81,6 +81,11 @@ public:
         return ss.str();
     }
 
+    // Line and column the error occured at.
+    ReaderPosition position() const {
+        return where;
+    }
+
 private:
     std::string msg;
     ReaderPosition where;
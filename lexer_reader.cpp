@@ -1,6 +1,7 @@
 #include "lexer_reader.h"
 
 LexerReader::LexerReader(const char* file_path) 
+    : stream(&src_stream)
 {
     src_stream.open(file_path, std::ios::binary);
     if (!src_stream)    // Check if our file opened successfully
@@ -13,9 +14,21 @@ LexerReader::LexerReader(const char* file_path)
     current_position = {1, 1};  // Initialize the line and column to 1 & 1.
 }
 
+LexerReader::LexerReader(std::istream& source)
+    : stream(&source)
+{
+    current_position = {1, 1};
+}
+
+LexerReader::LexerReader(std::istream& source, ReaderPosition start)
+    : stream(&source)
+{
+    current_position = start;
+}
+
 LexerReader::operator bool() const 
 {
-    return (!src_stream.eof() && src_stream.is_open());
+    return (!stream->eof() && (stream != &src_stream || src_stream.is_open()));
 }
 
 LexerReader::~LexerReader() 
@@ -26,7 +39,8 @@ LexerReader::~LexerReader()
 
 char LexerReader::advance() 
 {
-    char next = src_stream.get();
+    char next = stream->get();
+    offset++;
     
     if (next == '\n')      // Advance the line counter and reset the column number
     {
@@ -40,9 +54,50 @@ char LexerReader::advance()
     return next;
 }
 
+size_t LexerReader::advanceDigits(char* out, size_t capacity)
+{
+    std::streambuf* buffer = stream->rdbuf();
+    size_t count = 0;
+    int next = buffer->sgetc();
+    while (count < capacity && next >= '0' && next <= '9')
+    {
+        out[count++] = next;
+        next = buffer->snextc();
+    }
+
+    // Digits never end a line.
+    offset += count;
+    current_position.column += count;
+    return count;
+}
+
+size_t LexerReader::advanceStringBytes(char* out, size_t capacity)
+{
+    std::streambuf* buffer = stream->rdbuf();
+    size_t count = 0;
+    int next = buffer->sgetc();
+    while (count < capacity && next != std::char_traits<char>::eof() && next != '"' && next != '\\')
+    {
+        out[count++] = next;
+        if (next == '\n')
+        {
+            current_position.line++;
+            current_position.column = 1;
+        }
+        else
+        {
+            current_position.column++;
+        }
+        next = buffer->snextc();
+    }
+
+    offset += count;
+    return count;
+}
+
 char LexerReader::peekNext()
 {
-    return src_stream.peek();
+    return stream->peek();
 }
 
 ReaderPosition LexerReader::getPositionData() 
@@ -34,6 +34,24 @@ public:
      */
     LexerReader(const char* file_path);
 
+    /**
+     * @brief Construct a Lexer Reader over source that's already in memory
+     * (or anywhere else a stream can come from). The stream is not owned and
+     * must outlive the reader.
+     * 
+     * @param source The stream to read the source from
+     */
+    LexerReader(std::istream& source);
+
+    /**
+     * @brief The same, for a stream picking up part way through a file:
+     * positions are counted on from 'start'.
+     * 
+     * @param source The stream to read the source from
+     * @param start The line and column the stream starts at
+     */
+    LexerReader(std::istream& source, ReaderPosition start);
+
     /**
      * @brief Closes the file stream when this object goes out of scope
      * or gets destroyed so we don't need to manually do it.
@@ -66,6 +84,24 @@ public:
      */
     char peekNext();
 
+    /**
+     * @brief Extract a run of ASCII digits, up to 'capacity' of them, into
+     * 'out', advancing the reader position past them. Reads straight from
+     * the stream's buffer rather than a byte per get().
+     *
+     * @return size_t The number of digits extracted; 0 if the next byte
+     * isn't a digit.
+     */
+    size_t advanceDigits(char* out, size_t capacity);
+
+    /**
+     * @brief The same for the body of a string literal: extract bytes up to
+     * the next '"', '\\' or the end of the stream, up to 'capacity' of them.
+     *
+     * @return size_t The number of bytes extracted.
+     */
+    size_t advanceStringBytes(char* out, size_t capacity);
+
     /**
      * @brief Returns a copy of the position within the file at this
      * moment in time.
@@ -73,9 +109,19 @@ public:
      * @return ReaderPosition 
      */
     ReaderPosition getPositionData();
+
+    /**
+     * @brief The number of bytes extracted so far. Unlike the line and
+     * column, this never wraps around.
+     * 
+     * @return size_t
+     */
+    size_t getOffset() const {return offset;}
 private:
     std::ifstream src_stream;
+    std::istream* stream;       // src_stream, or the stream we were given
     ReaderPosition current_position;
+    size_t offset = 0;
 };
 
 #endif
\ No newline at end of file
@@ -8,7 +8,21 @@
  */
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 // Stuff for lexer
 #include "fsm/lexer_fsm.h"
@@ -20,26 +34,590 @@
 #include "id_table.h"
 #include "tree_gen.h"
 #include "encoded_program.h"
+#include "x86_assembler.h"
+#include "expression_memo.h"
+#include "reassociate.h"
+#include "batch_program.h"
+#include "code_cache.h"
+#include "stats.h"
+#include "trace.h"
+#include "server.h"
+#include "incremental.h"
+#include "output_buffer.h"
+#include "result_stream.h"
 
 // Somewhat deceptively named. If true, the program will try to execute
 // any successfully parsed expressions should the most recent one
 // is invaliud. 
 #define RECOVERY true   
 
-int main(int argc, char **argv)
+// In --tier=auto, expressions with fewer nodes than this are interpreted,
+// since mapping executable memory for them costs more than running them.
+#define INTERPRET_BELOW_NODES 32
+
+/**
+ * Values for the variables in an expression. Each --bind name=value gives
+ * one value for every run; a --rows file gives a header line of variable
+ * names followed by one line of values per row, and every expression is run
+ * once per row (falling back to --bind for names without a column).
+ */
+struct Bindings
 {
-    // Usage
-    if (argc != 2)
+    std::map<std::string, int64_t> values;
+    std::vector<std::string> columns;
+    std::vector<std::vector<int64_t>> rows;
+};
+
+// Everything from the command line that decides how a file is compiled.
+// Shared read-only by every worker in batch mode.
+struct CompileOptions
+{
+    bool use_cache = false;         // --cache: reuse/store assembled code on disk.
+    ExecutionTier tier = ExecutionTier::JIT;
+    bool auto_tier = false;         // --tier=auto
+    bool vector = false;            // --vector: evaluate --rows with SIMD batch programs.
+    ArithmeticMode mode;            // --int64, --checked
+    bool share_subexpressions = false;  // --cse: evaluate repeated subexpressions once.
+    bool reassociate = false;       // --reassociate: balance long '+' and '*' chains.
+    bool optimize = false;          // --optimize: run the IR passes before encoding.
+    size_t memo_entries = 64;       // --memo n: duplicate expressions remembered per file (0: none)
+    Bindings bindings;              // --bind name=value, --rows file
+    bool quiet = false;             // --quiet: print results only
+    bool results_timing = false;    // --results-timing: time each --results record
+};
+
+// How compiling one file went, for the batch mode summary.
+struct FileResult
+{
+    uint64_t source_bytes = 0;
+    size_t expressions = 0;
+    bool clean = true;              // No lexical, syntax or assembly errors
+    bool opened = true;             // The file could be read at all
+};
+
+// Parse a --rows file into 'bindings'. Values may be separated by
+// whitespace or commas.
+bool load_rows(const char *path, Bindings &bindings)
+{
+    std::ifstream rows_file(path);
+    if (!rows_file)
+        return false;
+
+    std::string line;
+    bool header = true;
+    while (std::getline(rows_file, line))
     {
-        std::cerr << "Usage: ./ncc src_file" << std::endl;
-        exit(1);
+        for (char &c : line)
+            if (c == ',')
+                c = ' ';
+
+        std::stringstream fields(line);
+        if (header)
+        {
+            std::string name;
+            while (fields >> name)
+                bindings.columns.push_back(name);
+            header = bindings.columns.empty();
+            continue;
+        }
+
+        std::vector<int64_t> row;
+        long long value;
+        while (fields >> value)
+            row.push_back(value);
+        if (row.empty())
+            continue;
+        if (row.size() != bindings.columns.size())
+            return false;
+        bindings.rows.push_back(row);
+    }
+    return true;
+}
+
+/**
+ * Run an assembled program against the bindings and print its output, then
+ * release it. With rows, the program is assembled once and called once per
+ * row, each printing its own output line. With --quiet, only the values are
+ * printed. Each result (or error) is also written to 'results', if given.
+ *
+ * With 'memo', the program is the memo's and isn't released. A constant
+ * program's result is recorded there the first time, and just printed
+ * from there after that.
+ */
+void run_program(EncodedProgram &prog, const CompileOptions &options, OutputBuffer &out, std::ostream &err,
+    ResultWriter *results, ExpressionMemo::Entry *memo = nullptr)
+{
+    const Bindings &bindings = options.bindings;
+    const std::vector<std::string> &names = prog.variables();
+    std::vector<int64_t> values(names.size());
+
+    // For each slot, the --rows column holding it, or -1 to use --bind.
+    std::vector<int> columns(names.size(), -1);
+    for (size_t slot = 0; slot < names.size(); slot++)
+    {
+        for (size_t col = 0; col < bindings.columns.size(); col++)
+            if (bindings.columns[col] == names[slot])
+                columns[slot] = col;
+
+        if (columns[slot] == -1)
+        {
+            auto bound = bindings.values.find(names[slot]);
+            if (bound == bindings.values.end())
+            {
+                out.flush();
+                err << "Error: variable '" << names[slot] << "' has no value, use --bind or --rows." << std::endl;
+                if (results)
+                    results->emit(RESULT_UNBOUND_VARIABLE);
+                if (!memo)
+                    prog.release();
+                return;
+            }
+            values[slot] = bound->second;
+        }
+    }
+
+    if (bindings.rows.empty() || names.empty())
+    {
+        uint64_t started = results ? results->now() : 0;
+        try
+        {
+            int64_t value;
+            if (memo && memo->known)
+            {
+                value = memo->value;
+            }
+            else
+            {
+                value = prog.run(values.data());
+                if (memo && names.empty())
+                {
+                    memo->known = true;
+                    memo->value = value;
+                }
+            }
+            if (results)
+                results->emit(RESULT_OK, value, 0, results->now() - started);
+
+            if (!options.quiet)
+                out << "Program Length: " << prog.length() << " bytes\n" << "Output: ";
+            out << value << '\n';
+        }
+        catch (ExecutionException &e)
+        {
+            out.flush();
+            err << e.message() << std::endl;
+            if (results)
+                results->emit((ResultStatus)e.get_status(), 0, 0, results->now() - started);
+        }
+        if (!memo)
+            prog.release();
+        return;
+    }
+
+    if (!options.quiet)
+        out << "Program Length: " << prog.length() << " bytes\n";
+    for (size_t r = 0; r < bindings.rows.size(); r++)
+    {
+        for (size_t slot = 0; slot < names.size(); slot++)
+            if (columns[slot] != -1)
+                values[slot] = bindings.rows[r][columns[slot]];
+
+        uint64_t started = results ? results->now() : 0;
+        try
+        {
+            int64_t value = prog.run(values.data());
+            if (results)
+                results->emit(RESULT_OK, value, r, results->now() - started);
+            if (!options.quiet)
+                out << "Output: ";
+            out << value << '\n';
+        }
+        catch (ExecutionException &e)
+        {
+            out.flush();
+            err << e.message() << std::endl;
+            if (results)
+                results->emit((ResultStatus)e.get_status(), 0, r, results->now() - started);
+        }
+    }
+    if (!memo)
+        prog.release();
+}
+
+/**
+ * Evaluate an expression over every --rows row at once with a BatchProgram,
+ * turning the rows into one column per variable (--bind values are repeated
+ * down a column of their own), and print one output per row.
+ */
+void run_batch(Node *head, const CompileOptions &options, OutputBuffer &out, std::ostream &err,
+    ResultWriter *results)
+{
+    const Bindings &bindings = options.bindings;
+    BatchProgram batch(head);
+    uint64_t assemble_started = results ? results->now() : 0;
+    try
+    {
+        batch.assemble();
+    }
+    catch (ParseException &e)
+    {
+        out.flush();
+        err << e.message() << std::endl;
+        if (results)
+            results->emit(RESULT_ASSEMBLY_ERROR);
+        return;
+    }
+    if (results)
+    {
+        results->record.code_size = batch.length();
+        results->record.assemble_ns = results->now() - assemble_started;
+    }
+
+    const std::vector<std::string> &names = batch.variables();
+    std::vector<std::vector<int>> columns(names.size());
+    std::vector<const int *> column_ptrs(names.size());
+    for (size_t slot = 0; slot < names.size(); slot++)
+    {
+        int col = -1;
+        for (size_t c = 0; c < bindings.columns.size(); c++)
+            if (bindings.columns[c] == names[slot])
+                col = c;
+
+        if (col != -1)
+        {
+            for (const std::vector<int64_t> &row : bindings.rows)
+                columns[slot].push_back(row[col]);      // Batch programs are 32-bit.
+        }
+        else
+        {
+            auto bound = bindings.values.find(names[slot]);
+            if (bound == bindings.values.end())
+            {
+                out.flush();
+                err << "Error: variable '" << names[slot] << "' has no value, use --bind or --rows." << std::endl;
+                if (results)
+                    results->emit(RESULT_UNBOUND_VARIABLE);
+                return;
+            }
+            columns[slot].assign(bindings.rows.size(), bound->second);
+        }
+        column_ptrs[slot] = columns[slot].data();
+    }
+
+    // Like run_program, an expression without variables is only run once.
+    std::vector<int> values(names.empty() ? 1 : bindings.rows.size());
+    std::vector<std::pair<size_t, ExecutionException>> failures;
+    uint64_t started = results ? results->now() : 0;
+    batch.evaluate(column_ptrs.data(), values.data(), values.size(), &failures);
+    uint64_t per_row = results ? (results->now() - started) / values.size() : 0;
+
+    if (!options.quiet)
+        out << "Program Length: " << batch.length() << " bytes\n";
+    size_t next_failure = 0;
+    for (size_t r = 0; r < values.size(); r++)
+    {
+        if (next_failure < failures.size() && failures[next_failure].first == r)
+        {
+            ExecutionException &e = failures[next_failure++].second;
+            out.flush();
+            err << e.message() << std::endl;
+            if (results)
+                results->emit((ResultStatus)e.get_status(), 0, r, per_row);
+            continue;
+        }
+        if (results)
+            results->emit(RESULT_OK, values[r], r, per_row);
+        if (!options.quiet)
+            out << "Output: ";
+        out << values[r] << '\n';
+    }
+}
+
+// Print and run every expression recovered from the code cache. The output
+// matches a fresh compile exactly, the code tree just comes from the cache.
+void run_cached(std::vector<CachedExpression> &cached, const CompileOptions &options,
+    OutputBuffer &out, std::ostream &err, ResultWriter *results)
+{
+    for (size_t i = 0; i < cached.size(); i++)
+    {
+        if (results)
+        {
+            results->begin(i);
+            results->record.code_size = cached[i].code_length;
+        }
+
+        if (!options.quiet)
+        {
+            out << "EXPRESSION #" << i << '\n';
+            out << "Code Tree:" << '\n';
+            out << cached[i].tree_text;
+            out << '\n';
+        }
+        EncodedProgram prog(cached[i].code, cached[i].code_length, cached[i].variables, options.mode,
+            cached[i].traps);
+        Stats::instance().add_expression(prog.length());
+
+        PhaseTimer execute_timer(Phase::EXECUTE, i);
+        run_program(prog, options, out, err, results);
+        execute_timer.stop();
+
+        if (!options.quiet)
+            out << '\n';
+    }
+}
+
+// With --stats, print the summary to stderr and write the JSON report
+// (if asked for) once the run is over.
+void report_stats(const char *json_path)
+{
+    Stats &stats = Stats::instance();
+    if (!stats.enabled)
+        return;
+
+    stats.print_summary(std::cerr);
+    if (json_path != nullptr)
+    {
+        std::ofstream json(json_path);
+        if (json)
+            stats.write_json(json);
+        else
+            std::cerr << "Warning: could not write stats to " << json_path << std::endl;
+    }
+}
+
+// Fill in a record's source span from the tokens [first, end) of an
+// expression, from the start of the first token to the end of the last.
+void set_span(ResultRecord &record, const std::vector<Token> &tokens, int first, int end)
+{
+    if (first < 0 || end <= first || (size_t)end > tokens.size())
+        return;
+
+    const Token &last = tokens[end - 1];
+    record.first_line = tokens[first].line;
+    record.first_column = tokens[first].column;
+    record.end_line = last.line;
+    record.end_column = last.column + std::max<size_t>(1, last.length);
+}
+
+/**
+ * Print, assemble and run one parsed expression: everything ncc prints for
+ * it after its "EXPRESSION #i" line. Deletes the tree when done, and returns
+ * false if it couldn't be assembled.
+ *
+ * With --quiet nothing but the results is printed, so the tree is only
+ * printed (to 'tree_text', which is reused between calls) when it's going
+ * in the code cache: with 'to_cache', the program's code and printed tree
+ * are kept aside there before execute() releases the code.
+ *
+ * With 'memo', an expression compiled before (in the same file) isn't
+ * assembled again, and a new one is added to the memo once assembled.
+ */
+bool compile_expression(tree_gen &parse_tree, Node *head, size_t i, const CompileOptions &options,
+    OutputBuffer &out, std::ostream &err, ResultWriter *results, OutputBuffer &tree_text,
+    std::vector<CachedExpression> *to_cache = nullptr, std::vector<std::string> *code_copies = nullptr,
+    ExpressionMemo *memo = nullptr)
+{
+    if (!options.quiet || to_cache)
+    {
+        PhaseTimer print_timer(Phase::PRINT, i);
+        tree_text.clear();
+        parse_tree.print_tree_pretty(head, 0, tree_text);
+
+        if (!options.quiet)
+        {
+            out << "Code Tree:" << '\n';
+            out << tree_text.str();
+            out << '\n';
+        }
+        print_timer.stop();
+    }
+
+    if (options.vector && !options.bindings.rows.empty())
+    {
+        PhaseTimer execute_timer(Phase::EXECUTE, i);
+        run_batch(head, options, out, err, results);
+        execute_timer.stop();
+        if (!options.quiet)
+            out << '\n';
+        parse_tree.delete_tree(head);
+        return true;
+    }
+
+    ExpressionMemo::Entry *memo_entry = memo ? memo->find(head) : nullptr;
+    if (memo_entry)
+    {
+        Stats::instance().add_expression(memo_entry->program.length());
+        if (results)
+            results->record.code_size = memo_entry->program.length();
+
+        PhaseTimer execute_timer(Phase::EXECUTE, i);
+        run_program(memo_entry->program, options, out, err, results, memo_entry);
+        execute_timer.stop();
+
+        if (!options.quiet)
+            out << '\n';
+        parse_tree.delete_tree(head);
+        return true;
+    }
+
+    ExecutionTier expression_tier = options.tier;
+    if (options.auto_tier && parse_tree.count_nodes(head) < INTERPRET_BELOW_NODES)
+        expression_tier = ExecutionTier::INTERPRETER;
+
+    // The printed tree (and the memo's key) is the one parsed, the program is
+    // built from the rebalanced one. Only machine code has dependency chains
+    // to shorten: the interpreter does one operation at a time whatever the
+    // shape, and batch programs are busy with the other rows meanwhile.
+    if (options.reassociate && expression_tier == ExecutionTier::JIT)
+        Stats::instance().count(Stats::instance().chains_rebalanced, reassociate(head));
+
+    PhaseTimer assemble_timer(Phase::ASSEMBLE, i);
+    uint64_t assemble_started = results ? results->now() : 0;
+    EncodedProgram prog(head, expression_tier, options.mode, options.share_subexpressions);
+    try
+    {
+        if (options.optimize)
+            prog.optimize_with(&PassManager::standard());
+        prog.assemble();
+        assemble_timer.stop();
+        Stats::instance().add_expression(prog.length());
+        if (options.share_subexpressions || options.optimize)
+        {
+            Stats &stats = Stats::instance();
+            stats.count(stats.shared_nodes, prog.nodes_eliminated());
+            stats.count(stats.shared_bytes_removed, prog.bytes_removed());
+            stats.count(stats.shared_bytes_added, prog.bytes_added());
+        }
+        if (results)
+        {
+            results->record.code_size = prog.length();
+            results->record.assemble_ns = results->now() - assemble_started;
+        }
+    }
+    catch (ParseException &e)
+    {
+        out.flush();
+        err << e.message() << endl;
+        if (results)
+            results->emit(RESULT_ASSEMBLY_ERROR);
+        prog.release();
+        if (!options.quiet)
+            out << '\n';
+        parse_tree.delete_tree(head);
+        return false;
+    }
+
+    if (to_cache)
+    {
+        code_copies->push_back(std::string((const char *)prog.code(), prog.length()));
+        to_cache->push_back({nullptr, (uint32_t)prog.length(), tree_text.str(), prog.variables(), prog.traps()});
+    }
+
+    PhaseTimer execute_timer(Phase::EXECUTE, i);
+    if (memo)
+    {
+        memo_entry = memo->insert(prog);
+        run_program(memo_entry->program, options, out, err, results, memo_entry);
+        if (memo_entry->known)
+            memo->forget_code(memo_entry);
+    }
+    else
+    {
+        run_program(prog, options, out, err, results);
+    }
+    execute_timer.stop();
+
+    if (!options.quiet)
+        out << '\n';
+
+    parse_tree.delete_tree(head);
+    return true;
+}
+
+/**
+ * Compile and run every expression in one source file: look it up in the
+ * code cache, otherwise lex, parse, print, assemble and run each expression
+ * (storing the result in the cache if asked). Program output goes to 'out'
+ * and diagnostics to 'err', so batch mode can keep each file's text together.
+ *
+ * With 'results', every result and error is also written there as a binary
+ * record. With 'source_text', the source comes from memory (as in a request
+ * to the compile server) and 'src_file' only names it.
+ */
+void compile_file(const char *src_file, const CompileOptions &options,
+    OutputBuffer &out, std::ostream &err, FileResult &result,
+    ResultWriter *results = nullptr, const std::string *source_text = nullptr)
+{
+    // On a warm cache, the front end is skipped entirely.
+    struct stat src_stat;
+    if (source_text != nullptr)
+    {
+        result.source_bytes = source_text->size();
+        Stats::instance().count(Stats::instance().source_bytes, source_text->size());
+    }
+    else if (stat(src_file, &src_stat) == 0)
+    {
+        result.source_bytes = src_stat.st_size;
+        Stats::instance().count(Stats::instance().source_bytes, src_stat.st_size);
+    }
+
+    ArithmeticMode mode = options.mode;
+    bool use_cache = options.use_cache;
+
+    CodeCache cache;
+    PhaseTimer cache_timer(Phase::CACHE);
+    if (use_cache && (source_text ? cache.load_text(*source_text) : cache.load_source(src_file)))
+    {
+        // The arithmetic mode, sharing, optimising and rebalancing change the code, so they're part of the key.
+        cache.add_key(std::string(mode.wide ? "int64" : "int32") + (mode.check_overflow ? "/checked" : "")
+            + (options.share_subexpressions ? "/cse" : "") + (options.optimize ? "/opt" : "")
+            + (options.reassociate ? "/reassoc" : ""));
+
+        std::vector<CachedExpression> cached;
+        if (cache.lookup(cached))
+        {
+            cache_timer.stop();
+            run_cached(cached, options, out, err, results);
+            result.expressions = cached.size();
+            return;
+        }
+    }
+    else
+    {
+        use_cache = false;
     }
+    cache_timer.stop();
 
-    // Initialize the lexer
-    LexerReader reader(argv[1]);
+    // Only a clean compile is worth caching; diagnostics aren't stored.
+    bool &clean_compile = result.clean;
+
+    // Initialize the lexer. A missing file only fails that file in batch mode.
+    std::unique_ptr<LexerReader> reader_owner;
+    std::istringstream text_stream;
+    try
+    {
+        if (source_text != nullptr)
+        {
+            text_stream.str(*source_text);
+            reader_owner.reset(new LexerReader(text_stream));
+        }
+        else
+        {
+            reader_owner.reset(new LexerReader(src_file));
+        }
+    }
+    catch (std::runtime_error &e)
+    {
+        err << e.what();
+        clean_compile = false;
+        result.opened = false;
+        return;
+    }
+    LexerReader &reader = *reader_owner;
     LexerFSM fsm(&reader);
 
     // Read in tokens from the file
+    PhaseTimer lex_timer(Phase::LEX);
     try
     {
         while (reader)
@@ -50,31 +628,59 @@ int main(int argc, char **argv)
     }
     catch (LexicalException &e)
     {
-        std::cout << e.message() << std::endl;
+        out << e.message() << '\n';
+        clean_compile = false;
+        if (results)
+        {
+            results->begin(RESULT_NO_EXPRESSION);
+            results->record.first_line = results->record.end_line = e.position().line;
+            results->record.first_column = results->record.end_column = e.position().column;
+            results->emit(RESULT_LEXICAL_ERROR);
+        }
     }
+    lex_timer.arg("tokens", fsm.tokens.size());
+    lex_timer.stop();
+    Stats::instance().count(Stats::instance().tokens, fsm.tokens.size());
 
-    // Vector of heads to arithmetic expressions.
+    // Vector of heads to arithmetic expressions, and the tokens each one
+    // was parsed from: [first, end).
     std::vector<Node*> expression_heads;
+    std::vector<std::pair<int, int>> expression_tokens;
 
     // Set up the tree generator with our token vector
-    tree_gen parse_tree = tree_gen(fsm.tokens);
+    PhaseTimer parse_timer(Phase::PARSE);
+    tree_gen parse_tree(fsm.tokens);
 
     // While there are still more expressions to create trees from...
     while (!parse_tree.finished())
     {
         // Make a new head and generate a tree from it.
         Node* next_head;
+        TraceSpan expression_span("expression", "parse", expression_heads.size());
+        int first_token = parse_tree.token_position();
+        expression_span.arg("first_token", first_token);
         try
         {
             parse_tree.create_parse_tree(next_head);
             expression_heads.push_back(next_head);
+            expression_tokens.push_back({first_token, parse_tree.token_position()});
+            expression_span.arg("end_token", parse_tree.token_position());
         }
         catch (ParseException &e)
         {   // If an error occurs, we'll either stop and execute what we have, or just explode.
-            std::cerr << e.message() << endl;
+            out.flush();
+            err << e.message() << endl;
+            clean_compile = false;
+            if (results)
+            {
+                // The span runs up to and including the offending token.
+                results->begin(expression_heads.size());
+                set_span(results->record, fsm.tokens, first_token, parse_tree.token_position() + 1);
+                results->emit(RESULT_SYNTAX_ERROR);
+            }
             if (RECOVERY)
             {
-                std::cerr << "Attempting to print and execute any completed expressions up to this point." << "\n\n";
+                err << "Attempting to print and execute any completed expressions up to this point." << "\n\n";
                 break;
             }
             else
@@ -84,29 +690,448 @@ int main(int argc, char **argv)
         }
 
     }
+    parse_timer.stop();
+
+    result.expressions = expression_heads.size();
+    if (Stats::instance().enabled)
+    {
+        for (Node *head : expression_heads)
+            Stats::instance().count(Stats::instance().nodes, parse_tree.count_nodes(head));
+    }
 
     /**
-     * For each tree...
-     *  - Print out it's pretty representation
-     *  - Create an EncodedProgram from the head
-     *  - Assemble the program
-     *  - Execute the program
-     *  - Delete the tree
+     * Print, assemble and run each tree in turn. When caching, each
+     * program's code and printed tree are kept aside to be written out at
+     * the end.
      */
+    std::vector<CachedExpression> to_cache;
+    std::vector<std::string> code_copies;
+    OutputBuffer tree_text;     // Reused for every expression
+
+    // Duplicates are worth remembering, except when every expression's code
+    // is going in the code cache.
+    std::unique_ptr<ExpressionMemo> memo;
+    if (options.memo_entries > 0 && !use_cache)
+        memo.reset(new ExpressionMemo(options.memo_entries));
     for (size_t i = 0; i < expression_heads.size(); i++)
     {
-        cout << "EXPRESSION #" << i << endl;
-        cout << "Code Tree:" << endl;
-        parse_tree.print_tree_pretty(expression_heads[i], 0);
-        cout << endl;
-        EncodedProgram prog(expression_heads[i]);
-        prog.assemble();
-        prog.execute();
+        if (results)
+        {
+            results->begin(i);
+            set_span(results->record, fsm.tokens, expression_tokens[i].first, expression_tokens[i].second);
+        }
 
-        cout << endl;
+        if (!options.quiet)
+            out << "EXPRESSION #" << i << '\n';
+        if (!compile_expression(parse_tree, expression_heads[i], i, options, out, err, results, tree_text,
+                use_cache ? &to_cache : nullptr, use_cache ? &code_copies : nullptr, memo.get()))
+            clean_compile = false;
+    }
 
-        parse_tree.delete_tree(expression_heads[i]);
+    if (use_cache && clean_compile)
+    {
+        PhaseTimer store_timer(Phase::CACHE);
+        for (size_t i = 0; i < to_cache.size(); i++)
+            to_cache[i].code = (const unsigned char *)code_copies[i].data();
+
+        if (!cache.store(to_cache))
+        {
+            out.flush();
+            err << "Warning: failed to write the code cache." << std::endl;
+        }
+    }
+}
+
+/**
+ * Add the files named on the command line to 'files': a directory
+ * contributes every regular file directly inside it, in name order, and
+ * anything else is taken as a file. Returns false for an unreadable directory.
+ */
+bool add_input(const char *path, std::vector<std::string> &files, bool &saw_directory)
+{
+    struct stat path_stat;
+    if (stat(path, &path_stat) != 0 || !S_ISDIR(path_stat.st_mode))
+    {
+        files.push_back(path);
+        return true;
+    }
+
+    saw_directory = true;
+    DIR *dir = opendir(path);
+    if (dir == nullptr)
+        return false;
+
+    std::string prefix(path);
+    if (prefix.back() != '/')
+        prefix += '/';
+
+    std::vector<std::string> entries;
+    while (struct dirent *entry = readdir(dir))
+    {
+        std::string entry_path = prefix + entry->d_name;
+        struct stat entry_stat;
+        if (stat(entry_path.c_str(), &entry_stat) == 0 && S_ISREG(entry_stat.st_mode))
+            entries.push_back(entry_path);
+    }
+    closedir(dir);
+
+    std::sort(entries.begin(), entries.end());
+    files.insert(files.end(), entries.begin(), entries.end());
+    return true;
+}
+
+// Read a --files list, one path per line ("-" reads the list from stdin).
+bool load_file_list(const char *path, std::vector<std::string> &files, bool &saw_directory)
+{
+    std::ifstream list_file;
+    if (strcmp(path, "-") != 0)
+    {
+        list_file.open(path);
+        if (!list_file)
+            return false;
+    }
+    std::istream &list = (strcmp(path, "-") == 0) ? std::cin : list_file;
+
+    std::string line;
+    while (std::getline(list, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty() && !add_input(line.c_str(), files, saw_directory))
+            std::cerr << "Warning: could not read directory " << line << std::endl;
+    }
+    return true;
+}
+
+// Write a file's buffered diagnostics with its path in front of each line.
+void print_diagnostics(const std::string &path, const std::string &diagnostics)
+{
+    std::stringstream lines(diagnostics);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        if (line.empty())
+            std::cerr << '\n';
+        else
+            std::cerr << path << ": " << line << '\n';
+    }
+}
+
+/**
+ * Batch mode: compile every file on a pool of 'jobs' worker threads. Workers
+ * claim files in order from a shared counter and buffer each file's output
+ * and diagnostics, which the main thread prints in input order as soon as
+ * each file (and every file before it) is done, so the output doesn't depend
+ * on the number of workers. The code arena, code cache directory and
+ * statistics are shared by every worker. Binary result records (if
+ * 'results' is given) are collected and written in the same order.
+ *
+ * Prints a throughput summary to stderr, and returns the number of files
+ * that had errors.
+ */
+size_t compile_files(const std::vector<std::string> &files, const CompileOptions &options, unsigned jobs,
+    OutputBuffer *results)
+{
+    struct Slot
+    {
+        std::string output;
+        std::string diagnostics;
+        std::string records;
+        FileResult result;
+        bool done = false;
+    };
+    std::vector<Slot> slots(files.size());
+    std::mutex lock;
+    std::condition_variable finished;
+    std::atomic<size_t> next_file(0);
+
+    auto start = std::chrono::steady_clock::now();
+
+    auto worker = [&]() {
+        for (size_t i = next_file++; i < files.size(); i = next_file++)
+        {
+            OutputBuffer out;
+            std::ostringstream err;
+            OutputBuffer records;
+            ResultWriter writer(records, options.results_timing);
+            writer.record.file = i;
+            FileResult result;
+            compile_file(files[i].c_str(), options, out, err, result, results ? &writer : nullptr);
+
+            std::lock_guard<std::mutex> guard(lock);
+            slots[i].output = out.take();
+            slots[i].diagnostics = err.str();
+            slots[i].records = records.take();
+            slots[i].result = result;
+            slots[i].done = true;
+            finished.notify_one();
+        }
+    };
+
+    jobs = std::max(1u, std::min<unsigned>(jobs, files.size()));
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < jobs; i++)
+        workers.emplace_back(worker);
+
+    OutputBuffer out(STDOUT_FILENO);
+    size_t failed = 0;
+    uint64_t source_bytes = 0;
+    size_t expressions = 0;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        Slot slot;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            finished.wait(guard, [&]() {return slots[i].done;});
+            std::swap(slot, slots[i]);
+        }
+
+        if (!options.quiet)
+            out << "==> " << files[i] << " <==" << '\n';
+        out << slot.output;
+        if (results)
+            results->write(slot.records.data(), slot.records.size());
+        if (!slot.diagnostics.empty())
+        {
+            out.flush();
+            print_diagnostics(files[i], slot.diagnostics);
+        }
+
+        failed += !slot.result.clean;
+        source_bytes += slot.result.source_bytes;
+        expressions += slot.result.expressions;
+    }
+
+    out.flush();
+    for (std::thread &thread : workers)
+        thread.join();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (seconds <= 0)
+        seconds = 1e-9;
+
+    char summary[256];
+    snprintf(summary, sizeof(summary),
+        "Batch: %zu files (%zu with errors), %zu expressions, %llu bytes in %.3f s on %u threads: "
+        "%.1f files/s, %.2f MB/s\n",
+        files.size(), failed, expressions, (unsigned long long)source_bytes, seconds, jobs,
+        files.size() / seconds, source_bytes / seconds / 1e6);
+    std::cerr << summary;
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> src_files;     // Files, directories, --files list
+    bool batch = false;             // More than one file, a directory or a list
+    unsigned jobs = std::thread::hardware_concurrency();    // --jobs/-j N: batch workers
+    CompileOptions options;
+    const char *tier_name = "jit";  // --tier=jit|interp|auto: how expressions are executed.
+    Bindings &bindings = options.bindings;
+    ArithmeticMode &mode = options.mode;
+    const char *stats_json = nullptr;   // --stats, --perf, --stats-json file
+    const char *serve = nullptr;        // --serve socket|-: run as a compile server
+    const char *results_path = nullptr; // --results file: binary result records
+    bool bad_usage = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--cache") == 0)
+            options.use_cache = true;
+        else if (strcmp(argv[i], "--quiet") == 0 || strcmp(argv[i], "-q") == 0)
+            options.quiet = true;
+        else if (strcmp(argv[i], "--vector") == 0)
+            options.vector = true;
+        else if (strcmp(argv[i], "--int64") == 0)
+            mode.wide = true;
+        else if (strcmp(argv[i], "--checked") == 0)
+            mode.check_overflow = true;
+        else if (strcmp(argv[i], "--cse") == 0)
+            options.share_subexpressions = true;
+        else if (strcmp(argv[i], "--reassociate") == 0)
+            options.reassociate = true;
+        else if (strcmp(argv[i], "--optimize") == 0)
+            options.optimize = true;
+        else if (strcmp(argv[i], "--check-encoder") == 0)
+            exit(X86Assembler::self_check(std::cerr) ? 0 : 1);
+        else if (strcmp(argv[i], "--stats") == 0)
+            Stats::instance().enabled = true;
+        else if (strcmp(argv[i], "--perf") == 0)
+        {
+            // Hardware counters go in the --stats report, so they imply it.
+            Stats::instance().enabled = true;
+            Stats::instance().perf = true;
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            Tracer::instance().start(argv[++i]);
+        else if (strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc)
+        {
+            Stats::instance().enabled = true;
+            stats_json = argv[++i];
+        }
+        else if (strncmp(argv[i], "--tier=", 7) == 0)
+            tier_name = argv[i] + 7;
+        else if (strcmp(argv[i], "--bind") == 0 && i + 1 < argc && strchr(argv[i + 1], '='))
+        {
+            std::string binding(argv[++i]);
+            size_t equals = binding.find('=');
+            bindings.values[binding.substr(0, equals)] = atoll(binding.c_str() + equals + 1);
+        }
+        else if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc)
+        {
+            if (!load_rows(argv[++i], bindings))
+            {
+                std::cerr << "Failed to read rows from " << argv[i] << std::endl;
+                exit(1);
+            }
+        }
+        else if ((strcmp(argv[i], "--jobs") == 0 || strcmp(argv[i], "-j") == 0) && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            jobs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--memo") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 0)
+            options.memo_entries = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--results") == 0 && i + 1 < argc)
+            results_path = argv[++i];
+        else if (strcmp(argv[i], "--results-timing") == 0)
+            options.results_timing = true;
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+            serve = argv[++i];
+        else if (strcmp(argv[i], "--files") == 0 && i + 1 < argc)
+        {
+            batch = true;
+            if (!load_file_list(argv[++i], src_files, batch))
+            {
+                std::cerr << "Failed to read the file list " << argv[i] << std::endl;
+                exit(1);
+            }
+        }
+        else if (argv[i][0] != '-')
+        {
+            if (!add_input(argv[i], src_files, batch))
+            {
+                std::cerr << "Failed to read directory " << argv[i] << std::endl;
+                exit(1);
+            }
+        }
+        else
+            bad_usage = true;
+    }
+
+    // Usage
+    options.auto_tier = strcmp(tier_name, "auto") == 0;
+    if (strcmp(tier_name, "interp") == 0)
+        options.tier = ExecutionTier::INTERPRETER;
+    else if (strcmp(tier_name, "jit") != 0 && !options.auto_tier)
+        bad_usage = true;
+
+    if (src_files.size() > 1)
+        batch = true;
+
+    if (bad_usage || (src_files.empty() && !batch && serve == nullptr) || (serve != nullptr && !src_files.empty()))
+    {
+        std::cerr << "Usage: ./ncc [--cache] [--tier=jit|interp|auto] [--int64] [--checked] [--cse] [--reassociate] [--optimize] [--memo n] [--bind name=value]... [--rows file [--vector]] [--quiet] [--stats] [--perf] [--stats-json file] [--trace file] [--results file [--results-timing]] [--jobs n] [--files list] src_file|directory..." << std::endl;
+        std::cerr << "       ./ncc [options] [--jobs n] --serve socket|-" << std::endl;
+        std::cerr << "       ./ncc --check-encoder" << std::endl;
+        exit(1);
+    }
+
+    // Without executable memory, everything has to be interpreted.
+    if (options.auto_tier && !EncodedProgram::jit_available())
+    {
+        options.auto_tier = false;
+        options.tier = ExecutionTier::INTERPRETER;
+    }
+
+    // Batch programs only do 32-bit wrap-around arithmetic.
+    if (options.vector && (mode.wide || mode.check_overflow))
+    {
+        std::cerr << "Warning: --vector does not support --int64 or --checked, evaluating row by row." << std::endl;
+        options.vector = false;
+    }
+
+    // Regrouping can move an overflow, or make one disappear.
+    if (options.reassociate && mode.check_overflow)
+    {
+        std::cerr << "Warning: --reassociate does not support --checked, keeping chains as parsed." << std::endl;
+        options.reassociate = false;
+    }
+
+    // Cached code is run in place, so only scalar machine code is worth caching.
+    if (options.use_cache && (options.tier != ExecutionTier::JIT || options.auto_tier || options.vector))
+    {
+        std::cerr << "Warning: --cache requires the scalar JIT tier, not caching." << std::endl;
+        options.use_cache = false;
+    }
+
+    if (serve != nullptr && results_path != nullptr)
+    {
+        std::cerr << "Warning: --results is not supported with --serve, ignoring it." << std::endl;
+        results_path = nullptr;
+    }
+
+    // The header goes first; every file's records follow as they're done.
+    int results_fd = -1;
+    std::unique_ptr<OutputBuffer> results_out;
+    if (results_path != nullptr)
+    {
+        results_fd = open(results_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (results_fd < 0)
+        {
+            perror(results_path);
+            exit(1);
+        }
+        results_out.reset(new OutputBuffer(results_fd));
+        ResultWriter::write_header(*results_out, options.results_timing);
+    }
+
+    if (serve != nullptr)
+    {
+        // Each request is compiled like a file of its own, from memory.
+        // Open documents are compiled an expression at a time, so an edit
+        // only recompiles the expressions it touched.
+        Server server([&options](const std::string &source, OutputBuffer &out, std::ostream &err) {
+            FileResult result;
+            compile_file("<request>", options, out, err, result, nullptr, &source);
+            return result.clean;
+        }, [&options]() {
+            return std::unique_ptr<IncrementalDocument>(new IncrementalDocument(
+                [&options](tree_gen &parse_tree, Node *head, OutputBuffer &out, std::ostream &err) {
+                    OutputBuffer tree_text;
+                    return compile_expression(parse_tree, head, 0, options, out, err, nullptr, tree_text);
+                }, !options.quiet));
+        }, jobs);
+
+        int status = (strcmp(serve, "-") == 0) ? server.serve_stdio() : server.serve_socket(serve);
+        report_stats(stats_json);
+        return status;
+    }
+
+    if (batch)
+    {
+        size_t failed = compile_files(src_files, options, jobs, results_out.get());
+        if (results_out)
+        {
+            results_out.reset();    // Flushes
+            close(results_fd);
+        }
+        report_stats(stats_json);
+        return failed ? 1 : 0;
+    }
+
+    OutputBuffer out(STDOUT_FILENO);
+    FileResult result;
+    std::unique_ptr<ResultWriter> writer;
+    if (results_out)
+        writer.reset(new ResultWriter(*results_out, options.results_timing));
+    compile_file(src_files[0].c_str(), options, out, std::cerr, result, writer.get());
+    out.flush();
+    if (results_out)
+    {
+        results_out.reset();
+        close(results_fd);
     }
+    if (!result.opened)
+        return 1;
 
+    report_stats(stats_json);
     return 0;
 }
\ No newline at end of file
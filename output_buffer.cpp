@@ -0,0 +1,97 @@
+#include "output_buffer.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+// "00" through "99", so each division by 100 produces two digits at once.
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+OutputBuffer::OutputBuffer(int fd)
+    : fd(fd)
+{
+    // Room for a full block plus the write that overflows it.
+    buffer.reserve(BLOCK_SIZE * 2);
+}
+
+OutputBuffer::OutputBuffer()
+    : fd(-1)
+{
+}
+
+OutputBuffer::~OutputBuffer()
+{
+    flush();
+}
+
+OutputBuffer& OutputBuffer::operator<<(unsigned long long value)
+{
+    char digits[20];
+    char* end = digits + sizeof(digits);
+    char* start = end;
+
+    while (value >= 100)
+    {
+        unsigned pair = (value % 100) * 2;
+        value /= 100;
+        *--start = digit_pairs[pair + 1];
+        *--start = digit_pairs[pair];
+    }
+    if (value >= 10)
+    {
+        *--start = digit_pairs[value * 2 + 1];
+        *--start = digit_pairs[value * 2];
+    }
+    else
+    {
+        *--start = '0' + value;
+    }
+
+    write(start, end - start);
+    return *this;
+}
+
+OutputBuffer& OutputBuffer::operator<<(long long value)
+{
+    if (value < 0)
+    {
+        buffer.push_back('-');
+        // Negate as unsigned so the most negative value survives.
+        return *this << (0ULL - (unsigned long long)value);
+    }
+    return *this << (unsigned long long)value;
+}
+
+void OutputBuffer::flush()
+{
+    if (fd < 0)
+        return;
+
+    size_t written = 0;
+    while (written < buffer.size())
+    {
+        ssize_t n = ::write(fd, buffer.data() + written, buffer.size() - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;      // Nowhere left to write to (a closed pipe); drop it.
+        written += n;
+    }
+    buffer.clear();
+}
+
+std::string OutputBuffer::take()
+{
+    std::string taken;
+    taken.swap(buffer);
+    return taken;
+}
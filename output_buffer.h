@@ -0,0 +1,91 @@
+/**
+ * @file output_buffer.h
+ * @author Jake Rogers (z1826513)
+ * @brief A small buffered writer for everything ncc prints: code trees,
+ * program lengths and results.
+ *
+ * Going through std::cout with std::endl flushes (a write system call) on
+ * every line, which dominates the run time once a file has millions of
+ * expressions. An OutputBuffer collects text in one block that is reused
+ * for the whole run and hands it to write(2) once it passes BLOCK_SIZE, so
+ * printing costs a memcpy and the occasional system call. Integers are
+ * formatted by hand, two digits at a time, without locales or allocation.
+ *
+ * A buffer built without a file descriptor keeps everything in memory
+ * instead, for batch mode and the compile server, which collect each
+ * file's or request's output before sending it on.
+ *
+ * Nothing is written until flush() (or the destructor) unless the block
+ * fills up, so anything written to stderr in between can overtake it; flush
+ * first when the order matters.
+ */
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+class OutputBuffer
+{
+public:
+    // Write to 'fd' a block at a time.
+    explicit OutputBuffer(int fd);
+
+    // Collect everything in memory, see str() and take().
+    OutputBuffer();
+
+    // Flushes whatever is left.
+    ~OutputBuffer();
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    inline void write(const char* data, size_t length)
+    {
+        buffer.append(data, length);
+        if (fd >= 0 && buffer.size() >= BLOCK_SIZE)
+            flush();
+    }
+
+    inline OutputBuffer& operator<<(char c)
+    {
+        buffer.push_back(c);
+        if (fd >= 0 && buffer.size() >= BLOCK_SIZE)
+            flush();
+        return *this;
+    }
+
+    inline OutputBuffer& operator<<(const char* text) {write(text, strlen(text)); return *this;}
+    inline OutputBuffer& operator<<(const std::string& text) {write(text.data(), text.size()); return *this;}
+    inline OutputBuffer& operator<<(std::string_view text) {write(text.data(), text.size()); return *this;}
+
+    OutputBuffer& operator<<(long long value);
+    OutputBuffer& operator<<(unsigned long long value);
+    inline OutputBuffer& operator<<(int value) {return *this << (long long)value;}
+    inline OutputBuffer& operator<<(long value) {return *this << (long long)value;}
+    inline OutputBuffer& operator<<(unsigned value) {return *this << (unsigned long long)value;}
+    inline OutputBuffer& operator<<(unsigned long value) {return *this << (unsigned long long)value;}
+
+    // Write out everything buffered so far. Does nothing for an in-memory
+    // buffer.
+    void flush();
+
+    // Everything an in-memory buffer has collected.
+    const std::string& str() const {return buffer;}
+
+    // Hand over what an in-memory buffer has collected and start again empty.
+    std::string take();
+
+    // Forget what's buffered, keeping the memory for reuse.
+    void clear() {buffer.clear();}
+
+    static const size_t BLOCK_SIZE = 65536;
+
+private:
+    int fd;                 // -1 for an in-memory buffer
+    std::string buffer;
+};
+
+#endif
@@ -25,16 +25,23 @@ public:
     std::string message()
     {
         char error_msg[1024];
-        sprintf(error_msg, "Parse Error: %s | ID = %d @ %d:%d '%c'", msg.c_str(),
+        snprintf(error_msg, sizeof(error_msg), "Parse Error: %s | ID = %d @ %d:%d '%c'", msg.c_str(),
             bad_token.id, bad_token.line, bad_token.column, bad_token.id);
-        
-        if (!bad_token.value.empty())
+        std::string text(error_msg);
+
+        // Values can be any length (a string running to the end of the file).
+        if (bad_token.text != 0)
+        {
+            text += " -> (";
+            text += bad_token.value();
+            text += ")";
+        }
+        else if (bad_token.id == TypeID::INTEGER)
         {
-            char value_extension[128];
-            sprintf(value_extension, " -> (%s)", bad_token.value.c_str());
-            strcat(error_msg, value_extension);
+            // Numbers keep only their value.
+            text += " -> (" + std::to_string(bad_token.i_value) + ")";
         }
-        return std::string(error_msg);
+        return text;
     }
 
 private:
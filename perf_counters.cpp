@@ -0,0 +1,115 @@
+#include "perf_counters.h"
+
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const char* event_names[PERF_EVENT_COUNT] = {
+    "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses"
+};
+
+// Fill in the type and config perf_event_open wants for one of our events.
+static void describe_event(int event, perf_event_attr& attr)
+{
+    switch (event)
+    {
+    case PERF_CYCLES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case PERF_INSTRUCTIONS:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case PERF_BRANCH_MISSES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    case PERF_L1D_MISSES:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case PERF_LLC_MISSES:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    }
+}
+
+PerfCounters& PerfCounters::for_thread()
+{
+    thread_local PerfCounters counters;
+    return counters;
+}
+
+PerfCounters::PerfCounters()
+{
+    for (int event = 0; event < PERF_EVENT_COUNT; event++)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        describe_event(event, attr);
+        attr.exclude_kernel = 1;    // Allowed at perf_event_paranoid <= 2
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // pid 0, cpu -1: this thread, on whichever CPU it runs.
+        int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+        if (fd == -1)
+        {
+            if (open_error.empty())
+                open_error = std::string(event_names[event]) + ": " + strerror(errno);
+            continue;
+        }
+
+        if (leader == -1)
+            leader = fd;
+        fds[members] = fd;
+        order[members++] = event;
+        mask |= 1u << event;
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+    for (int i = 0; i < members; i++)
+        close(fds[i]);
+}
+
+bool PerfCounters::read(PerfSample& sample)
+{
+    sample.mask = 0;
+    if (leader == -1)
+        return false;
+
+    // nr, time_enabled, time_running, then one value per member.
+    uint64_t buffer[3 + PERF_EVENT_COUNT];
+    if (::read(leader, buffer, sizeof(buffer)) < (ssize_t)(3 * sizeof(uint64_t)))
+        return false;
+
+    uint64_t enabled = buffer[1];
+    uint64_t running = buffer[2];
+    for (uint64_t i = 0; i < buffer[0] && i < (uint64_t)members; i++)
+    {
+        uint64_t value = buffer[3 + i];
+
+        // If the kernel had to multiplex the PMU, scale up to an estimate
+        // for the whole time the group was enabled.
+        if (running != 0 && running < enabled)
+            value = (uint64_t)((double)value * enabled / running);
+        sample.values[order[i]] = value;
+    }
+
+    sample.mask = mask;
+    return true;
+}
+
+const char* PerfCounters::event_name(int event)
+{
+    return event_names[event];
+}
@@ -0,0 +1,71 @@
+/**
+ * @file perf_counters.h
+ * @author Jake Rogers (z1826513)
+ * @brief Hardware performance counters for the calling thread, read through
+ * perf_event_open(2).
+ *
+ * Each thread gets its own group of counters (cycles, instructions, branch
+ * misses, L1D read misses and LLC misses), opened the first time that thread
+ * asks for them. PhaseTimer samples the group at both ends of a phase, so
+ * with --perf every phase reports the hardware events it caused alongside its
+ * wall and CPU time.
+ *
+ * Counters aren't always there: virtual machines often have no PMU, and
+ * kernel.perf_event_paranoid may forbid them. Any event which fails to open
+ * is simply left out of the group (and reported as n/a), and if none open at
+ * all a sample is just marked empty. Nothing here ever throws.
+ */
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <string>
+
+enum PerfEvent
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_EVENT_COUNT
+};
+
+// Running totals of every event since the group was opened. Bit 'e' of
+// 'mask' is set if event 'e' is actually being counted.
+struct PerfSample
+{
+    uint64_t values[PERF_EVENT_COUNT] = {};
+    unsigned mask = 0;
+};
+
+class PerfCounters
+{
+public:
+    // The counters for the calling thread, opened on first use.
+    static PerfCounters& for_thread();
+
+    // Fill 'sample' with the current totals. Returns false (and leaves the
+    // mask empty) if no counters could be opened for this thread.
+    bool read(PerfSample& sample);
+
+    bool available() const {return leader != -1;}
+
+    // Why the first event failed to open, if it did.
+    const std::string& error() const {return open_error;}
+
+    static const char* event_name(int event);
+
+private:
+    PerfCounters();
+    ~PerfCounters();
+
+    int leader = -1;                    // Group leader's fd, -1 if nothing opened
+    int fds[PERF_EVENT_COUNT];          // Every member's fd, leader first
+    int order[PERF_EVENT_COUNT];        // Event of each group member, in read order
+    int members = 0;
+    unsigned mask = 0;
+    std::string open_error;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "reassociate.h"
+
+#include <vector>
+
+#include "token.h"
+
+// A binary '+' or '*' node, which can take part in a chain.
+static bool is_associative(Node *n)
+{
+    return (n->token.id == '+' || n->token.id == '*') && n->child != nullptr
+        && n->child->sibling != nullptr && n->child->sibling->sibling == nullptr;
+}
+
+// Rebuild operands[low, high) as a balanced tree, taking operator nodes from
+// 'operators' in order. The first one taken is the root.
+static Node *balance(std::vector<Node *> &operators, size_t &next_operator, std::vector<Node *> &operands,
+    size_t low, size_t high)
+{
+    if (high - low == 1)
+        return operands[low];
+
+    Node *op = operators[next_operator++];
+    size_t middle = low + (high - low) / 2;
+    Node *left = balance(operators, next_operator, operands, low, middle);
+    Node *right = balance(operators, next_operator, operands, middle, high);
+    op->child = left;
+    left->sibling = right;
+    right->sibling = nullptr;
+    return op;
+}
+
+size_t reassociate(Node *head)
+{
+    if (!is_associative(head))
+    {
+        size_t rebalanced = 0;
+        for (Node *child = head->child; child != nullptr; child = child->sibling)
+            rebalanced += reassociate(child);
+        return rebalanced;
+    }
+
+    // Gather the chain's operators and its operands in left-to-right order.
+    // Left-deep chains are as long as the expression, so this uses a stack of
+    // its own rather than recursing.
+    char op = head->token.id;
+    std::vector<Node *> operators;
+    std::vector<Node *> operands;
+    std::vector<Node *> pending = {head};
+    while (!pending.empty())
+    {
+        Node *n = pending.back();
+        pending.pop_back();
+        if (n->token.id == op && is_associative(n))
+        {
+            operators.push_back(n);
+            pending.push_back(n->child->sibling);
+            pending.push_back(n->child);
+        }
+        else
+        {
+            operands.push_back(n);
+        }
+    }
+
+    size_t rebalanced = 0;
+    for (Node *operand : operands)
+        rebalanced += reassociate(operand);
+    if (operands.size() < REASSOCIATE_MIN_OPERANDS)
+        return rebalanced;
+
+    // The head stays the root, so whatever points at it (and its sibling) is
+    // still right.
+    size_t next_operator = 0;
+    balance(operators, next_operator, operands, 0, operands.size());
+    return rebalanced + 1;
+}
@@ -0,0 +1,38 @@
+/**
+ * @file reassociate.h
+ * @author Jake Rogers (z1826513)
+ * @brief Rebalances long chains of '+' or '*' in a parse tree.
+ *
+ * tree_gen parses "a + b + c + d" left-associatively, into a left-deep tree
+ * whose code is one serial chain: every addition waits for the one before.
+ * Both operators are associative in wrap-around (two's complement)
+ * arithmetic, so a chain of them can be regrouped into a balanced tree,
+ * "(a + b) + (c + d)", which gives the same result with a dependency chain
+ * log2(n) long instead of n, letting the CPU overlap the independent halves.
+ *
+ * The operands keep their left-to-right order, so variables still get their
+ * slots in order of first appearance, and any error is reported for the
+ * same token as before. Checked arithmetic isn't associative (regrouping can
+ * move or remove an overflow), so this is only for unchecked programs.
+ */
+#ifndef REASSOCIATE_H
+#define REASSOCIATE_H
+
+#include <cstddef>
+
+#include "node.h"
+
+// Chains with fewer operands than this are left as they are, since
+// rebalancing them wouldn't shorten them.
+#define REASSOCIATE_MIN_OPERANDS 4
+
+/**
+ * @brief Rebalance every chain of REASSOCIATE_MIN_OPERANDS or more '+' or
+ * '*' operands in the expression rooted at 'head' (its children, but not its
+ * siblings), in place. Only existing nodes are reused, none are allocated.
+ *
+ * @return The number of chains rebalanced.
+ */
+size_t reassociate(Node *head);
+
+#endif
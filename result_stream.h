@@ -0,0 +1,139 @@
+/**
+ * @file result_stream.h
+ * @author Jake Rogers (z1826513)
+ * @brief A binary stream of results, for programs consuming ncc's output
+ * without parsing text.
+ *
+ * With --results file, every result (and every error) ncc reports is also
+ * written as a fixed-size ResultRecord, in the same order the text output
+ * gives them. The file is a ResultStreamHeader followed by records and
+ * nothing else, in native byte order, so a reader can mmap it and index
+ * records directly: record i lives at sizeof(ResultStreamHeader) +
+ * i * header.record_size. Records are appended as results complete (in
+ * blocks, see OutputBuffer) and a block only ever holds whole records, so a
+ * file that's still being written can be read up to its current size.
+ *
+ * Fields are only ever added to the end of a record, so readers should step
+ * by header.record_size rather than sizeof(ResultRecord).
+ */
+#ifndef RESULT_STREAM_H
+#define RESULT_STREAM_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+#include "output_buffer.h"
+
+#define RESULT_STREAM_MAGIC "NCCRSLT"     // Plus the terminating NUL, 8 bytes
+#define RESULT_STREAM_VERSION 1
+
+// The record's timing fields are filled in (--results-timing).
+#define RESULT_STREAM_TIMING 0x1
+
+// What a record reports. The runtime statuses match ExecutionStatus.
+enum ResultStatus
+{
+    RESULT_OK = 0,                  // 'value' is the result
+    RESULT_OVERFLOW = 1,            // Checked arithmetic overflowed
+    RESULT_DIVIDE_BY_ZERO = 2,
+    RESULT_DIVISION_OVERFLOW = 3,   // The most negative value divided by -1
+    RESULT_UNBOUND_VARIABLE = 16,   // A variable had no --bind or --rows value
+    RESULT_ASSEMBLY_ERROR = 17,     // The expression couldn't be assembled
+    RESULT_SYNTAX_ERROR = 18,       // The expression couldn't be parsed
+    RESULT_LEXICAL_ERROR = 19       // The file couldn't be lexed past the span
+};
+
+// The expression index of a record not tied to an expression (lexical errors).
+#define RESULT_NO_EXPRESSION 0xffffffffu
+
+struct ResultStreamHeader
+{
+    char magic[8];              // RESULT_STREAM_MAGIC
+    uint32_t version;           // RESULT_STREAM_VERSION
+    uint32_t record_size;       // Bytes per record
+    uint32_t flags;             // RESULT_STREAM_*
+    uint32_t reserved;
+};
+
+struct ResultRecord
+{
+    uint32_t file;              // Index of the source file in batch mode, else 0
+    uint32_t expression;        // Index of the expression within its file
+    uint32_t row;               // --rows row the result is for, else 0
+    uint32_t code_size;         // Bytes of code, 0 if never assembled
+    uint32_t status;            // ResultStatus
+    uint16_t first_line;        // Source span: where the expression's first
+    uint16_t first_column;      // token starts...
+    uint16_t end_line;          // ...and where its last token ends. All zero
+    uint16_t end_column;        // when unknown (results from the code cache).
+    uint32_t reserved;
+    int64_t value;              // The result, if status is RESULT_OK
+    uint64_t assemble_ns;       // With RESULT_STREAM_TIMING, else 0
+    uint64_t execute_ns;        // Ditto. Per row, even for --vector.
+};
+
+static_assert(sizeof(ResultStreamHeader) == 24, "ResultStreamHeader must not change size");
+static_assert(sizeof(ResultRecord) == 56, "ResultRecord must not change size");
+
+/**
+ * Writes records to an OutputBuffer. 'record' holds the fields common to
+ * everything about to be written (the file, the expression and its span,
+ * the code size and assembly time); each emit() fills in the rest and
+ * appends a copy.
+ */
+class ResultWriter
+{
+public:
+    ResultWriter(OutputBuffer &out, bool timing)
+        : timing(timing), out(out)
+    {
+        memset(&record, 0, sizeof(record));
+    }
+
+    static void write_header(OutputBuffer &out, bool timing)
+    {
+        ResultStreamHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, RESULT_STREAM_MAGIC, sizeof(header.magic));
+        header.version = RESULT_STREAM_VERSION;
+        header.record_size = sizeof(ResultRecord);
+        header.flags = timing ? RESULT_STREAM_TIMING : 0;
+        out.write((const char *)&header, sizeof(header));
+    }
+
+    // Start on a new expression: clears everything but the file index.
+    void begin(uint32_t expression)
+    {
+        uint32_t file = record.file;
+        memset(&record, 0, sizeof(record));
+        record.file = file;
+        record.expression = expression;
+    }
+
+    void emit(ResultStatus status, int64_t value = 0, uint32_t row = 0, uint64_t execute_ns = 0)
+    {
+        record.status = status;
+        record.value = value;
+        record.row = row;
+        record.execute_ns = execute_ns;
+        out.write((const char *)&record, sizeof(record));
+    }
+
+    // Nanosecond timestamps for the timing fields; always 0 without timing.
+    uint64_t now() const
+    {
+        if (!timing)
+            return 0;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    ResultRecord record;
+    const bool timing;
+
+private:
+    OutputBuffer &out;
+};
+
+#endif
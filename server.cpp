@@ -0,0 +1,498 @@
+#include "server.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <exception>
+#include <sstream>
+
+#include "stats.h"
+
+// Set by SIGINT/SIGTERM while a socket server is running.
+static volatile sig_atomic_t stop_signal = 0;
+
+static void on_stop_signal(int)
+{
+    stop_signal = 1;
+}
+
+LatencyHistogram::LatencyHistogram()
+    : total(0), largest(0)
+{
+    for (std::atomic<uint64_t>& bucket_count : counts)
+        bucket_count.store(0, std::memory_order_relaxed);
+}
+
+// Values below SUB_BUCKETS get a bucket each; above that, every power of two
+// is split into SUB_BUCKETS equal buckets.
+int LatencyHistogram::bucket(uint64_t nanoseconds)
+{
+    if (nanoseconds < SUB_BUCKETS)
+        return nanoseconds;
+
+    int exponent = 63 - __builtin_clzll(nanoseconds);   // At least 4
+    int sub = (nanoseconds >> (exponent - 4)) & (SUB_BUCKETS - 1);
+    return (exponent - 3) * SUB_BUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::bucket_limit(int bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+
+    int exponent = bucket / SUB_BUCKETS + 3;
+    uint64_t sub = bucket % SUB_BUCKETS;
+    uint64_t lower = (SUB_BUCKETS + sub) << (exponent - 4);
+    return lower + ((uint64_t)1 << (exponent - 4)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds)
+{
+    counts[bucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t seen = largest.load(std::memory_order_relaxed);
+    while (nanoseconds > seen && !largest.compare_exchange_weak(seen, nanoseconds, std::memory_order_relaxed))
+        ;
+}
+
+uint64_t LatencyHistogram::percentile(double fraction) const
+{
+    uint64_t recorded = count();
+    if (recorded == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(fraction * recorded + 0.999999);
+    if (rank == 0)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (int b = 0; b < BUCKETS; b++)
+    {
+        seen += counts[b].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return std::min(bucket_limit(b), max());
+    }
+    return max();
+}
+
+Server::Connection::~Connection()
+{
+    if (owned)
+    {
+        close(in_fd);
+        if (out_fd != in_fd)
+            close(out_fd);
+    }
+}
+
+bool Server::Connection::send(const std::string& frame)
+{
+    std::lock_guard<std::mutex> guard(write_lock);
+    size_t written = 0;
+    while (!broken && written < frame.size())
+    {
+        ssize_t n = write(out_fd, frame.data() + written, frame.size() - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            broken = true;      // The client went away; drop its replies.
+        else
+            written += n;
+    }
+    return !broken;
+}
+
+Server::Server(Handler handler, DocumentFactory new_document, unsigned worker_count)
+    : handler(handler), new_document(new_document), shutdown_requested(false), in_flight(0), failed(0)
+{
+    // A client hanging up mid-reply must not kill the server.
+    signal(SIGPIPE, SIG_IGN);
+
+    if (worker_count == 0)
+        worker_count = 1;
+    for (unsigned i = 0; i < worker_count; i++)
+        workers.emplace_back(&Server::work, this);
+}
+
+Server::~Server()
+{
+    stop_workers();
+}
+
+void Server::stop_workers()
+{
+    {
+        std::lock_guard<std::mutex> guard(queue_lock);
+        stopping = true;
+    }
+    queue_ready.notify_all();
+
+    for (std::thread& worker : workers)
+        worker.join();
+    workers.clear();
+}
+
+int Server::serve_stdio()
+{
+    read_requests(std::make_shared<Connection>(STDIN_FILENO, STDOUT_FILENO, false));
+    stop_workers();
+    return 0;
+}
+
+int Server::serve_socket(const char* path)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        std::cerr << "Socket path is too long: " << path << std::endl;
+        return 1;
+    }
+    strcpy(address.sun_path, path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+    {
+        perror("socket");
+        return 1;
+    }
+
+    unlink(path);   // A socket left behind by a server that didn't exit cleanly
+    if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+    {
+        perror(path);
+        close(listener);
+        return 1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_stop_signal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    // Poll with a timeout rather than blocking in accept(), since a signal
+    // or a shutdown request may well arrive on some other thread.
+    while (!stop_signal && !shutdown_requested)
+    {
+        pollfd listening = {listener, POLLIN, 0};
+        if (poll(&listening, 1, 100) <= 0)
+            continue;
+
+        int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0)
+            continue;
+
+        std::shared_ptr<Connection> connection = std::make_shared<Connection>(client, client, true);
+        {
+            std::lock_guard<std::mutex> guard(readers_lock);
+            std::vector<std::weak_ptr<Connection>> live;
+            for (std::weak_ptr<Connection>& known : connections)
+                if (!known.expired())
+                    live.push_back(known);
+            live.push_back(connection);
+            connections.swap(live);
+            active_readers++;
+        }
+
+        std::thread([this, connection]() {
+            read_requests(connection);
+            std::lock_guard<std::mutex> guard(readers_lock);
+            active_readers--;
+            readers_done.notify_all();
+        }).detach();
+    }
+
+    close(listener);
+    unlink(path);
+
+    // Stop reading from every client (their replies still go out), wait for
+    // the readers to notice, then answer whatever they queued.
+    {
+        std::unique_lock<std::mutex> guard(readers_lock);
+        for (std::weak_ptr<Connection>& known : connections)
+            if (std::shared_ptr<Connection> connection = known.lock())
+                shutdown(connection->in_fd, SHUT_RD);
+        readers_done.wait(guard, [this]() {return active_readers == 0;});
+    }
+    stop_workers();
+    return 0;
+}
+
+void Server::read_requests(std::shared_ptr<Connection> connection)
+{
+    std::string buffer;
+    size_t start = 0;       // Start of the unparsed part of buffer
+
+    auto fill = [&]() {
+        buffer.erase(0, start);
+        start = 0;
+
+        char chunk[65536];
+        ssize_t n;
+        do
+            n = read(connection->in_fd, chunk, sizeof(chunk));
+        while (n < 0 && errno == EINTR);
+
+        if (n <= 0)
+            return false;
+        buffer.append(chunk, n);
+        return true;
+    };
+
+    auto protocol_error = [&](const char* message) {
+        connection->send(reply("-", "protocol", "", std::string(message) + "\n"));
+    };
+
+    while (!shutdown_requested)
+    {
+        size_t newline;
+        while ((newline = buffer.find('\n', start)) == std::string::npos)
+        {
+            if (buffer.size() - start > 256)
+                return protocol_error("Request header too long.");
+            if (!fill())
+                return;
+        }
+
+        std::string header = buffer.substr(start, newline - start);
+        start = newline + 1;
+        if (!header.empty() && header.back() == '\r')
+            header.pop_back();
+        if (header.empty())
+            continue;       // Blank lines between frames are harmless.
+
+        char verb[16];
+        char id[65];
+        unsigned long long length;
+        int header_length = 0;
+        if (sscanf(header.c_str(), "%15s %64s %llu%n", verb, id, &length, &header_length) != 3
+            || header_length != (int)header.size())
+            return protocol_error("Malformed request header, expected '<verb> <id> <length>'.");
+        if (length > SERVER_MAX_BODY)
+            return protocol_error("Request body too large.");
+
+        while (buffer.size() - start < length)
+        {
+            if (!fill())
+                return protocol_error("Connection closed in the middle of a request body.");
+        }
+
+        Job job;
+        job.received = std::chrono::steady_clock::now();
+        job.connection = connection;
+        job.id = id;
+        job.verb = verb;
+        job.body = buffer.substr(start, length);
+        start += length;
+
+        if (job.verb == "shutdown")
+        {
+            shutdown_requested = true;
+            connection->send(reply(job.id, "ok", "", ""));
+            break;
+        }
+        if (job.verb == "open" || job.verb == "edit" || job.verb == "close")
+        {
+            // Edits to a document must apply in the order they were sent.
+            connection->send(handle_document(job));
+            latencies.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - job.received).count());
+            continue;
+        }
+        if (job.verb != "eval" && job.verb != "stats")
+        {
+            connection->send(reply(job.id, "unknown", "", "Unknown verb '" + job.verb + "'.\n"));
+            continue;
+        }
+
+        in_flight++;
+        std::unique_lock<std::mutex> guard(queue_lock);
+        queue_space.wait(guard, [this]() {return queue.size() < SERVER_MAX_QUEUED;});
+        queue.push_back(std::move(job));
+        guard.unlock();
+        queue_ready.notify_one();
+    }
+}
+
+void Server::work()
+{
+    while (true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> guard(queue_lock);
+            queue_ready.wait(guard, [this]() {return stopping || !queue.empty();});
+            if (queue.empty())
+                return;     // Stopping, and nothing left to answer
+            job = std::move(queue.front());
+            queue.pop_front();
+        }
+        queue_space.notify_one();
+        handle(job);
+    }
+}
+
+void Server::handle(Job& job)
+{
+    std::string frame;
+    if (job.verb == "stats")
+    {
+        frame = reply(job.id, "ok", instrumentation(), "");
+    }
+    else
+    {
+        OutputBuffer out;
+        std::ostringstream err;
+        bool clean;
+        try
+        {
+            clean = handler(job.body, out, err);
+        }
+        catch (const char* message)     // Allocation failures in the code generator
+        {
+            err << message << "\n";
+            clean = false;
+        }
+        catch (const std::exception& e)
+        {
+            err << "Error: " << e.what() << "\n";
+            clean = false;
+        }
+        catch (...)
+        {
+            err << "Error: the request could not be handled.\n";
+            clean = false;
+        }
+
+        if (!clean)
+            failed++;
+        frame = reply(job.id, clean ? "ok" : "error", out.take(), err.str());
+    }
+
+    job.connection->send(frame);
+    latencies.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - job.received).count());
+    in_flight--;
+}
+
+std::string Server::handle_document(Job& job)
+{
+    std::map<std::string, std::unique_ptr<IncrementalDocument>>& documents = job.connection->documents;
+    size_t newline = job.body.find('\n');
+    std::string line = job.body.substr(0, newline);
+    std::string rest = (newline == std::string::npos) ? "" : job.body.substr(newline + 1);
+
+    char name[65];
+    size_t offset = 0, removed = 0;
+    int line_length = 0;
+    bool well_formed;
+    if (job.verb == "edit")
+        well_formed = sscanf(line.c_str(), "%64s %zu %zu%n", name, &offset, &removed, &line_length) == 3;
+    else
+        well_formed = sscanf(line.c_str(), "%64s%n", name, &line_length) == 1;
+    if (!well_formed || line_length != (int)line.size())
+        return reply(job.id, "invalid", "", "Malformed " + job.verb + " request.\n");
+
+    if (job.verb == "close")
+    {
+        if (documents.erase(name) == 0)
+            return reply(job.id, "invalid", "", std::string("No open document '") + name + "'.\n");
+        return reply(job.id, "ok", "", "");
+    }
+
+    OutputBuffer out;
+    std::ostringstream err;
+    IncrementalDocument* document;
+    try
+    {
+        if (job.verb == "open")
+        {
+            std::unique_ptr<IncrementalDocument>& slot = documents[name];
+            slot = new_document();
+            document = slot.get();
+            document->load(rest);
+        }
+        else
+        {
+            auto found = documents.find(name);
+            if (found == documents.end())
+                return reply(job.id, "invalid", "", std::string("No open document '") + name + "'.\n");
+            document = found->second.get();
+            if (!document->edit(offset, removed, rest))
+                return reply(job.id, "invalid", "", "Edit is outside the document.\n");
+        }
+
+        document->write_output(out, err);
+    }
+    catch (const char* message)
+    {
+        err << message << "\n";
+        document = nullptr;
+    }
+    catch (const std::exception& e)
+    {
+        err << "Error: " << e.what() << "\n";
+        document = nullptr;
+    }
+    catch (...)
+    {
+        err << "Error: the request could not be handled.\n";
+        document = nullptr;
+    }
+
+    if (document == nullptr)
+    {
+        // Whatever state it was left in can't be trusted for the next edit.
+        documents.erase(name);
+        err << "Document '" << name << "' was closed.\n";
+        failed++;
+        return reply(job.id, "error", "", err.str());
+    }
+
+    if (!document->clean())
+        failed++;
+    return reply(job.id, document->clean() ? "ok" : "error", out.take(), err.str());
+}
+
+std::string Server::instrumentation()
+{
+    std::ostringstream out;
+    char line[128];
+
+    out << "requests " << latencies.count() << "\n";
+    out << "failed " << failed.load() << "\n";
+    out << "in_flight " << in_flight.load() << "\n";
+
+    static const struct {const char* name; double fraction;} percentiles[] = {
+        {"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}, {"p999", 0.999}};
+    for (const auto& p : percentiles)
+    {
+        snprintf(line, sizeof(line), "latency_%s_us %.1f\n", p.name, latencies.percentile(p.fraction) / 1e3);
+        out << line;
+    }
+    snprintf(line, sizeof(line), "latency_max_us %.1f\n", latencies.max() / 1e3);
+    out << line;
+
+    if (Stats::instance().enabled)
+        Stats::instance().print_summary(out);
+    return out.str();
+}
+
+std::string Server::reply(const std::string& id, const char* status,
+    const std::string& output, const std::string& diagnostics)
+{
+    std::string frame = id + " " + status + " " + std::to_string(output.size()) + " "
+        + std::to_string(diagnostics.size()) + "\n";
+    frame.reserve(frame.size() + output.size() + diagnostics.size());
+    frame += output;
+    frame += diagnostics;
+    return frame;
+}
@@ -0,0 +1,196 @@
+/**
+ * @file server.h
+ * @author Jake Rogers (z1826513)
+ * @brief A long-running compile server, so tools that need many small
+ * compiles pay for process startup (and cold caches) once instead of per
+ * request.
+ *
+ * The server speaks a small framed protocol over a Unix domain socket (one
+ * connection per client) or over stdin/stdout. Every frame is a header line
+ * followed by a body of exactly the length the header gives:
+ *
+ *   request:  <verb> <id> <length>\n<body>
+ *   reply:    <id> <status> <output length> <diagnostics length>\n<output><diagnostics>
+ *
+ * Verbs:
+ *   eval      The body is ncc source. The reply's output is exactly what
+ *             ncc would print for it, and its diagnostics what ncc would
+ *             print to stderr. Status is "ok", or "error" if the source had
+ *             lexical, syntax or assembly errors.
+ *   stats     No body. The output is the server's instrumentation: requests
+ *             served, requests in flight and latency percentiles, followed
+ *             by the --stats summary if stats are enabled.
+ *   shutdown  No body. Stops the server once the requests already received
+ *             are answered. Over stdio, the end of input does the same.
+ *
+ * For editors, a connection can also keep documents open and send edits to
+ * them instead of whole files (see IncrementalDocument). Each reply carries
+ * what eval would for the document's whole current text; only the work
+ * near the edit is redone. Documents belong to their connection and are
+ * dropped when it closes. These requests are answered on the connection's
+ * reader, in order, rather than by the workers.
+ *   open      The body is "<name>\n<source>". Opens (or replaces) the
+ *             document <name> (up to 64 bytes, no whitespace).
+ *   edit      The body is "<name> <offset> <removed>\n<inserted>": replace
+ *             <removed> bytes at byte <offset> of the document with the
+ *             rest of the body.
+ *   close     The body is "<name>". Forgets the document.
+ * A request naming a document that isn't open, or an edit outside it, gets
+ * status "invalid". If a document can't be brought up to date at all (the
+ * compiler failed rather than the source), the reply is "error" with the
+ * reason, and the document is closed.
+ *
+ * Ids are chosen by the client and echoed back untouched (up to 64 bytes,
+ * no whitespace). Requests are pipelined: a client may send any number
+ * before reading a reply, and since requests are handled concurrently by a
+ * pool of workers, replies come back in completion order, not request
+ * order. A malformed frame gets one reply with id "-" and status
+ * "protocol", after which the connection is closed.
+ */
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "output_buffer.h"
+#include "incremental.h"
+
+// Largest request body accepted, to keep a bad client from exhausting memory.
+#define SERVER_MAX_BODY (64u << 20)
+
+// Requests queued for the workers before readers stop reading, which pushes
+// back on clients through their socket buffers.
+#define SERVER_MAX_QUEUED 4096
+
+/**
+ * A histogram of request latencies, log-linear so it covers nanoseconds to
+ * minutes in a fixed 8KB with at most 1/16 relative error per bucket.
+ * Recording is one relaxed atomic increment, so every worker can record
+ * without a lock.
+ */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(uint64_t nanoseconds);
+
+    // The latency below which 'fraction' (0 to 1) of the recorded requests
+    // fell, in nanoseconds. Reports the upper edge of its bucket.
+    uint64_t percentile(double fraction) const;
+
+    uint64_t count() const {return total.load(std::memory_order_relaxed);}
+    uint64_t max() const {return largest.load(std::memory_order_relaxed);}
+
+private:
+    static const int SUB_BUCKETS = 16;  // Per power of two
+    static const int BUCKETS = 64 * SUB_BUCKETS;
+
+    static int bucket(uint64_t nanoseconds);
+    static uint64_t bucket_limit(int bucket);
+
+    std::atomic<uint64_t> counts[BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> largest;
+};
+
+class Server
+{
+public:
+    // Compile 'source', writing what ncc would print to 'out' and 'err'.
+    // Returns false if the source had errors. Called from several worker
+    // threads at once.
+    typedef std::function<bool(const std::string& source, OutputBuffer& out, std::ostream& err)> Handler;
+
+    // Creates the documents for open requests.
+    typedef std::function<std::unique_ptr<IncrementalDocument>()> DocumentFactory;
+
+    Server(Handler handler, DocumentFactory new_document, unsigned workers);
+    ~Server();
+
+    // Serve one client over stdin/stdout until the end of stdin.
+    int serve_stdio();
+
+    // Listen on a Unix domain socket at 'path', serving every client that
+    // connects, until a shutdown request, SIGINT or SIGTERM.
+    int serve_socket(const char* path);
+
+private:
+    // One client. Replies from several workers are written under its lock,
+    // so they never interleave; the descriptor is closed when the last
+    // request holding the connection is done with it.
+    struct Connection
+    {
+        Connection(int in_fd, int out_fd, bool owned) : in_fd(in_fd), out_fd(out_fd), owned(owned) {}
+        ~Connection();
+
+        bool send(const std::string& frame);
+
+        int in_fd;
+        int out_fd;
+        bool owned;         // Close the descriptors when done
+        std::mutex write_lock;
+        bool broken = false;
+
+        // Open documents, only ever touched by the connection's reader.
+        std::map<std::string, std::unique_ptr<IncrementalDocument>> documents;
+    };
+
+    struct Job
+    {
+        std::shared_ptr<Connection> connection;
+        std::string id;
+        std::string verb;
+        std::string body;
+        std::chrono::steady_clock::time_point received;
+    };
+
+    // Read and queue requests from one client until it hangs up.
+    void read_requests(std::shared_ptr<Connection> connection);
+
+    // Answer everything queued, then stop the workers.
+    void stop_workers();
+
+    void work();
+    void handle(Job& job);
+    std::string handle_document(Job& job);
+    std::string instrumentation();
+
+    static std::string reply(const std::string& id, const char* status,
+        const std::string& output, const std::string& diagnostics);
+
+    Handler handler;
+    DocumentFactory new_document;
+
+    std::mutex queue_lock;
+    std::condition_variable queue_ready;
+    std::condition_variable queue_space;
+    std::deque<Job> queue;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    // Socket clients, so their readers can be woken up on shutdown.
+    std::mutex readers_lock;
+    std::condition_variable readers_done;
+    std::vector<std::weak_ptr<Connection>> connections;
+    size_t active_readers = 0;
+
+    std::atomic<bool> shutdown_requested;
+    std::atomic<uint64_t> in_flight;
+    std::atomic<uint64_t> failed;
+    LatencyHistogram latencies;
+};
+
+#endif
@@ -0,0 +1,322 @@
+#include "stats.h"
+
+#include <cstdio>
+#include <ctime>
+#include <sys/resource.h>
+
+static const char* phase_names[(int)Phase::COUNT] = {
+    "lex", "parse", "print", "assemble", "execute", "cache"
+};
+
+Stats& Stats::instance()
+{
+    static Stats singleton;
+    return singleton;
+}
+
+void Stats::add_phase(Phase phase, uint64_t wall_ns, uint64_t cpu_ns)
+{
+    phase_wall_ns[(int)phase].fetch_add(wall_ns, std::memory_order_relaxed);
+    phase_cpu_ns[(int)phase].fetch_add(cpu_ns, std::memory_order_relaxed);
+    phase_calls[(int)phase].fetch_add(1, std::memory_order_relaxed);
+}
+
+void Stats::add_phase_events(Phase phase, const PerfSample& start, const PerfSample& end)
+{
+    unsigned mask = start.mask & end.mask;
+    for (int e = 0; e < PERF_EVENT_COUNT; e++)
+    {
+        if (mask & (1u << e))
+            phase_events[(int)phase][e].fetch_add(end.values[e] - start.values[e], std::memory_order_relaxed);
+    }
+    events_counted.fetch_or(mask, std::memory_order_relaxed);
+}
+
+void Stats::add_expression(uint64_t bytes)
+{
+    if (!enabled)
+        return;
+
+    std::lock_guard<std::mutex> guard(expression_lock);
+    code_bytes.push_back(bytes);
+}
+
+void Stats::add_pass(const char* name, uint64_t wall_ns, uint64_t changes, uint64_t removed)
+{
+    if (!enabled)
+        return;
+
+    std::lock_guard<std::mutex> guard(pass_lock);
+    for (PassTotals &totals : passes)
+    {
+        if (totals.name == name)
+        {
+            totals.runs++;
+            totals.wall_ns += wall_ns;
+            totals.changes += changes;
+            totals.removed += removed;
+            return;
+        }
+    }
+    passes.push_back({name, 1, wall_ns, changes, removed});
+}
+
+void Stats::sample_events(PerfSample& sample)
+{
+    PerfCounters& counters = PerfCounters::for_thread();
+    if (counters.read(sample))
+        return;
+
+    // Say why once per run, rather than once per phase.
+    if (!perf_warned.exchange(true))
+    {
+        std::cerr << "Warning: hardware counters unavailable";
+        if (!counters.error().empty())
+            std::cerr << " (" << counters.error() << ")";
+        std::cerr << ", reporting times only." << std::endl;
+    }
+}
+
+const char* Stats::phase_name(Phase phase)
+{
+    return phase_names[(int)phase];
+}
+
+uint64_t Stats::thread_cpu_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+long Stats::peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;     // Kilobytes on Linux
+}
+
+// Rate per second of 'amount' over 'ns' nanoseconds, or 0 if nothing was timed.
+static double per_second(uint64_t amount, uint64_t ns)
+{
+    return (ns == 0) ? 0.0 : amount * 1e9 / ns;
+}
+
+// Instructions per cycle, or 0 if either wasn't counted.
+static double ipc(uint64_t instructions, uint64_t cycles)
+{
+    return (cycles == 0) ? 0.0 : (double)instructions / cycles;
+}
+
+void Stats::print_events(std::ostream& out)
+{
+    char line[256];
+    unsigned counted = events_counted.load();
+
+    if (counted == 0)
+    {
+        out << "hardware counters: unavailable" << std::endl;
+        return;
+    }
+
+    snprintf(line, sizeof(line), "%-10s %14s %14s %6s %12s %12s %12s", "phase",
+        "cycles", "instructions", "IPC", "br-misses", "L1D-misses", "LLC-misses");
+    out << line << std::endl;
+    for (int p = 0; p < (int)Phase::COUNT; p++)
+    {
+        if (phase_calls[p].load() == 0)
+            continue;
+
+        // Each event column, or n/a if that event couldn't be opened.
+        char columns[PERF_EVENT_COUNT][24];
+        for (int e = 0; e < PERF_EVENT_COUNT; e++)
+        {
+            if (counted & (1u << e))
+                snprintf(columns[e], sizeof(columns[e]), "%llu", (unsigned long long)phase_events[p][e].load());
+            else
+                snprintf(columns[e], sizeof(columns[e]), "n/a");
+        }
+
+        char ipc_column[16] = "n/a";
+        if ((counted & (1u << PERF_CYCLES)) && (counted & (1u << PERF_INSTRUCTIONS)))
+            snprintf(ipc_column, sizeof(ipc_column), "%.2f",
+                ipc(phase_events[p][PERF_INSTRUCTIONS].load(), phase_events[p][PERF_CYCLES].load()));
+
+        snprintf(line, sizeof(line), "%-10s %14s %14s %6s %12s %12s %12s", phase_names[p],
+            columns[PERF_CYCLES], columns[PERF_INSTRUCTIONS], ipc_column,
+            columns[PERF_BRANCH_MISSES], columns[PERF_L1D_MISSES], columns[PERF_LLC_MISSES]);
+        out << line << std::endl;
+    }
+}
+
+void Stats::print_summary(std::ostream& out)
+{
+    char line[256];
+    uint64_t total_wall = 0;
+    uint64_t total_cpu = 0;
+
+    out << "---- ncc stats ----" << std::endl;
+    snprintf(line, sizeof(line), "%-10s %8s %14s %14s", "phase", "calls", "wall ms", "cpu ms");
+    out << line << std::endl;
+    for (int p = 0; p < (int)Phase::COUNT; p++)
+    {
+        uint64_t calls = phase_calls[p].load();
+        if (calls == 0)
+            continue;
+
+        total_wall += phase_wall_ns[p].load();
+        total_cpu += phase_cpu_ns[p].load();
+        snprintf(line, sizeof(line), "%-10s %8llu %14.3f %14.3f", phase_names[p], (unsigned long long)calls,
+            phase_wall_ns[p].load() / 1e6, phase_cpu_ns[p].load() / 1e6);
+        out << line << std::endl;
+    }
+    snprintf(line, sizeof(line), "%-10s %8s %14.3f %14.3f", "total", "", total_wall / 1e6, total_cpu / 1e6);
+    out << line << std::endl;
+
+    if (perf)
+        print_events(out);
+
+    uint64_t lex_ns = phase_wall_ns[(int)Phase::LEX].load();
+    uint64_t total_code = 0;
+    for (uint64_t bytes : code_bytes)
+        total_code += bytes;
+
+    out << "source bytes:   " << source_bytes.load()
+        << " (" << per_second(source_bytes.load(), lex_ns) / 1e6 << " MB/s lexed)" << std::endl;
+    out << "tokens:         " << tokens.load()
+        << " (" << per_second(tokens.load(), lex_ns) / 1e6 << " M/s lexed)" << std::endl;
+    out << "nodes:          " << nodes.load() << std::endl;
+    out << "expressions:    " << code_bytes.size() << std::endl;
+    out << "code bytes:     " << total_code;
+    if (!code_bytes.empty())
+        out << " (" << (double)total_code / code_bytes.size() << " per expression)";
+    out << std::endl;
+    if (shared_bytes_removed.load() || shared_bytes_added.load())
+    {
+        out << "shared (--cse): " << shared_nodes.load() << " nodes, "
+            << (int64_t)(shared_bytes_removed.load() - shared_bytes_added.load()) << " code bytes eliminated ("
+            << shared_bytes_removed.load() << " removed, " << shared_bytes_added.load() << " added)" << std::endl;
+    }
+    if (!passes.empty())
+    {
+        snprintf(line, sizeof(line), "%-10s %8s %14s %10s %10s", "pass", "runs", "wall ms", "changes", "removed");
+        out << line << std::endl;
+        for (const PassTotals &totals : passes)
+        {
+            snprintf(line, sizeof(line), "%-10s %8llu %14.3f %10llu %10llu", totals.name.c_str(),
+                (unsigned long long)totals.runs, totals.wall_ns / 1e6, (unsigned long long)totals.changes,
+                (unsigned long long)totals.removed);
+            out << line << std::endl;
+        }
+    }
+    if (chains_rebalanced.load())
+        out << "rebalanced:     " << chains_rebalanced.load() << " chains" << std::endl;
+    if (memo_lookups.load())
+    {
+        out << "memo:           " << memo_hits.load() << "/" << memo_lookups.load() << " hits ("
+            << 100.0 * memo_hits.load() / memo_lookups.load() << "%), " << memo_results.load()
+            << " results reused, " << memo_evictions.load() << " evicted" << std::endl;
+    }
+    out << "mmap/munmap:    " << mmap_calls.load() << "/" << munmap_calls.load() << std::endl;
+    out << "peak RSS:       " << peak_rss_kb() << " KB" << std::endl;
+}
+
+void Stats::write_json(std::ostream& out)
+{
+    uint64_t lex_ns = phase_wall_ns[(int)Phase::LEX].load();
+
+    out << "{\"phases\":{";
+    for (int p = 0; p < (int)Phase::COUNT; p++)
+    {
+        out << (p ? "," : "") << "\"" << phase_names[p] << "\":{"
+            << "\"calls\":" << phase_calls[p].load()
+            << ",\"wall_ns\":" << phase_wall_ns[p].load()
+            << ",\"cpu_ns\":" << phase_cpu_ns[p].load();
+
+        // Events which couldn't be counted are left out rather than faked as 0.
+        unsigned counted = events_counted.load();
+        for (int e = 0; e < PERF_EVENT_COUNT; e++)
+        {
+            if (perf && (counted & (1u << e)))
+                out << ",\"" << PerfCounters::event_name(e) << "\":" << phase_events[p][e].load();
+        }
+        if (perf && (counted & (1u << PERF_CYCLES)) && (counted & (1u << PERF_INSTRUCTIONS)))
+            out << ",\"ipc\":" << ipc(phase_events[p][PERF_INSTRUCTIONS].load(), phase_events[p][PERF_CYCLES].load());
+        out << "}";
+    }
+    out << "},";
+
+    out << "\"source_bytes\":" << source_bytes.load()
+        << ",\"bytes_per_second\":" << per_second(source_bytes.load(), lex_ns)
+        << ",\"tokens\":" << tokens.load()
+        << ",\"tokens_per_second\":" << per_second(tokens.load(), lex_ns)
+        << ",\"nodes\":" << nodes.load()
+        << ",\"shared_nodes\":" << shared_nodes.load()
+        << ",\"shared_bytes_removed\":" << shared_bytes_removed.load()
+        << ",\"shared_bytes_added\":" << shared_bytes_added.load()
+        << ",\"chains_rebalanced\":" << chains_rebalanced.load()
+        << ",\"memo_lookups\":" << memo_lookups.load()
+        << ",\"memo_hits\":" << memo_hits.load()
+        << ",\"memo_results\":" << memo_results.load()
+        << ",\"memo_evictions\":" << memo_evictions.load()
+        << ",\"mmap_calls\":" << mmap_calls.load()
+        << ",\"munmap_calls\":" << munmap_calls.load()
+        << ",\"peak_rss_kb\":" << peak_rss_kb()
+        << ",\"hardware_counters\":" << ((perf && events_counted.load() != 0) ? "true" : "false");
+
+    out << ",\"passes\":{";
+    for (size_t i = 0; i < passes.size(); i++)
+    {
+        out << (i ? "," : "") << "\"" << passes[i].name << "\":{"
+            << "\"runs\":" << passes[i].runs
+            << ",\"wall_ns\":" << passes[i].wall_ns
+            << ",\"changes\":" << passes[i].changes
+            << ",\"removed\":" << passes[i].removed << "}";
+    }
+    out << "}";
+
+    out << ",\"code_bytes\":[";
+    for (size_t i = 0; i < code_bytes.size(); i++)
+        out << (i ? "," : "") << code_bytes[i];
+    out << "]}" << std::endl;
+}
+
+PhaseTimer::PhaseTimer(Phase phase, int64_t expression)
+    : span(Stats::phase_name(phase), "phase", expression)
+{
+    this->phase = phase;
+    running = Stats::instance().enabled;
+    if (running)
+    {
+        if (Stats::instance().perf)
+            Stats::instance().sample_events(events_start);
+        wall_start = std::chrono::steady_clock::now();
+        cpu_start = Stats::thread_cpu_ns();
+    }
+}
+
+PhaseTimer::~PhaseTimer()
+{
+    stop();
+}
+
+void PhaseTimer::stop()
+{
+    span.stop();
+    if (!running)
+        return;
+    running = false;
+
+    uint64_t wall = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - wall_start).count();
+    uint64_t cpu = Stats::thread_cpu_ns() - cpu_start;
+
+    Stats& stats = Stats::instance();
+    if (stats.perf)
+    {
+        PerfSample events_end;
+        stats.sample_events(events_end);
+        stats.add_phase_events(phase, events_start, events_end);
+    }
+    stats.add_phase(phase, wall, cpu);
+}
@@ -0,0 +1,173 @@
+/**
+ * @file stats.h
+ * @author Jake Rogers (z1826513)
+ * @brief Instrumentation for the ncc pipeline: where the time goes, and how
+ * much work each phase did.
+ *
+ * Stats is a singleton which collects wall and CPU time per phase (through
+ * PhaseTimer) and a handful of counters: source bytes and tokens lexed,
+ * parse tree nodes allocated, code bytes emitted per expression, what
+ * sharing subexpressions saved (with --cse), how often duplicate
+ * expressions were found in the ExpressionMemo, and mmap calls. With
+ * --optimize it also totals each IR pass's time, changes and instructions
+ * removed. At the end of a run it can print a human-readable summary or a
+ * JSON report, both of which also include the process's peak RSS.
+ *
+ * With --perf, each PhaseTimer also samples the thread's hardware counters
+ * (see perf_counters.h) so every phase gets cycles, instructions, IPC, branch
+ * misses and cache misses of its own.
+ *
+ * Everything checks 'enabled' first, so when --stats isn't given the cost is
+ * one predictable branch per timer or counter. Counters are atomics so they
+ * can be bumped from any thread.
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "perf_counters.h"
+#include "trace.h"
+
+enum class Phase
+{
+    LEX,
+    PARSE,
+    PRINT,
+    ASSEMBLE,
+    EXECUTE,
+    CACHE,
+    COUNT
+};
+
+class Stats
+{
+public:
+    static Stats& instance();
+
+    // Add one timed run of 'phase'.
+    void add_phase(Phase phase, uint64_t wall_ns, uint64_t cpu_ns);
+
+    // Add the hardware events counted during one timed run of 'phase'.
+    void add_phase_events(Phase phase, const PerfSample& start, const PerfSample& end);
+
+    // Record the code size of one assembled expression.
+    void add_expression(uint64_t code_bytes);
+
+    // Add one run of the IR pass 'name' (see ir_passes.h).
+    void add_pass(const char* name, uint64_t wall_ns, uint64_t changes, uint64_t removed);
+
+    inline void count(std::atomic<uint64_t>& counter, uint64_t amount = 1)
+    {
+        if (enabled)
+            counter.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    inline void count_mmap() {count(mmap_calls);}
+    inline void count_munmap() {count(munmap_calls);}
+
+    // Human-readable summary of everything collected.
+    void print_summary(std::ostream& out);
+
+    // The same, as a single JSON object.
+    void write_json(std::ostream& out);
+
+    // Read the calling thread's hardware counters into 'sample' (warning once
+    // if they can't be read).
+    void sample_events(PerfSample& sample);
+
+    // Lower case name of a phase, as used in reports and traces.
+    static const char* phase_name(Phase phase);
+
+    // CPU time used by the calling thread, in nanoseconds.
+    static uint64_t thread_cpu_ns();
+
+    bool enabled = false;
+    bool perf = false;      // Also sample hardware counters (--perf)
+
+    std::atomic<uint64_t> source_bytes{0};
+    std::atomic<uint64_t> tokens{0};
+    std::atomic<uint64_t> nodes{0};
+    std::atomic<uint64_t> shared_nodes{0};          // Tree nodes never compiled thanks to --cse
+    std::atomic<uint64_t> shared_bytes_removed{0};  // The code they'd have taken
+    std::atomic<uint64_t> shared_bytes_added{0};    // Code keeping and reusing shared values
+    std::atomic<uint64_t> chains_rebalanced{0};     // By --reassociate
+    std::atomic<uint64_t> memo_lookups{0};
+    std::atomic<uint64_t> memo_hits{0};             // Of which were duplicates, not assembled again
+    std::atomic<uint64_t> memo_results{0};          // Of those, constant ones not even run again
+    std::atomic<uint64_t> memo_evictions{0};
+    std::atomic<uint64_t> mmap_calls{0};
+    std::atomic<uint64_t> munmap_calls{0};
+
+private:
+    Stats() {}
+
+    // The per-phase hardware event table of print_summary().
+    void print_events(std::ostream& out);
+
+    // Peak resident set size of the process so far, in kilobytes.
+    static long peak_rss_kb();
+
+    std::atomic<uint64_t> phase_wall_ns[(int)Phase::COUNT] = {};
+    std::atomic<uint64_t> phase_cpu_ns[(int)Phase::COUNT] = {};
+    std::atomic<uint64_t> phase_calls[(int)Phase::COUNT] = {};
+    std::atomic<uint64_t> phase_events[(int)Phase::COUNT][PERF_EVENT_COUNT] = {};
+    std::atomic<unsigned> events_counted{0};    // PerfSample mask of every event seen
+    std::atomic<bool> perf_warned{false};
+
+    std::mutex expression_lock;
+    std::vector<uint64_t> code_bytes;   // One entry per assembled expression
+
+    struct PassTotals
+    {
+        std::string name;
+        uint64_t runs;
+        uint64_t wall_ns;
+        uint64_t changes;
+        uint64_t removed;   // Instructions
+    };
+
+    std::mutex pass_lock;
+    std::vector<PassTotals> passes;     // In the order they first ran
+};
+
+/**
+ * Times everything from its construction to its destruction (or stop()) as
+ * one run of a phase:
+ *
+ *     {
+ *         PhaseTimer timer(Phase::LEX);
+ *         ...
+ *     }
+ *
+ * When tracing, the same region is also recorded as a span on the thread's
+ * timeline, tagged with 'expression' if it's about a single expression.
+ */
+class PhaseTimer
+{
+public:
+    PhaseTimer(Phase phase, int64_t expression = -1);
+    ~PhaseTimer();
+
+    // Attach an integer argument to the phase's trace span.
+    void arg(const char* name, int64_t value) {span.arg(name, value);}
+
+    // End the timed region early. Later calls (and the destructor) do nothing.
+    void stop();
+
+private:
+    Phase phase;
+    TraceSpan span;
+    bool running;
+    std::chrono::steady_clock::time_point wall_start;
+    uint64_t cpu_start;
+    PerfSample events_start;
+};
+
+#endif
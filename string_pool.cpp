@@ -0,0 +1,141 @@
+#include "string_pool.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#define INITIAL_INDEX 1024
+#define CHUNK_SIZE (64 * 1024)
+#define CACHE_SIZE 512      // Per thread, a power of two
+
+StringPool& StringPool::instance()
+{
+    // Never destroyed, so it outlives anything still holding a handle at exit.
+    static StringPool *pool = new StringPool();
+    return *pool;
+}
+
+StringPool::StringPool()
+    : count(0), index(INITIAL_INDEX, 0), chunk_used(0), chunk_size(0)
+{
+    memset(entries, 0, sizeof(entries));
+    add(std::string_view(), (uint32_t)hash("", 0));     // Handle 0
+}
+
+uint64_t StringPool::hash(const char *text, size_t length)
+{
+    // Eight bytes per multiply, then the rest in one last word.
+    const uint64_t multiplier = 0x9e3779b97f4a7c15ull;
+    uint64_t h = length * multiplier;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, text + i, 8);
+        h = (h ^ word) * multiplier;
+        h ^= h >> 29;
+    }
+    if (i < length)
+    {
+        uint64_t word = 0;
+        memcpy(&word, text + i, length - i);
+        h = (h ^ word) * multiplier;
+        h ^= h >> 29;
+    }
+    return h ^ (h >> 32);
+}
+
+uint32_t StringPool::intern(std::string_view text)
+{
+    uint64_t text_hash = hash(text.data(), text.size());
+
+    // Names repeat, so most lookups end here, without the lock.
+    struct Cached
+    {
+        uint64_t hash;
+        uint32_t handle;
+    };
+    thread_local Cached cache[CACHE_SIZE] = {};
+    Cached &cached = cache[text_hash & (CACHE_SIZE - 1)];
+    if (cached.hash == text_hash)
+    {
+        const Entry &found = entry(cached.handle);
+        if (found.length == text.size() && memcmp(found.text, text.data(), text.size()) == 0)
+            return cached.handle;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    uint32_t handle = add(text, (uint32_t)text_hash);
+    cached.hash = text_hash;
+    cached.handle = handle;
+    return handle;
+}
+
+uint32_t StringPool::add(std::string_view text, uint32_t text_hash)
+{
+    size_t mask = index.size() - 1;
+    size_t slot = text_hash & mask;
+    for (; index[slot]; slot = (slot + 1) & mask)
+    {
+        const Entry &found = entry(index[slot] - 1);
+        if (found.hash == text_hash && found.length == text.size() && memcmp(found.text, text.data(), text.size()) == 0)
+            return index[slot] - 1;
+    }
+
+    // Refuse rather than run off the end of 'entries'; nothing has been
+    // changed yet, so the pool is still good for the texts it has.
+    if (count == MAX_BLOCKS * BLOCK_SIZE)
+        throw std::length_error("String pool is full: too many distinct names and strings.");
+
+    uint32_t handle = count;
+    if (entries[handle >> BLOCK_BITS] == nullptr)
+        entries[handle >> BLOCK_BITS] = new Entry[BLOCK_SIZE];
+    Entry &added = entries[handle >> BLOCK_BITS][handle & (BLOCK_SIZE - 1)];
+    added.text = store(text);
+    added.length = text.size();
+    added.hash = text_hash;
+    index[slot] = handle + 1;
+    count++;
+
+    // Keep the index under half full so probes stay short.
+    if (count * 2 > index.size())
+        grow();
+    return handle;
+}
+
+const char *StringPool::store(std::string_view text)
+{
+    size_t needed = text.size() + 1;
+    if (chunk_used + needed > chunk_size)
+    {
+        // Anything bigger than a chunk gets one of its own.
+        chunk_size = std::max<size_t>(CHUNK_SIZE, needed);
+        chunks.push_back(new char[chunk_size]);
+        chunk_used = 0;
+    }
+
+    char *stored = chunks.back() + chunk_used;
+    memcpy(stored, text.data(), text.size());
+    stored[text.size()] = '\0';
+    chunk_used += needed;
+    return stored;
+}
+
+void StringPool::grow()
+{
+    index.assign(index.size() * 2, 0);
+    size_t mask = index.size() - 1;
+    for (uint32_t handle = 0; handle < count; handle++)
+    {
+        size_t slot = entry(handle).hash & mask;
+        while (index[slot])
+            slot = (slot + 1) & mask;
+        index[slot] = handle + 1;
+    }
+}
+
+size_t StringPool::size() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return count;
+}
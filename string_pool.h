@@ -0,0 +1,91 @@
+/**
+ * @file string_pool.h
+ * @author Jake Rogers (z1826513)
+ * @brief Interns the text of identifiers and string literals, so tokens and
+ * nodes carry a 32-bit handle instead of a std::string each.
+ *
+ * Every distinct text is stored once, in an arena of large chunks that
+ * never move, and gets a handle: handles are handed out in order from 0
+ * (the empty string), so anything kept per name can live in a plain vector
+ * indexed by handle, and two texts are equal exactly when their handles are.
+ *
+ * There's one pool for the whole process, shared by every lexer, parser and
+ * assembler, and it is thread safe: batch workers and the server's threads
+ * all intern into it. Interning hashes the text (eight bytes at a time)
+ * and first looks in a small cache private to the calling thread; only a
+ * text the thread hasn't seen lately takes the pool's lock. Reading a
+ * handle's text never locks, since stored text never moves.
+ *
+ * Nothing is ever removed, so the pool only grows: it's meant for the
+ * names and strings of source files, which repeat far more than they vary.
+ * Numbers aren't interned, their value is all anyone needs. The pool holds
+ * at most 64M texts; past that, intern() throws std::length_error.
+ */
+#ifndef STRING_POOL_H
+#define STRING_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class StringPool
+{
+public:
+    static StringPool& instance();
+
+    /**
+     * @brief The handle of 'text', adding it to the pool if it's new.
+     * Throws std::length_error if it's new and the pool is full.
+     */
+    uint32_t intern(std::string_view text);
+
+    // The text of a handle, NUL-terminated.
+    std::string_view view(uint32_t handle) const
+    {
+        const Entry &found = entry(handle);
+        return std::string_view(found.text, found.length);
+    }
+
+    // How many distinct texts there are, the empty string included.
+    size_t size() const;
+
+    static uint64_t hash(const char *text, size_t length);
+
+private:
+    StringPool();
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    struct Entry
+    {
+        const char *text;
+        uint32_t length;
+        uint32_t hash;      // The low half of hash(), for growing the index
+    };
+
+    // Entries live in blocks that never move, so reading one needs no lock
+    // while another thread adds more.
+    static const int BLOCK_BITS = 12;
+    static const uint32_t BLOCK_SIZE = 1u << BLOCK_BITS;
+    static const uint32_t MAX_BLOCKS = 1u << 14;     // 64M texts
+
+    const Entry& entry(uint32_t handle) const {return entries[handle >> BLOCK_BITS][handle & (BLOCK_SIZE - 1)];}
+
+    // Everything below is only touched with 'lock' held.
+    uint32_t add(std::string_view text, uint32_t text_hash);
+    const char *store(std::string_view text);
+    void grow();
+
+    mutable std::mutex lock;
+    Entry *entries[MAX_BLOCKS];
+    uint32_t count;
+    std::vector<uint32_t> index;        // Open addressing: handle + 1, 0 when empty
+    std::vector<char *> chunks;         // The arena
+    size_t chunk_used;
+    size_t chunk_size;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#!/bin/sh
+# Regression test: an expression whose code doesn't fit in its program
+# buffer must be refused with a diagnostic, without touching any other
+# program. A 12000-term chain is about 120KB of machine code, more than
+# twice a CodeArena block, so it would overwrite the memoised x+3 right
+# after it if nothing stopped it.
+#
+# Run from the repository root (or with 'make check') after building ncc.
+
+NCC=${NCC:-./ncc}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+failed=0
+
+# x+1, x+2, x+3, the oversized chain, then x+3 again (from the memo).
+awk 'BEGIN {
+    print "x+1"; print "x+2"; print "x+3"
+    line = "100000"
+    for (i = 1; i < 12000; i++)
+        line = line "+100000"
+    print line
+    print "x+3"
+}' > "$dir/chain.txt"
+printf '2\n3\n4\n4\n' > "$dir/expected"
+
+check()
+{
+    name=$1
+    shift
+    "$NCC" "$@" > "$dir/out" 2> "$dir/err"
+    status=$?
+    if [ $status -ne 0 ]; then
+        echo "FAIL $name: exited with status $status"
+        failed=1
+    elif ! grep -q "Expression is too large" "$dir/err"; then
+        echo "FAIL $name: no diagnostic for the oversized expression"
+        failed=1
+    elif ! cmp -s "$dir/out" "$dir/expected"; then
+        echo "FAIL $name: wrong results"
+        diff "$dir/expected" "$dir/out"
+        failed=1
+    else
+        echo "ok   $name"
+    fi
+}
+
+check "jit, memoised" --quiet --memo 2 --bind x=1 "$dir/chain.txt"
+check "interpreter, memoised" --quiet --memo 2 --tier=interp --bind x=1 "$dir/chain.txt"
+check "jit, checked" --quiet --memo 2 --checked --int64 --bind x=1 "$dir/chain.txt"
+check "jit, shared subexpressions" --quiet --memo 2 --cse --bind x=1 "$dir/chain.txt"
+
+# Vectorized batch programs have their own buffer.
+printf 'x\n1\n' > "$dir/rows.txt"
+awk 'BEGIN {
+    print "x+1"; print "x+2"; print "x+3"
+    line = "x"
+    for (i = 1; i < 30000; i++)
+        line = line "+x"
+    print line
+    print "x+3"
+}' > "$dir/chain.txt"
+check "batch" --quiet --vector --rows "$dir/rows.txt" "$dir/chain.txt"
+
+exit $failed
@@ -14,7 +14,9 @@
 #define TOKEN_H
 
 #include <cstdint>
-#include <string>
+#include <string_view>
+
+#include "string_pool.h"
 
 /**
  * For most simple tokens, their ID is equivalent to the
@@ -49,42 +51,54 @@ struct Token {
         this->column = 0;
 
         this->id = -1;
-        this->value = "";
+        this->text = 0;
+        this->length = 0;
     }
 
     Token(uint16_t line, uint16_t column)
     {
-        Token();
         this->line = line;
         this->column = column;
 
         this->id = -1;
-        this->value = "";
+        this->text = 0;
+        this->length = 0;
     }
 
-    Token(std::string one_char_value)
+    Token(std::string_view one_char_value)
     {
         this->line = 0;
         this->column = 0;
-        this->value = one_char_value;
         this->id = one_char_value.front();
+        this->length = 0;
+        setValue(one_char_value);
     }
 
-    Token(std::string value, char id)
+    Token(std::string_view value, char id)
     {
         this->line = 0;
         this->column = 0;
 
-        this->value = value;
         this->id = id;
+        this->length = 0;
+        setValue(value);
     }
     
-    void setContent(std::string value, char id)
+    void setContent(std::string_view value, char id)
     {
-        this->value = value;
+        setValue(value);
         this->id = id;
     }
 
+    // Identifiers, strings and the parser's own tokens have text; it
+    // lives in the StringPool, and the token only keeps its handle.
+    void setValue(std::string_view value)
+    {
+        this->text = StringPool::instance().intern(value);
+    }
+
+    std::string_view value() const {return StringPool::instance().view(text);}
+
 
     char id;
 
@@ -93,9 +107,10 @@ struct Token {
     // < 65k... at least I hope so.
     uint16_t  line;
     uint16_t column;
+    uint16_t length;    // Of an identifier or literal in the source, numbers included
 
-    std::string value;
-    int i_value;
+    uint32_t text;      // StringPool handle; 0 (the empty string) for no text
+    int64_t i_value;    // Literals are lexed as 64 bits, whether or not they're compiled that way.
 };
 
 
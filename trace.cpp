@@ -0,0 +1,149 @@
+#include "trace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+static void flush_at_exit()
+{
+    Tracer::instance().flush();
+}
+
+Tracer& Tracer::instance()
+{
+    static Tracer singleton;
+    return singleton;
+}
+
+void Tracer::start(const char* path)
+{
+    this->path = path;
+    epoch = std::chrono::steady_clock::now();
+    enabled = true;
+
+    // exit() is used for fatal parse errors too, so write the trace from an
+    // exit handler rather than relying on main() returning normally.
+    atexit(flush_at_exit);
+}
+
+uint64_t Tracer::now_ns() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - epoch).count();
+}
+
+Tracer::Buffer& Tracer::thread_buffer()
+{
+    thread_local Buffer* buffer = nullptr;
+    if (buffer == nullptr)
+    {
+        // Owned by the registry, so the events survive the thread exiting.
+        buffer = new Buffer();
+        buffer->events.reserve(1024);
+
+        std::lock_guard<std::mutex> guard(registry_lock);
+        buffer->tid = buffers.size() + 1;
+        buffers.push_back(buffer);
+    }
+    return *buffer;
+}
+
+void Tracer::record(const Event& event)
+{
+    Buffer& buffer = thread_buffer();
+    std::lock_guard<std::mutex> guard(buffer.lock);
+    if (enabled)
+        buffer.events.push_back(event);
+}
+
+void Tracer::flush()
+{
+    // Nothing more is recorded once we start writing.
+    if (!enabled.exchange(false))
+        return;
+
+    std::ofstream out(path);
+    if (!out)
+    {
+        std::cerr << "Warning: could not write trace to " << path << std::endl;
+        return;
+    }
+
+    char line[512];
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" << std::endl;
+    out << "{\"ph\":\"M\",\"pid\":1,\"tid\":0,\"name\":\"process_name\",\"args\":{\"name\":\"ncc\"}}";
+
+    std::lock_guard<std::mutex> guard(registry_lock);
+    for (Buffer* buffer : buffers)
+    {
+        std::lock_guard<std::mutex> buffer_guard(buffer->lock);
+        snprintf(line, sizeof(line),
+            ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":\"%s %u\"}}",
+            buffer->tid, buffer->tid == 1 ? "main" : "thread", buffer->tid);
+        out << line;
+
+        for (const Event& event : buffer->events)
+        {
+            // Chrome wants microseconds; keep the nanoseconds as a fraction.
+            int length = snprintf(line, sizeof(line),
+                ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"name\":\"%s\",\"cat\":\"%s\",\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+                buffer->tid, event.name, event.category, event.start_ns / 1e3, event.duration_ns / 1e3);
+
+            const char* separator = "";
+            if (event.expression >= 0)
+            {
+                length += snprintf(line + length, sizeof(line) - length, "\"expression\":%lld", (long long)event.expression);
+                separator = ",";
+            }
+            for (int i = 0; i < event.args; i++)
+            {
+                length += snprintf(line + length, sizeof(line) - length, "%s\"%s\":%lld",
+                    separator, event.arg_names[i], (long long)event.arg_values[i]);
+                separator = ",";
+            }
+            out << line << "}}";
+        }
+    }
+    out << "\n]}" << std::endl;
+}
+
+TraceSpan::TraceSpan(const char* name, const char* category, int64_t expression)
+{
+    Tracer& tracer = Tracer::instance();
+    running = tracer.enabled;
+    if (running)
+    {
+        event.name = name;
+        event.category = category;
+        event.expression = expression;
+        event.args = 0;
+        event.start_ns = tracer.now_ns();
+    }
+}
+
+TraceSpan::~TraceSpan()
+{
+    stop();
+}
+
+void TraceSpan::arg(const char* name, int64_t value)
+{
+    if (!running || event.args == TRACE_MAX_ARGS)
+        return;
+
+    event.arg_names[event.args] = name;
+    event.arg_values[event.args] = value;
+    event.args++;
+}
+
+void TraceSpan::stop()
+{
+    if (!running)
+        return;
+    running = false;
+
+    Tracer& tracer = Tracer::instance();
+    event.duration_ns = tracer.now_ns() - event.start_ns;
+    tracer.record(event);
+}
@@ -0,0 +1,108 @@
+/**
+ * @file trace.h
+ * @author Jake Rogers (z1826513)
+ * @brief Timeline tracing of the compile pipeline, written out in the Chrome
+ * trace event format (chrome://tracing, ui.perfetto.dev).
+ *
+ * Each TraceSpan records one complete ("X") event: a name, a category, when
+ * it started and how long it took, the expression it belongs to (if any) and
+ * up to two integer arguments. Events go into a buffer owned by the thread
+ * that recorded them, guarded by a lock of its own which nothing else takes
+ * until the trace is written, so recording never waits. Buffers outlive
+ * their threads and are all written out together when the process exits,
+ * possibly while batch or server workers are still running: 'enabled' is
+ * atomic, and a span which ends after the trace is written is dropped.
+ *
+ * When tracing isn't enabled a TraceSpan costs one branch.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define TRACE_MAX_ARGS 2
+
+class Tracer
+{
+public:
+    static Tracer& instance();
+
+    // Start recording. The trace is written to 'path' when the process exits.
+    void start(const char* path);
+
+    // Nanoseconds since start().
+    uint64_t now_ns() const;
+
+    struct Event
+    {
+        const char* name;           // Names and categories must be string literals,
+        const char* category;       // they're only written out at exit.
+        uint64_t start_ns;
+        uint64_t duration_ns;
+        int64_t expression;         // -1 if the span isn't about one expression
+        int args;
+        const char* arg_names[TRACE_MAX_ARGS];
+        int64_t arg_values[TRACE_MAX_ARGS];
+    };
+
+    // Append an event to the calling thread's buffer, unless the trace has
+    // been written already.
+    void record(const Event& event);
+
+    // Write every thread's events to the trace file. Called at exit.
+    void flush();
+
+    std::atomic<bool> enabled{false};
+
+private:
+    Tracer() {}
+
+    struct Buffer
+    {
+        uint32_t tid;
+        std::mutex lock;                // Only contended by flush()
+        std::vector<Event> events;
+    };
+
+    Buffer& thread_buffer();
+
+    std::chrono::steady_clock::time_point epoch;
+    std::string path;
+
+    std::mutex registry_lock;           // Guards 'buffers' (not their contents)
+    std::vector<Buffer*> buffers;
+};
+
+/**
+ * Records everything from its construction to its destruction (or stop())
+ * as one span on the calling thread's timeline:
+ *
+ *     {
+ *         TraceSpan span("parse", "parse", expression);
+ *         span.arg("first_token", first);
+ *         ...
+ *     }
+ */
+class TraceSpan
+{
+public:
+    TraceSpan(const char* name, const char* category = "ncc", int64_t expression = -1);
+    ~TraceSpan();
+
+    // Attach an integer argument (at most TRACE_MAX_ARGS, the rest are dropped).
+    void arg(const char* name, int64_t value);
+
+    // End the span early. Later calls (and the destructor) do nothing.
+    void stop();
+
+private:
+    bool running;
+    Tracer::Event event;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include "trap_handler.h"
+
+#include <cstring>
+#include <ucontext.h>
+
+// The Scope of the program running on this thread, if it can fault.
+static thread_local TrapHandler::Scope *running = nullptr;
+
+// What SIGFPE did before us, put back for faults which aren't ours.
+static struct sigaction previous;
+
+TrapHandler& TrapHandler::instance()
+{
+    static TrapHandler handler;
+    return handler;
+}
+
+TrapHandler::TrapHandler()
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = handle;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGFPE, &action, &previous);
+}
+
+TrapHandler::Scope::Scope(const unsigned char *code, int length, const std::vector<TrapSite> &sites, bool wide,
+    ExecutionStatus *status)
+    : code(code), length(length), sites(sites), wide(wide), status(status), outer(running)
+{
+    TrapHandler::instance();
+    running = this;
+}
+
+TrapHandler::Scope::~Scope()
+{
+    running = outer;
+}
+
+const TrapSite* TrapHandler::find(const std::vector<TrapSite> &sites, uint32_t offset)
+{
+    // Called from the signal handler too, so nothing which might allocate.
+    size_t low = 0;
+    size_t high = sites.size();
+    while (low < high)
+    {
+        size_t middle = (low + high) / 2;
+        if (sites[middle].offset < offset)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return (low < sites.size() && sites[low].offset == offset) ? &sites[low] : nullptr;
+}
+
+void TrapHandler::handle(int signal, siginfo_t *info, void *context)
+{
+    greg_t *regs = ((ucontext_t *)context)->uc_mcontext.gregs;
+    uintptr_t rip = regs[REG_RIP];
+
+    Scope *scope = running;
+    const TrapSite *site = nullptr;
+    if (scope != nullptr && rip >= (uintptr_t)scope->code && rip < (uintptr_t)scope->code + scope->length)
+        site = find(scope->sites, rip - (uintptr_t)scope->code);
+
+    if (site == nullptr)
+    {
+        // Not a division we emitted. Fault again the way we would have: a
+        // real fault happens again on return, one sent by kill() must be
+        // sent again.
+        sigaction(SIGFPE, &previous, nullptr);
+        if (info->si_code <= 0)
+            raise(signal);
+        return;
+    }
+
+    // The divisor is always RCX (ECX when narrow).
+    uint64_t divisor = regs[REG_RCX];
+    bool zero = scope->wide ? divisor == 0 : (uint32_t)divisor == 0;
+    *scope->status = zero ? STATUS_DIVIDE_BY_ZERO : STATUS_DIVISION_OVERFLOW;
+
+    // RET on the program's behalf: its return address is right above what
+    // it has pushed, and the caller's RBP (if it saved it) right below.
+    uint64_t *return_address = (uint64_t *)regs[REG_RSP] + site->stack_depth;
+    if (site->framed)
+        regs[REG_RBP] = return_address[-1];
+    regs[REG_RIP] = *return_address;
+    regs[REG_RSP] = (greg_t)(return_address + 1);
+    regs[REG_RAX] = site->offset;
+}
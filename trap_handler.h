@@ -0,0 +1,88 @@
+/**
+ * @file trap_handler.h
+ * @author Jake Rogers (z1826513)
+ * @brief Turns a divide error in JIT-ed code into an ExecutionStatus,
+ * rather than letting the SIGFPE kill the whole process.
+ *
+ * IDIV faults when the divisor is 0, or when the quotient doesn't fit (the
+ * most negative value divided by -1). The code generator doesn't test for
+ * either of these before dividing. Instead, each IDIV it emits is recorded
+ * as a TrapSite in a side table. The site holds the IDIV's offset, how many
+ * qwords the program has pushed when it runs, and the token it came from.
+ *
+ * While a program with any sites runs, a TrapHandler::Scope on the calling
+ * thread points the SIGFPE handler at its code and side table. When a fault
+ * hits one of those sites, the handler knows exactly where the program's
+ * return address is. It returns from the program on its behalf, restoring
+ * RBP if the program had a frame, and sets the program's status. The result
+ * register holds the site's offset, so the caller can report the token. The
+ * code itself pays nothing: there is no extra instruction anywhere in it.
+ *
+ * A SIGFPE anywhere else (or with no Scope) isn't ours. The handler puts
+ * the previous action back and returns, so the fault happens again and the
+ * process dies as it always did.
+ */
+#ifndef TRAP_HANDLER_H
+#define TRAP_HANDLER_H
+
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "execution_exception.h"
+
+// One instruction of an assembled program which can fault. Plain data, so
+// the code cache can store it as is.
+struct TrapSite
+{
+    uint32_t offset;        // Of the instruction, from the start of the code
+    uint32_t stack_depth;   // Qwords pushed since entry when it runs (JIT only)
+    uint32_t line;          // Of the token it was encoded for
+    uint32_t column;
+    uint8_t framed;         // The first pushed is the caller's RBP (JIT only)
+    uint8_t reserved[3];
+};
+
+class TrapHandler
+{
+public:
+    // Installs the SIGFPE handler the first time it's called.
+    static TrapHandler& instance();
+
+    /**
+     * Arms the handler for one run of a program on the calling thread. A
+     * divide fault at one of 'sites' returns from the program with 'status'
+     * set to STATUS_DIVIDE_BY_ZERO or STATUS_DIVISION_OVERFLOW, and the
+     * site's offset as its result. 'wide' tells the two apart, by how much
+     * of the divisor (always RCX) to look at.
+     */
+    class Scope
+    {
+    public:
+        Scope(const unsigned char* code, int length, const std::vector<TrapSite>& sites, bool wide,
+            ExecutionStatus* status);
+        ~Scope();
+
+    private:
+        friend class TrapHandler;
+
+        const unsigned char* code;
+        int length;
+        const std::vector<TrapSite>& sites;
+        bool wide;
+        ExecutionStatus* status;
+        Scope* outer;       // Scopes nest if a program is run from another's Scope
+    };
+
+    // The site at 'offset', or nullptr. 'sites' must be sorted by offset, as
+    // assembly leaves them.
+    static const TrapSite* find(const std::vector<TrapSite>& sites, uint32_t offset);
+
+private:
+    TrapHandler();
+
+    static void handle(int signal, siginfo_t* info, void* context);
+};
+
+#endif
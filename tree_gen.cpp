@@ -3,8 +3,27 @@
 tree_gen::tree_gen(std::vector<Token> tokens)
 {
     token_iterator = -1;
-    this->tokens = tokens;
-    tokens.push_back(Token("Parser EOX", 3)); // Add a ETX to signify an End of Expression. There should be no attempt to advance beyond this token.
+    owned_tokens = tokens;
+    owned_tokens.push_back(Token("Parser EOX", 3)); // Add a ETX to signify an End of Expression. There should be no attempt to advance beyond this token.
+    this->tokens = &owned_tokens;
+    token_end = owned_tokens.size();
+}
+
+tree_gen::tree_gen(const std::vector<Token> &tokens, int start, int end)
+{
+    this->tokens = &tokens;
+    token_end = end;
+    seek(start);
+}
+
+void tree_gen::seek(int position)
+{
+    // A borrowed bank has no ETX of its own, so one is made up past its end.
+    token_iterator = position;
+    if (position < token_end)
+        current_token = (*tokens)[position];
+    else
+        current_token = Token("Parser EOX", 3);
 }
 
 void tree_gen::advance_iterator()
@@ -13,8 +32,7 @@ void tree_gen::advance_iterator()
     {
         throw ParseException("Attempted to advance beyond End of Expression during code tree generation.", current_token);
     }
-    token_iterator++;
-    current_token = tokens[token_iterator];
+    seek(token_iterator + 1);
 }
 
 bool tree_gen::finished()
@@ -46,8 +64,8 @@ void tree_gen::print_tree(Node *n)
     // depending on which one is valid first.
     if (n->token.i_value != INT32_MIN) 
         std::cout << n->token.i_value;
-    else if (!n->token.value.empty())
-        std::cout << n->token.value;
+    else if (n->token.text != 0)
+        std::cout << n->token.value();
     else
         std::cout << n->token.id;
 
@@ -58,34 +76,44 @@ void tree_gen::print_tree(Node *n)
     }
 }
 
-void tree_gen::print_tree_pretty(Node* n, uint depth)
+void tree_gen::print_tree_pretty(Node* n, uint depth, OutputBuffer &out)
 {
     // PRE-order, visit the node, then handle the child, then sibling.
 
     // Add indent a number of times equal to the depth at this level.
     for (uint i = 0; i < depth; i++)
     {
-        printf("  ");
+        out << "  ";
     }
 
     // Tokens will be printed by i_value, value, then ID, 
     // depending on which one is valid first.
     if (n->token.i_value != INT32_MIN)
-        std::cout << n->token.i_value;
-    else if (!n->token.value.empty())
-        std::cout << n->token.value;
+        out << n->token.i_value;
+    else if (n->token.text != 0)
+        out << n->token.value();
     else
-        std::cout << n->token.id;
+        out << n->token.id;
 
-    std::cout << std::endl;
+    out << '\n';
 
     // Going to the child increases the depth by one.
     if (n->child != nullptr)
-        print_tree_pretty(n->child, depth + 1);
+        print_tree_pretty(n->child, depth + 1, out);
 
     // Going to the sibling retains the same depth.
     if (n->sibling != nullptr)
-        print_tree_pretty(n->sibling, depth);
+        print_tree_pretty(n->sibling, depth, out);
+}
+
+size_t tree_gen::count_nodes(Node *n)
+{
+    size_t count = 1;
+    if (n->child != nullptr)
+        count += count_nodes(n->child);
+    if (n->sibling != nullptr)
+        count += count_nodes(n->sibling);
+    return count;
 }
 
 void tree_gen::delete_tree(Node *n)
@@ -190,7 +218,7 @@ void tree_gen::negation(Node *&n)
     {
         Token op_token = current_token;
         op_token.id = TypeID::NEGATE;
-        op_token.value = "u-";
+        op_token.setValue("u-");
         advance_iterator();
         unit(t2);
 
@@ -202,7 +230,7 @@ void tree_gen::negation(Node *&n)
     {
         Token op_token = current_token;
         op_token.id = TypeID::UPLUS;
-        op_token.value = "u+";
+        op_token.setValue("u+");
         advance_iterator();
         unit(t2);
 
@@ -218,8 +246,8 @@ void tree_gen::negation(Node *&n)
 
 void tree_gen::unit(Node *&n)
 {
-    // Ripple a single integer back up the stack.
-    if (current_token.id == TypeID::INTEGER)
+    // Ripple a single integer or variable back up the stack.
+    if (current_token.id == TypeID::INTEGER || current_token.id == TypeID::IDENT)
     {
         n = new Node(current_token);
         advance_iterator();
@@ -23,6 +23,7 @@
 #include <vector>
 
 #include "node.h"
+#include "output_buffer.h"
 #include "parse_exception.h"
 
 using std::cout;
@@ -35,10 +36,26 @@ public:
     // expressions from.
     tree_gen(std::vector<Token> tokens);
 
+    // Create a generator over the tokens [start, end) of a bank without
+    // copying it. The tokens must outlive the generator.
+    tree_gen(const std::vector<Token> &tokens, int start, int end);
+
+    // 'tokens' may point at this generator's own copy of the bank, which a
+    // copy or move would leave behind, so neither is allowed.
+    tree_gen(const tree_gen&) = delete;
+    tree_gen& operator=(const tree_gen&) = delete;
+
+    // Continue with the expression starting at token 'position', skipping
+    // any in between.
+    void seek(int position);
+
     // When true, the token bank is empty. No more valid expressions can
     // be created.
     bool finished();
 
+    // Index of the token the next expression starts at.
+    int token_position() const {return (token_iterator < 0) ? 0 : token_iterator;}
+
     // Parse through the token vector to build an expression and head it's
     // parse tree at n.
     void create_parse_tree(Node *&n);
@@ -48,8 +65,12 @@ public:
     void print_tree(Node *n);
 
     // Print out a somewhat easier to view PRE-order traversal of a parse tree,
-    // using indentation to denote parent-child relations.
-    void print_tree_pretty(Node *n, uint depth);
+    // using indentation to denote parent-child relations. Printed to 'out'.
+    void print_tree_pretty(Node *n, uint depth, OutputBuffer &out);
+
+    // Count the nodes in a parse tree, a rough measure of how much work
+    // assembling and running it will be.
+    size_t count_nodes(Node *n);
 
     // Delete all of the memory in a parse tree in a post-order traversal.
     // This can be done immediately once the tree is stored as a program!
@@ -98,11 +119,13 @@ private:
     // A negation is a unary + or negation on a single number.
     void negation(Node *&n);
 
-    // A unit is either a single number, or the result of a new parentheized expression.
+    // A unit is either a single number, a variable, or the result of a new parentheized expression.
     void unit(Node *&n);
 
     Token current_token;        // tokens[token_iterator]
-    std::vector<Token> tokens;  // List of tokens potentially describing one or many arithmetic expressions
+    std::vector<Token> owned_tokens;    // A copy of the bank, unless it's borrowed
+    const std::vector<Token> *tokens;   // List of tokens potentially describing one or many arithmetic expressions
+    int token_end;              // Tokens from here on are past the End of Expression
     int token_iterator;         // Iterator for tokens.
 };
 
@@ -0,0 +1,195 @@
+#include "utf8.h"
+
+#include <cstring>
+#include <tmmintrin.h>
+
+size_t encode_utf8(uint32_t code_point, char *out)
+{
+    // The lead byte's marker, and how many of the code point's top bits it keeps, by length.
+    static const uint8_t lead_marker[UTF8_MAX_LENGTH + 1] = {0, 0x00, 0xc0, 0xe0, 0xf0};
+    static const uint8_t lead_mask[UTF8_MAX_LENGTH + 1] = {0, 0x7f, 0x1f, 0x0f, 0x07};
+
+    if (code_point > UTF8_MAX_CODE_POINT || (code_point >= 0xd800 && code_point < 0xe000))
+        return 0;
+
+    size_t length = 1 + (code_point >= 0x80) + (code_point >= 0x800) + (code_point >= 0x10000);
+    out[0] = lead_marker[length] | ((code_point >> (6 * (length - 1))) & lead_mask[length]);
+    for (size_t i = 1; i < length; i++)
+        out[i] = 0x80 | ((code_point >> (6 * (length - 1 - i))) & 0x3f);
+    return length;
+}
+
+size_t validate_utf8_scalar(const char *bytes, size_t length)
+{
+    const uint8_t *in = (const uint8_t *)bytes;
+    size_t i = 0;
+    while (i < length)
+    {
+        // Eight ASCII bytes at a time.
+        uint64_t word;
+        if (i + 8 <= length && (memcpy(&word, in + i, 8), (word & 0x8080808080808080ull) == 0))
+        {
+            i += 8;
+            continue;
+        }
+
+        uint8_t lead = in[i];
+        if (lead < 0x80)
+        {
+            i++;
+            continue;
+        }
+
+        // The sequence's length, and the range its second byte must be in
+        // (narrower after some leads, ruling out overlong forms, surrogates
+        // and code points past U+10FFFF).
+        size_t sequence;
+        uint8_t low = 0x80, high = 0xbf;
+        if (lead >= 0xc2 && lead <= 0xdf)
+            sequence = 2;
+        else if (lead >= 0xe0 && lead <= 0xef)
+        {
+            sequence = 3;
+            if (lead == 0xe0)
+                low = 0xa0;
+            else if (lead == 0xed)
+                high = 0x9f;
+        }
+        else if (lead >= 0xf0 && lead <= 0xf4)
+        {
+            sequence = 4;
+            if (lead == 0xf0)
+                low = 0x90;
+            else if (lead == 0xf4)
+                high = 0x8f;
+        }
+        else
+            return i;
+
+        if (i + sequence > length || in[i + 1] < low || in[i + 1] > high)
+            return i;
+        for (size_t c = 2; c < sequence; c++)
+            if ((in[i + c] & 0xc0) != 0x80)
+                return i;
+        i += sequence;
+    }
+    return length;
+}
+
+// What can be wrong with a pair of adjacent bytes, one bit per problem. A
+// pair is bad if a bit is set in all three of the tables below: by the
+// high and low nibbles of the first byte, and the high nibble of the second.
+#define TOO_SHORT       (1 << 0)    // A lead not followed by a continuation
+#define TOO_LONG        (1 << 1)    // ASCII followed by a continuation
+#define OVERLONG_3      (1 << 2)    // E0 followed by 80..9F
+#define TOO_LARGE       (1 << 3)    // F4 followed by 90..BF, or F5..FF
+#define SURROGATE       (1 << 4)    // ED followed by A0..BF
+#define OVERLONG_2      (1 << 5)    // C0 or C1
+#define TOO_LARGE_1000  (1 << 6)    // F5..FF followed by 80..8F
+#define OVERLONG_4      (1 << 6)    // F0 followed by 80..8F
+#define TWO_CONTS       (1 << 7)    // Two continuations (fine if a 3 or 4 byte lead is behind them)
+#define CARRY           (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+__attribute__((target("ssse3")))
+static inline __m128i high_nibbles(__m128i bytes)
+{
+    return _mm_and_si128(_mm_srli_epi16(bytes, 4), _mm_set1_epi8(0x0f));
+}
+
+__attribute__((target("ssse3")))
+static size_t validate_utf8_ssse3(const char *bytes, size_t length)
+{
+    static const uint8_t byte_1_high[16] = {
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2,
+        TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4};
+    static const uint8_t byte_1_low[16] = {
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+        CARRY | OVERLONG_2,
+        CARRY,
+        CARRY,
+        CARRY | TOO_LARGE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000};
+    static const uint8_t byte_2_high[16] = {
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT};
+
+    const __m128i byte_1_high_table = _mm_loadu_si128((const __m128i *)byte_1_high);
+    const __m128i byte_1_low_table = _mm_loadu_si128((const __m128i *)byte_1_low);
+    const __m128i byte_2_high_table = _mm_loadu_si128((const __m128i *)byte_2_high);
+
+    // A block ending in a lead whose continuations run past it.
+    const __m128i incomplete_limit = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+
+    __m128i error = _mm_setzero_si128();
+    __m128i previous = _mm_setzero_si128();
+    __m128i previous_incomplete = _mm_setzero_si128();
+
+    for (size_t i = 0; i < length; i += 16)
+    {
+        __m128i input;
+        if (i + 16 <= length)
+            input = _mm_loadu_si128((const __m128i *)(bytes + i));
+        else
+        {
+            // Pad the last block with ASCII, which ends any sequence early.
+            char tail[16] = {0};
+            memcpy(tail, bytes + i, length - i);
+            input = _mm_loadu_si128((const __m128i *)tail);
+        }
+
+        if (_mm_movemask_epi8(input) == 0)
+        {
+            // All ASCII: only a sequence left open by the last block can be wrong.
+            error = _mm_or_si128(error, previous_incomplete);
+            previous_incomplete = _mm_setzero_si128();
+        }
+        else
+        {
+            __m128i previous_1 = _mm_alignr_epi8(input, previous, 15);
+            __m128i special = _mm_and_si128(
+                _mm_and_si128(_mm_shuffle_epi8(byte_1_high_table, high_nibbles(previous_1)),
+                    _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(previous_1, _mm_set1_epi8(0x0f)))),
+                _mm_shuffle_epi8(byte_2_high_table, high_nibbles(input)));
+
+            // Bytes two or three after a 3 or 4 byte lead must be
+            // continuations, and are the only places two in a row are fine.
+            __m128i third = _mm_subs_epu8(_mm_alignr_epi8(input, previous, 14), _mm_set1_epi8(0xe0 - 0x80));
+            __m128i fourth = _mm_subs_epu8(_mm_alignr_epi8(input, previous, 13), _mm_set1_epi8(0xf0 - 0x80));
+            __m128i must_continue = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char)0x80));
+
+            error = _mm_or_si128(error, _mm_xor_si128(must_continue, special));
+            previous_incomplete = _mm_subs_epu8(input, incomplete_limit);
+        }
+        previous = input;
+    }
+    error = _mm_or_si128(error, previous_incomplete);
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xffff)
+        return length;
+    return validate_utf8_scalar(bytes, length);
+}
+
+size_t validate_utf8(const char *bytes, size_t length)
+{
+    static const bool ssse3 = (__builtin_cpu_init(), __builtin_cpu_supports("ssse3"));
+    return ssse3 ? validate_utf8_ssse3(bytes, length) : validate_utf8_scalar(bytes, length);
+}
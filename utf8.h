@@ -0,0 +1,49 @@
+/**
+ * @file utf8.h
+ * @author Jake Rogers (z1826513)
+ * @brief Encoding code points as UTF-8 and validating UTF-8 text, for
+ * string literals.
+ *
+ * encode_utf8() is table-driven: the number of bytes comes from comparing
+ * the code point against the three length boundaries, and the lead byte's
+ * marker and each byte's shift from tables indexed by that length, so
+ * there's no per-length branch and nothing is allocated.
+ *
+ * validate_utf8() checks that bytes are well-formed UTF-8 (no stray or
+ * missing continuation bytes, overlong forms, surrogates, or code points
+ * past U+10FFFF). On CPUs with SSSE3 it checks 16 bytes at a time with
+ * three nibble-indexed table lookups per block, the method of Keiser and
+ * Lemire ("Validating UTF-8 In Less Than One Instruction Per Byte"), and
+ * only falls back to the byte-at-a-time check to find where a bad block
+ * went wrong. Elsewhere the byte-at-a-time check is all there is.
+ */
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define UTF8_MAX_CODE_POINT 0x10ffff
+#define UTF8_MAX_LENGTH 4
+
+/**
+ * @brief Write the UTF-8 encoding of 'code_point' to 'out', which must have
+ * room for UTF8_MAX_LENGTH bytes.
+ *
+ * @return The number of bytes written, or 0 (writing nothing) if the code
+ * point is a surrogate or past U+10FFFF, which UTF-8 can't encode.
+ */
+size_t encode_utf8(uint32_t code_point, char *out);
+
+/**
+ * @brief Check that 'length' bytes are well-formed UTF-8.
+ *
+ * @return 'length' if they are, otherwise the offset of the first byte of
+ * the first malformed sequence.
+ */
+size_t validate_utf8(const char *bytes, size_t length);
+
+// The same, without SIMD, for comparison and CPUs without SSSE3.
+size_t validate_utf8_scalar(const char *bytes, size_t length);
+
+#endif
@@ -0,0 +1,372 @@
+#include "x86_assembler.h"
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+
+static inline uint8_t low3(Reg reg) {return (uint8_t)reg & 7;}
+
+static inline bool fits_int8(int64_t value) {return value >= INT8_MIN && value <= INT8_MAX;}
+
+void X86Assembler::imm32(int32_t value)
+{
+    // Little-endian, lowest byte first.
+    for (int i = 0; i < 4; i++)
+    {
+        byte(value & 0xff);
+        value >>= 8;
+    }
+}
+
+void X86Assembler::rex(Width width, uint8_t reg, uint8_t index, uint8_t base)
+{
+    uint8_t prefix = 0x40 | ((width == Width::Q) << 3) | (((reg >> 3) & 1) << 2) | (((index >> 3) & 1) << 1)
+        | ((base >> 3) & 1);
+    if (prefix != 0x40)
+        byte(prefix);
+}
+
+void X86Assembler::opcode(uint16_t opcode)
+{
+    if (opcode > 0xff)
+        byte(opcode >> 8);
+    byte(opcode & 0xff);
+}
+
+void X86Assembler::op_rr(Width width, uint16_t op, uint8_t reg, uint8_t rm)
+{
+    rex(width, reg, 0, rm);
+    opcode(op);
+    byte(0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void X86Assembler::op_rm(Width width, uint16_t op, uint8_t reg, const Mem &mem)
+{
+    rex(width, reg, mem.indexed ? (uint8_t)mem.index : 0, (uint8_t)mem.base);
+    opcode(op);
+
+    // RBP and R13 as a base with mod 00 mean RIP-relative, so they always
+    // take a displacement, even of 0.
+    uint8_t mod;
+    if (mem.disp == 0 && low3(mem.base) != 5)
+        mod = 0;
+    else if (fits_int8(mem.disp))
+        mod = 1;
+    else
+        mod = 2;
+
+    // RSP and R12 as a base can only be given through a SIB byte.
+    bool sib = mem.indexed || low3(mem.base) == 4;
+    byte((mod << 6) | ((reg & 7) << 3) | (sib ? 4 : low3(mem.base)));
+    if (sib)
+    {
+        uint8_t scale = (mem.scale == 8) ? 3 : (mem.scale == 4) ? 2 : (mem.scale == 2) ? 1 : 0;
+        byte((scale << 6) | ((mem.indexed ? low3(mem.index) : 4) << 3) | low3(mem.base));
+    }
+
+    if (mod == 1)
+        byte((uint8_t)mem.disp);
+    else if (mod == 2)
+        imm32(mem.disp);
+}
+
+void X86Assembler::group1(Width width, uint8_t extension, Reg dst, int32_t value)
+{
+    if (fits_int8(value))
+    {
+        op_rr(width, 0x83, extension, (uint8_t)dst);
+        byte((uint8_t)value);
+    }
+    else if (dst == Reg::RAX)
+    {
+        // The accumulator has its own form without a ModR/M byte.
+        rex(width, 0, 0, 0);
+        byte((extension << 3) | 5);
+        imm32(value);
+    }
+    else
+    {
+        op_rr(width, 0x81, extension, (uint8_t)dst);
+        imm32(value);
+    }
+}
+
+void X86Assembler::push(Reg reg)
+{
+    rex(Width::D, 0, 0, (uint8_t)reg);
+    byte(0x50 + low3(reg));
+}
+
+void X86Assembler::push(const Mem &mem)
+{
+    // PUSH is 64 bits without REX.W. FF /6
+    op_rm(Width::D, 0xff, 6, mem);
+}
+
+void X86Assembler::push(int32_t value)
+{
+    if (fits_int8(value))
+    {
+        byte(0x6a);
+        byte((uint8_t)value);
+    }
+    else
+    {
+        byte(0x68);
+        imm32(value);
+    }
+}
+
+void X86Assembler::pop(Reg reg)
+{
+    rex(Width::D, 0, 0, (uint8_t)reg);
+    byte(0x58 + low3(reg));
+}
+
+void X86Assembler::mov(Width width, Reg dst, Reg src)
+{
+    op_rr(width, 0x89, (uint8_t)src, (uint8_t)dst);
+}
+
+void X86Assembler::mov(Width width, Reg dst, const Mem &src)
+{
+    op_rm(width, 0x8b, (uint8_t)dst, src);
+}
+
+void X86Assembler::mov(Width width, const Mem &dst, Reg src)
+{
+    op_rm(width, 0x89, (uint8_t)src, dst);
+}
+
+void X86Assembler::mov(Width width, const Mem &dst, int32_t value)
+{
+    op_rm(width, 0xc7, 0, dst);
+    imm32(value);
+}
+
+void X86Assembler::mov(Reg dst, int64_t value)
+{
+    if (value >= 0 && value <= UINT32_MAX)
+    {
+        // MOV r32, imm32 zero-extends into the whole register.
+        rex(Width::D, 0, 0, (uint8_t)dst);
+        byte(0xb8 + low3(dst));
+        imm32((int32_t)value);
+    }
+    else if (value >= INT32_MIN && value <= INT32_MAX)
+    {
+        // MOV r/m64, imm32 sign-extends.
+        op_rr(Width::Q, 0xc7, 0, (uint8_t)dst);
+        imm32((int32_t)value);
+    }
+    else
+    {
+        rex(Width::Q, 0, 0, (uint8_t)dst);
+        byte(0xb8 + low3(dst));
+        imm32(value & 0xffffffff);
+        imm32(value >> 32);
+    }
+}
+
+void X86Assembler::add(Width width, Reg dst, Reg src) {op_rr(width, 0x01, (uint8_t)src, (uint8_t)dst);}
+void X86Assembler::add(Width width, Reg dst, int32_t value) {group1(width, 0, dst, value);}
+void X86Assembler::sub(Width width, Reg dst, Reg src) {op_rr(width, 0x29, (uint8_t)src, (uint8_t)dst);}
+void X86Assembler::sub(Width width, Reg dst, int32_t value) {group1(width, 5, dst, value);}
+void X86Assembler::cmp(Width width, Reg left, Reg right) {op_rr(width, 0x39, (uint8_t)right, (uint8_t)left);}
+void X86Assembler::cmp(Width width, Reg left, int32_t value) {group1(width, 7, left, value);}
+void X86Assembler::test(Width width, Reg left, Reg right) {op_rr(width, 0x85, (uint8_t)right, (uint8_t)left);}
+void X86Assembler::xor_(Width width, Reg dst, Reg src) {op_rr(width, 0x31, (uint8_t)src, (uint8_t)dst);}
+void X86Assembler::imul(Width width, Reg dst, Reg src) {op_rr(width, 0x0faf, (uint8_t)dst, (uint8_t)src);}
+void X86Assembler::neg(Width width, Reg reg) {op_rr(width, 0xf7, 3, (uint8_t)reg);}
+void X86Assembler::idiv(Width width, Reg divisor) {op_rr(width, 0xf7, 7, (uint8_t)divisor);}
+
+void X86Assembler::sign_extend_rax(Width width)
+{
+    rex(width, 0, 0, 0);
+    byte(0x99);
+}
+
+void X86Assembler::jump_to(Label &target, uint8_t short_opcode, uint16_t near_opcode)
+{
+    if (target.position >= 0)
+    {
+        int back = target.position - (offset + 2);
+        if (fits_int8(back))
+        {
+            byte(short_opcode);
+            byte((uint8_t)back);
+            return;
+        }
+
+        opcode(near_opcode);
+        imm32(target.position - (offset + 4));
+        return;
+    }
+
+    opcode(near_opcode);
+    target.fixups.push_back(offset);
+    imm32(0);
+}
+
+void X86Assembler::jcc(Cond cond, Label &target)
+{
+    jump_to(target, 0x70 + (uint8_t)cond, 0x0f80 + (uint8_t)cond);
+}
+
+void X86Assembler::jmp(Label &target)
+{
+    jump_to(target, 0xeb, 0xe9);
+}
+
+void X86Assembler::bind(Label &label)
+{
+    label.position = offset;
+    for (int fixup : label.fixups)
+    {
+        int32_t displacement = label.position - (fixup + 4);
+        memcpy(code + fixup, &displacement, 4);
+    }
+    label.fixups.clear();
+}
+
+void X86Assembler::vzeroupper()
+{
+    byte(0xc5);
+    byte(0xf8);
+    byte(0x77);
+}
+
+bool X86Assembler::self_check(std::ostream &out)
+{
+    struct Case
+    {
+        const char *text;
+        std::function<void(X86Assembler&)> emit;
+        std::vector<uint8_t> expected;
+    };
+
+    const Width D = Width::D;
+    const Width Q = Width::Q;
+
+    // Too far back for a short jump.
+    std::vector<uint8_t> long_jump(130, 0xcc);
+    long_jump.insert(long_jump.end(), {0x0f, 0x85, 0x78, 0xff, 0xff, 0xff});
+
+    const std::vector<Case> cases = {
+        {"push rax", [](X86Assembler &a) {a.push(Reg::RAX);}, {0x50}},
+        {"push r12", [](X86Assembler &a) {a.push(Reg::R12);}, {0x41, 0x54}},
+        {"pop rbp", [](X86Assembler &a) {a.pop(Reg::RBP);}, {0x5d}},
+        {"pop r15", [](X86Assembler &a) {a.pop(Reg::R15);}, {0x41, 0x5f}},
+        {"push 5", [](X86Assembler &a) {a.push(5);}, {0x6a, 0x05}},
+        {"push -1", [](X86Assembler &a) {a.push(-1);}, {0x6a, 0xff}},
+        {"push 128", [](X86Assembler &a) {a.push(128);}, {0x68, 0x80, 0x00, 0x00, 0x00}},
+        {"push -129", [](X86Assembler &a) {a.push(-129);}, {0x68, 0x7f, 0xff, 0xff, 0xff}},
+        {"push qword [rbp-8]", [](X86Assembler &a) {a.push(Mem(Reg::RBP, -8));}, {0xff, 0x75, 0xf8}},
+        {"push qword [rbp-256]", [](X86Assembler &a) {a.push(Mem(Reg::RBP, -256));},
+            {0xff, 0xb5, 0x00, 0xff, 0xff, 0xff}},
+        {"mov eax, [rdi]", [=](X86Assembler &a) {a.mov(D, Reg::RAX, Mem(Reg::RDI));}, {0x8b, 0x07}},
+        {"mov rax, [rdi+8]", [=](X86Assembler &a) {a.mov(Q, Reg::RAX, Mem(Reg::RDI, 8));}, {0x48, 0x8b, 0x47, 0x08}},
+        {"mov eax, [rdi+1024]", [=](X86Assembler &a) {a.mov(D, Reg::RAX, Mem(Reg::RDI, 1024));},
+            {0x8b, 0x87, 0x00, 0x04, 0x00, 0x00}},
+        {"mov eax, [rsp]", [=](X86Assembler &a) {a.mov(D, Reg::RAX, Mem(Reg::RSP));}, {0x8b, 0x04, 0x24}},
+        {"mov eax, [rbp]", [=](X86Assembler &a) {a.mov(D, Reg::RAX, Mem(Reg::RBP));}, {0x8b, 0x45, 0x00}},
+        {"mov r9d, [r13]", [=](X86Assembler &a) {a.mov(D, Reg::R9, Mem(Reg::R13));}, {0x45, 0x8b, 0x4d, 0x00}},
+        {"mov rax, [r12+16]", [=](X86Assembler &a) {a.mov(Q, Reg::RAX, Mem(Reg::R12, 16));},
+            {0x49, 0x8b, 0x44, 0x24, 0x10}},
+        {"mov eax, [rsi+rcx*4]", [=](X86Assembler &a) {a.mov(D, Reg::RAX, Mem(Reg::RSI, Reg::RCX, 4));},
+            {0x8b, 0x04, 0x8e}},
+        {"mov [rbp-8], rcx", [=](X86Assembler &a) {a.mov(Q, Mem(Reg::RBP, -8), Reg::RCX);}, {0x48, 0x89, 0x4d, 0xf8}},
+        {"mov rbp, rsp", [=](X86Assembler &a) {a.mov(Q, Reg::RBP, Reg::RSP);}, {0x48, 0x89, 0xe5}},
+        {"mov dword [rsi], 1", [=](X86Assembler &a) {a.mov(D, Mem(Reg::RSI), 1);},
+            {0xc7, 0x06, 0x01, 0x00, 0x00, 0x00}},
+        {"mov rax, 1", [](X86Assembler &a) {a.mov(Reg::RAX, (int64_t)1);}, {0xb8, 0x01, 0x00, 0x00, 0x00}},
+        {"mov r10, 5", [](X86Assembler &a) {a.mov(Reg::R10, (int64_t)5);}, {0x41, 0xba, 0x05, 0x00, 0x00, 0x00}},
+        {"mov rax, -1", [](X86Assembler &a) {a.mov(Reg::RAX, (int64_t)-1);},
+            {0x48, 0xc7, 0xc0, 0xff, 0xff, 0xff, 0xff}},
+        {"mov rax, 0x100000000", [](X86Assembler &a) {a.mov(Reg::RAX, (int64_t)0x100000000);},
+            {0x48, 0xb8, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00}},
+        {"add eax, ecx", [=](X86Assembler &a) {a.add(D, Reg::RAX, Reg::RCX);}, {0x01, 0xc8}},
+        {"add rax, rcx", [=](X86Assembler &a) {a.add(Q, Reg::RAX, Reg::RCX);}, {0x48, 0x01, 0xc8}},
+        {"add r8, r9", [=](X86Assembler &a) {a.add(Q, Reg::R8, Reg::R9);}, {0x4d, 0x01, 0xc8}},
+        {"sub eax, ecx", [=](X86Assembler &a) {a.sub(D, Reg::RAX, Reg::RCX);}, {0x29, 0xc8}},
+        {"imul eax, ecx", [=](X86Assembler &a) {a.imul(D, Reg::RAX, Reg::RCX);}, {0x0f, 0xaf, 0xc1}},
+        {"imul r11, rax", [=](X86Assembler &a) {a.imul(Q, Reg::R11, Reg::RAX);}, {0x4c, 0x0f, 0xaf, 0xd8}},
+        {"neg eax", [=](X86Assembler &a) {a.neg(D, Reg::RAX);}, {0xf7, 0xd8}},
+        {"neg rax", [=](X86Assembler &a) {a.neg(Q, Reg::RAX);}, {0x48, 0xf7, 0xd8}},
+        {"cdq", [=](X86Assembler &a) {a.sign_extend_rax(D);}, {0x99}},
+        {"cqo", [=](X86Assembler &a) {a.sign_extend_rax(Q);}, {0x48, 0x99}},
+        {"idiv ecx", [=](X86Assembler &a) {a.idiv(D, Reg::RCX);}, {0xf7, 0xf9}},
+        {"idiv r9", [=](X86Assembler &a) {a.idiv(Q, Reg::R9);}, {0x49, 0xf7, 0xf9}},
+        {"sub rsp, 16", [=](X86Assembler &a) {a.sub(Q, Reg::RSP, 16);}, {0x48, 0x83, 0xec, 0x10}},
+        {"sub rsp, 1024", [=](X86Assembler &a) {a.sub(Q, Reg::RSP, 1024);}, {0x48, 0x81, 0xec, 0x00, 0x04, 0x00, 0x00}},
+        {"add rcx, 8", [=](X86Assembler &a) {a.add(Q, Reg::RCX, 8);}, {0x48, 0x83, 0xc1, 0x08}},
+        {"add eax, 1000", [=](X86Assembler &a) {a.add(D, Reg::RAX, 1000);}, {0x05, 0xe8, 0x03, 0x00, 0x00}},
+        {"cmp rcx, rdx", [=](X86Assembler &a) {a.cmp(Q, Reg::RCX, Reg::RDX);}, {0x48, 0x39, 0xd1}},
+        {"cmp r8d, -2", [=](X86Assembler &a) {a.cmp(D, Reg::R8, -2);}, {0x41, 0x83, 0xf8, 0xfe}},
+        {"test rdx, rdx", [=](X86Assembler &a) {a.test(Q, Reg::RDX, Reg::RDX);}, {0x48, 0x85, 0xd2}},
+        {"xor ecx, ecx", [=](X86Assembler &a) {a.xor_(D, Reg::RCX, Reg::RCX);}, {0x31, 0xc9}},
+        {"ret", [](X86Assembler &a) {a.ret();}, {0xc3}},
+        {"vzeroupper", [](X86Assembler &a) {a.vzeroupper();}, {0xc5, 0xf8, 0x77}},
+        {"l: jb l", [](X86Assembler &a) {Label l; a.bind(l); a.jcc(Cond::B, l);}, {0x72, 0xfe}},
+        {"l: jmp l", [](X86Assembler &a) {Label l; a.bind(l); a.jmp(l);}, {0xeb, 0xfe}},
+        {"jo l; l:", [](X86Assembler &a) {Label l; a.jcc(Cond::O, l); a.bind(l);},
+            {0x0f, 0x80, 0x00, 0x00, 0x00, 0x00}},
+        {"l: (130 bytes) jne l", [](X86Assembler &a) {
+                Label l;
+                a.bind(l);
+                for (int i = 0; i < 130; i++)
+                    a.int3();
+                a.jcc(Cond::NE, l);
+            }, long_jump},
+    };
+
+    bool passed = true;
+    for (const Case &c : cases)
+    {
+        unsigned char buffer[256];
+        int length = 0;
+        X86Assembler assembler(buffer, length, sizeof(buffer));
+        c.emit(assembler);
+
+        if (length == (int)c.expected.size() && memcmp(buffer, c.expected.data(), length) == 0)
+            continue;
+
+        passed = false;
+        out << "x86 encoder: " << c.text << ":";
+        char hex[4];
+        for (int i = 0; i < length; i++)
+        {
+            snprintf(hex, sizeof(hex), " %02x", buffer[i]);
+            out << hex;
+        }
+        out << ", expected";
+        for (uint8_t b : c.expected)
+        {
+            snprintf(hex, sizeof(hex), " %02x", b);
+            out << hex;
+        }
+        out << std::endl;
+    }
+
+    // An instruction which doesn't fit must throw, not run past the buffer.
+    unsigned char small[8] = {};
+    int used = 3;
+    bool refused = false;
+    try
+    {
+        X86Assembler(small, used, 6).mov(Width::D, Reg::RAX, Mem(Reg::RBP, 0x100));
+    }
+    catch (CodeBufferFull &e)
+    {
+        refused = true;
+    }
+    if (!refused || used > 6 || small[6] != 0)
+    {
+        passed = false;
+        out << "x86 encoder: wrote past the end of a full buffer" << std::endl;
+    }
+
+    if (passed)
+        out << "x86 encoder: all " << cases.size() << " encodings match" << std::endl;
+    return passed;
+}
@@ -0,0 +1,163 @@
+/**
+ * @file x86_assembler.h
+ * @author Jake Rogers (z1826513)
+ * @brief A small typed x86-64 assembler for the general purpose instructions
+ * the code generators use.
+ *
+ * Registers, memory operands and condition codes are typed, so no caller
+ * works out ModR/M, SIB or REX bytes by hand. All sixteen registers can be
+ * used. Each instruction is given its shortest encoding:
+ *
+ *  - A REX prefix only when the operand is 64 bits or a register is R8-R15.
+ *  - 8-bit immediates (PUSH imm8, the 0x83 group) when the value fits, and
+ *    the short accumulator forms otherwise.
+ *  - No displacement for [reg] and disp8 for small ones. SIB is used only
+ *    when the base needs it (RSP, R12) or there's an index.
+ *  - Short jumps backwards to a bound label whenever they reach. Jumps
+ *    forwards are always rel32, since the distance isn't known yet, and
+ *    are patched when the label is bound.
+ *
+ * The assembler writes through to a code buffer and offset owned by its
+ * caller, so raw bytes (such as BatchProgram's VEX instructions) can still
+ * be mixed in. It's also given the buffer's capacity, and throws
+ * CodeBufferFull rather than write a byte past it. self_check() assembles a table of instructions and compares
+ * each against its known encoding (run it with ncc --check-encoder).
+ */
+#ifndef X86_ASSEMBLER_H
+#define X86_ASSEMBLER_H
+
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <vector>
+
+enum class Reg : uint8_t
+{
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// Operand size of an instruction: 32 bits (which zero the upper half of a
+// destination register) or 64.
+enum class Width : uint8_t
+{
+    D,
+    Q
+};
+
+// Condition codes, numbered as in the Jcc opcodes.
+enum class Cond : uint8_t
+{
+    O, NO, B, AE, E, NE, BE, A, S, NS, P, NP, L, GE, LE, G
+};
+
+// [base + index * scale + disp]
+struct Mem
+{
+    Reg base;
+    int32_t disp = 0;
+    bool indexed = false;
+    Reg index = Reg::RAX;
+    uint8_t scale = 1;      // 1, 2, 4 or 8
+
+    Mem(Reg base, int32_t disp = 0) : base(base), disp(disp) {}
+    Mem(Reg base, Reg index, uint8_t scale, int32_t disp = 0)
+        : base(base), disp(disp), indexed(true), index(index), scale(scale) {}
+};
+
+// A position in the code, which jumps can target before or after it's bound.
+struct Label
+{
+    int position = -1;              // Offset once bound
+    std::vector<int> fixups;        // Offsets of rel32s waiting for it
+};
+
+// Thrown when code doesn't fit in its buffer. Nothing has been written past
+// the end, the caller decides how to report it.
+class CodeBufferFull : public std::exception
+{
+public:
+    const char* what() const noexcept override {return "Code buffer full.";}
+};
+
+class X86Assembler
+{
+public:
+    X86Assembler(unsigned char *code, int &offset, int capacity) : code(code), offset(offset), capacity(capacity) {}
+
+    inline int position() const {return offset;}
+
+    // Raw bytes, for anything the assembler doesn't know.
+    inline void byte(uint8_t value)
+    {
+        if (offset >= capacity)
+            throw CodeBufferFull();
+        code[offset++] = value;
+    }
+    void imm32(int32_t value);
+
+    void push(Reg reg);
+    void push(const Mem& mem);          // PUSH QWORD [mem]
+    void push(int32_t value);           // Sign-extended to 64 bits
+    void pop(Reg reg);
+
+    void mov(Width width, Reg dst, Reg src);
+    void mov(Width width, Reg dst, const Mem& src);
+    void mov(Width width, const Mem& dst, Reg src);
+    void mov(Width width, const Mem& dst, int32_t value);
+
+    // Load 'value' into all 64 bits of 'dst'.
+    void mov(Reg dst, int64_t value);
+
+    void add(Width width, Reg dst, Reg src);
+    void add(Width width, Reg dst, int32_t value);
+    void sub(Width width, Reg dst, Reg src);
+    void sub(Width width, Reg dst, int32_t value);
+    void cmp(Width width, Reg left, Reg right);
+    void cmp(Width width, Reg left, int32_t value);
+    void test(Width width, Reg left, Reg right);
+    void xor_(Width width, Reg dst, Reg src);
+    void imul(Width width, Reg dst, Reg src);
+    void neg(Width width, Reg reg);
+
+    // Sign-extend RAX into RDX (CDQ or CQO), then divide RDX:RAX by 'divisor'.
+    void sign_extend_rax(Width width);
+    void idiv(Width width, Reg divisor);
+
+    void jcc(Cond cond, Label& target);
+    void jmp(Label& target);
+
+    // 'label' is here. Patches every jump to it so far.
+    void bind(Label& label);
+
+    void ret() {byte(0xc3);}
+    void int3() {byte(0xcc);}
+    void vzeroupper();
+
+    // Compare the encodings of a table of instructions with what they should
+    // be, printing any which differ to 'out'. Returns true if none do.
+    static bool self_check(std::ostream& out);
+
+private:
+    // REX prefix, if one is needed at all.
+    void rex(Width width, uint8_t reg, uint8_t index, uint8_t base);
+
+    // Opcode (1 or 2 bytes) and ModR/M for register to register, with 'reg'
+    // in the reg field (a register, or an opcode extension) and 'rm' in r/m.
+    void op_rr(Width width, uint16_t opcode, uint8_t reg, uint8_t rm);
+
+    // The same with a memory operand in r/m.
+    void op_rm(Width width, uint16_t opcode, uint8_t reg, const Mem& mem);
+
+    // The 0x83/0x81 group (ADD /0, SUB /5, CMP /7 ...) with an immediate.
+    void group1(Width width, uint8_t extension, Reg dst, int32_t value);
+
+    void opcode(uint16_t opcode);
+    void jump_to(Label& target, uint8_t short_opcode, uint16_t near_opcode);
+
+    unsigned char *code;
+    int &offset;
+    int capacity;
+};
+
+#endif